@@ -9,6 +9,10 @@ LOCAL_PRELINK_MODULE := false
 
 LOCAL_SRC_FILES := Overlay.cpp
 LOCAL_SRC_FILES += cameraHAL.cpp
+LOCAL_SRC_FILES += yuv420sp.cpp
+LOCAL_SRC_FILES += frame_trace.cpp
+LOCAL_SRC_FILES += perf_counters.cpp
+LOCAL_SRC_FILES += frame_interval.cpp
 
 LOCAL_CFLAGS := -DDLOPEN_LIBMMCAMERA=1 -DHW_ENCODE
 LOCAL_CFLAGS += -DNUM_PREVIEW_BUFFERS=4 -D_ANDROID_
@@ -30,3 +34,101 @@ LOCAL_SHARED_LIBRARIES := libutils libui libcamera_client liblog libcutils
 LOCAL_SHARED_LIBRARIES += libbinder libdl libhardware libcamera
 
 include $(BUILD_SHARED_LIBRARY)
+
+# yuv420sp kernel check, NEON on the device
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := yuv420sp_bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := yuv420sp.cpp yuv420sp_bench.cpp
+LOCAL_CFLAGS := -DUSE_NEON_CONVERSION
+
+include $(BUILD_EXECUTABLE)
+
+# yuv420sp kernel check, scalar reference on the host
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := yuv420sp_bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := yuv420sp.cpp yuv420sp_bench.cpp
+LOCAL_LDLIBS := -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# mdp_blit routing and CPU fallback check, on the host
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := mdp_blit_check
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := mdp_blit.cpp yuv420sp.cpp mdp_blit_check.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# setParameters attribute lookup replay over the HAL's tables; device
+# only, the parameter names live in libcamera_client
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := attr_table_bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := attr_table_bench.cpp
+LOCAL_C_INCLUDES := $(TOP)/frameworks/base/include
+LOCAL_SHARED_LIBRARIES := libcamera_client libutils
+
+include $(BUILD_EXECUTABLE)
+
+# liboemcamera and camera driver stand-in, to run the HAL on the host
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := liboemcamera
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := oemcamera_sim.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/sim_host $(LOCAL_PATH)/../include
+LOCAL_LDLIBS := -lpthread -lrt
+
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera_sim_run
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := camera_sim_run.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/sim_host $(LOCAL_PATH)/../include
+LOCAL_SHARED_LIBRARIES := liboemcamera
+LOCAL_LDLIBS := -ldl -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# the same stand-in on the device, preloaded under the real library's name
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := liboemcamera_sim
+LOCAL_MODULE_STEM := liboemcamera
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA)/camera_sim
+LOCAL_MODULE_TAGS := optional
+LOCAL_PRELINK_MODULE := false
+
+LOCAL_SRC_FILES := oemcamera_sim.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include
+LOCAL_SHARED_LIBRARIES := libcutils
+
+include $(BUILD_SHARED_LIBRARY)
+
+# open/preview/record/snapshot latencies through camera_device_ops_t
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := camera_hal_bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := camera_hal_bench.cpp
+LOCAL_SHARED_LIBRARIES := libhardware libcutils
+
+include $(BUILD_EXECUTABLE)
@@ -21,6 +21,8 @@
 #include <utils/Log.h>
 
 #include "QualcommCameraHardware.h"
+#include "attr_table.h"
+#include "frame_trace.h"
 
 #include <utils/Errors.h>
 #include <utils/threads.h>
@@ -81,7 +83,6 @@ extern "C" {
 #define DEFAULT_PICTURE_HEIGHT 480
 #define THUMBNAIL_BUFFER_SIZE (THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * 3/2)
 #define MAX_ZOOM_LEVEL 5
-#define NOT_FOUND -1
 // Number of video buffers held by kernal (initially 1,2 &3)
 #define ACTIVE_VIDEO_BUFFERS 3
 
@@ -196,12 +197,6 @@ typedef struct crop_info_struct {
     int32_t h;
 } zoom_crop_info;
 
-union zoomimage
-{
-    char d[sizeof(struct mdp_blit_req_list) + sizeof(struct mdp_blit_req) * 1];
-    struct mdp_blit_req_list list;
-} zoomImage;
-
 //Default to QVGA
 #define DEFAULT_PREVIEW_WIDTH 320
 #define DEFAULT_PREVIEW_HEIGHT 240
@@ -324,16 +319,6 @@ static  android::FPSRange FpsRangesSupported[1] = {android::FPSRange(MINIMUM_FPS
 #define FPS_RANGES_SUPPORTED_COUNT (sizeof(FpsRangesSupported)/sizeof(FpsRangesSupported[0]))
 
 #define JPEG_THUMBNAIL_SIZE_COUNT (sizeof(jpeg_thumbnail_sizes)/sizeof(camera_size_type))
-static int attr_lookup(const str_map arr[], int len, const char *name)
-{
-    if (name) {
-        for (int i = 0; i < len; i++) {
-            if (!strcmp(arr[i].desc, name))
-                return arr[i].val;
-        }
-    }
-    return NOT_FOUND;
-}
 
 // round to the next power of two
 static inline unsigned clp2(unsigned x)
@@ -368,46 +353,6 @@ static int HAL_currentCameraId = 0;
 
 namespace android {
 
-static const int PICTURE_FORMAT_JPEG = 1;
-static const int PICTURE_FORMAT_RAW = 2;
-
-// from aeecamera.h
-static const str_map whitebalance[] = {
-    { CameraParameters::WHITE_BALANCE_AUTO,            CAMERA_WB_AUTO },
-    { CameraParameters::WHITE_BALANCE_INCANDESCENT,    CAMERA_WB_INCANDESCENT },
-    { CameraParameters::WHITE_BALANCE_FLUORESCENT,     CAMERA_WB_FLUORESCENT },
-    { CameraParameters::WHITE_BALANCE_DAYLIGHT,        CAMERA_WB_DAYLIGHT },
-    { CameraParameters::WHITE_BALANCE_CLOUDY_DAYLIGHT, CAMERA_WB_CLOUDY_DAYLIGHT }
-};
-
-// from camera_effect_t. This list must match aeecamera.h
-static const str_map effects[] = {
-    { CameraParameters::EFFECT_NONE,       CAMERA_EFFECT_OFF },
-    { CameraParameters::EFFECT_MONO,       CAMERA_EFFECT_MONO },
-    { CameraParameters::EFFECT_NEGATIVE,   CAMERA_EFFECT_NEGATIVE },
-    { CameraParameters::EFFECT_SOLARIZE,   CAMERA_EFFECT_SOLARIZE },
-    { CameraParameters::EFFECT_SEPIA,      CAMERA_EFFECT_SEPIA },
-    { CameraParameters::EFFECT_POSTERIZE,  CAMERA_EFFECT_POSTERIZE },
-    { CameraParameters::EFFECT_WHITEBOARD, CAMERA_EFFECT_WHITEBOARD },
-    { CameraParameters::EFFECT_BLACKBOARD, CAMERA_EFFECT_BLACKBOARD },
-    { CameraParameters::EFFECT_AQUA,       CAMERA_EFFECT_AQUA }
-};
-
-// from qcamera/common/camera.h
-static const str_map autoexposure[] = {
-    { CameraParameters::AUTO_EXPOSURE_FRAME_AVG,  CAMERA_AEC_FRAME_AVERAGE },
-    { CameraParameters::AUTO_EXPOSURE_CENTER_WEIGHTED, CAMERA_AEC_CENTER_WEIGHTED },
-    { CameraParameters::AUTO_EXPOSURE_SPOT_METERING, CAMERA_AEC_SPOT_METERING }
-};
-
-// from qcamera/common/camera.h
-static const str_map antibanding[] = {
-    { CameraParameters::ANTIBANDING_OFF,  CAMERA_ANTIBANDING_OFF },
-    { CameraParameters::ANTIBANDING_50HZ, CAMERA_ANTIBANDING_50HZ },
-    { CameraParameters::ANTIBANDING_60HZ, CAMERA_ANTIBANDING_60HZ },
-    { CameraParameters::ANTIBANDING_AUTO, CAMERA_ANTIBANDING_AUTO }
-};
-
 /* Mapping from MCC to antibanding type */
 struct country_map {
     uint32_t country_code;
@@ -615,32 +560,6 @@ static struct country_map country_numeric[] = {
 };
 
 
-static const str_map scenemode[] = {
-    { CameraParameters::SCENE_MODE_AUTO,           CAMERA_BESTSHOT_OFF },
-    { CameraParameters::SCENE_MODE_ACTION,         CAMERA_BESTSHOT_ACTION },
-    { CameraParameters::SCENE_MODE_PORTRAIT,       CAMERA_BESTSHOT_PORTRAIT },
-    { CameraParameters::SCENE_MODE_LANDSCAPE,      CAMERA_BESTSHOT_LANDSCAPE },
-    { CameraParameters::SCENE_MODE_NIGHT,          CAMERA_BESTSHOT_NIGHT },
-    { CameraParameters::SCENE_MODE_NIGHT_PORTRAIT, CAMERA_BESTSHOT_NIGHT_PORTRAIT },
-    { CameraParameters::SCENE_MODE_THEATRE,        CAMERA_BESTSHOT_THEATRE },
-    { CameraParameters::SCENE_MODE_BEACH,          CAMERA_BESTSHOT_BEACH },
-    { CameraParameters::SCENE_MODE_SNOW,           CAMERA_BESTSHOT_SNOW },
-    { CameraParameters::SCENE_MODE_SUNSET,         CAMERA_BESTSHOT_SUNSET },
-    { CameraParameters::SCENE_MODE_STEADYPHOTO,    CAMERA_BESTSHOT_ANTISHAKE },
-    { CameraParameters::SCENE_MODE_FIREWORKS ,     CAMERA_BESTSHOT_FIREWORKS },
-    { CameraParameters::SCENE_MODE_SPORTS ,        CAMERA_BESTSHOT_SPORTS },
-    { CameraParameters::SCENE_MODE_PARTY,          CAMERA_BESTSHOT_PARTY },
-    { CameraParameters::SCENE_MODE_CANDLELIGHT,    CAMERA_BESTSHOT_CANDLELIGHT },
-    { CameraParameters::SCENE_MODE_BACKLIGHT,      CAMERA_BESTSHOT_BACKLIGHT },
-    { CameraParameters::SCENE_MODE_FLOWERS,        CAMERA_BESTSHOT_FLOWERS },
-//    { CameraParameters::SCENE_MODE_AR,             CAMERA_BESTSHOT_AR },
-};
-
-static const str_map scenedetect[] = {
-    { CameraParameters::SCENE_DETECT_OFF, FALSE  },
-    { CameraParameters::SCENE_DETECT_ON, TRUE },
-};
-
 #define country_number (sizeof(country_numeric) / sizeof(country_map))
 /* TODO : setting dummy values as of now, need to query for correct
  * values from sensor in future
@@ -677,72 +596,13 @@ static camera_antibanding_type camera_get_location(void) {
     return CAMERA_ANTIBANDING_60HZ;
 }
 
-// from camera.h, led_mode_t
-static const str_map flash[] = {
-    { CameraParameters::FLASH_MODE_OFF,  LED_MODE_OFF },
-    { CameraParameters::FLASH_MODE_AUTO, LED_MODE_AUTO },
-    { CameraParameters::FLASH_MODE_ON, LED_MODE_ON },
-    { CameraParameters::FLASH_MODE_TORCH, LED_MODE_TORCH }
-};
-
-// from mm-camera/common/camera.h.
-static const str_map iso[] = {
-    { CameraParameters::ISO_AUTO,  CAMERA_ISO_AUTO},
-    { CameraParameters::ISO_HJR,   CAMERA_ISO_DEBLUR},
-    { CameraParameters::ISO_100,   CAMERA_ISO_100},
-    { CameraParameters::ISO_200,   CAMERA_ISO_200},
-    { CameraParameters::ISO_400,   CAMERA_ISO_400},
-    { CameraParameters::ISO_800,   CAMERA_ISO_800 },
-    { CameraParameters::ISO_1600,  CAMERA_ISO_1600 }
-};
-
-
-#define DONT_CARE 0
-static const str_map focus_modes[] = {
-    { CameraParameters::FOCUS_MODE_AUTO,     AF_MODE_AUTO},
-    { CameraParameters::FOCUS_MODE_INFINITY, DONT_CARE },
-    { CameraParameters::FOCUS_MODE_NORMAL,   AF_MODE_NORMAL },
-    { CameraParameters::FOCUS_MODE_MACRO,    AF_MODE_MACRO },
-    { CameraParameters::FOCUS_MODE_CONTINUOUS_VIDEO, DONT_CARE }
-};
-
-static const str_map lensshade[] = {
-    { CameraParameters::LENSSHADE_ENABLE, TRUE },
-    { CameraParameters::LENSSHADE_DISABLE, FALSE }
-};
-
-static const str_map histogram[] = {
-    { CameraParameters::HISTOGRAM_ENABLE, TRUE },
-    { CameraParameters::HISTOGRAM_DISABLE, FALSE }
-};
-
-static const str_map skinToneEnhancement[] = {
-    { CameraParameters::SKIN_TONE_ENHANCEMENT_ENABLE, TRUE },
-    { CameraParameters::SKIN_TONE_ENHANCEMENT_DISABLE, FALSE }
-};
-
-static const str_map continuous_af[] = {
-    { CameraParameters::CONTINUOUS_AF_OFF, FALSE },
-    { CameraParameters::CONTINUOUS_AF_ON, TRUE }
-};
-
-static const str_map selectable_zone_af[] = {
-    { CameraParameters::SELECTABLE_ZONE_AF_AUTO,  AUTO },
-    { CameraParameters::SELECTABLE_ZONE_AF_SPOT_METERING, SPOT },
-    { CameraParameters::SELECTABLE_ZONE_AF_CENTER_WEIGHTED, CENTER_WEIGHTED },
-    { CameraParameters::SELECTABLE_ZONE_AF_FRAME_AVERAGE, AVERAGE }
-};
-
-static const str_map facedetection[] = {
-    { CameraParameters::FACE_DETECTION_OFF, FALSE },
-    { CameraParameters::FACE_DETECTION_ON, TRUE }
+static const str_map histogram_delivery[] = {
+    { "full", QualcommCameraHardware::STATS_DELIVER_FULL },
+    { "changed", QualcommCameraHardware::STATS_DELIVER_CHANGED },
+    { "downsampled", QualcommCameraHardware::STATS_DELIVER_DOWNSAMPLED }
 };
 
 #define DONT_CARE_COORDINATE -1
-static const str_map touchafaec[] = {
-    { CameraParameters::TOUCH_AF_AEC_OFF, FALSE },
-    { CameraParameters::TOUCH_AF_AEC_ON, TRUE }
-};
 
 struct SensorType {
     const char *name;
@@ -761,6 +621,8 @@ struct SensorType {
 #define CAMERA_HISTOGRAM_ENABLE 1
 #define CAMERA_HISTOGRAM_DISABLE 0
 #define HISTOGRAM_STATS_SIZE 257
+#define HISTOGRAM_DOWNSAMPLE 4
+#define HISTOGRAM_SMALL_STATS_SIZE (1 + 256 / HISTOGRAM_DOWNSAMPLE)
 
 #define EXPOSURE_COMPENSATION_MAXIMUM_NUMERATOR 12
 #define EXPOSURE_COMPENSATION_MINIMUM_NUMERATOR -12
@@ -781,23 +643,33 @@ static SensorType sensorTypes[] = {
 
 static SensorType * sensorType;
 
-static const str_map picture_formats[] = {
-        {CameraParameters::PIXEL_FORMAT_JPEG, PICTURE_FORMAT_JPEG},
-        {CameraParameters::PIXEL_FORMAT_RAW, PICTURE_FORMAT_RAW}
-};
-
-static const str_map frame_rate_modes[] = {
-        {CameraParameters::KEY_PREVIEW_FRAME_RATE_AUTO_MODE, FPS_MODE_AUTO},
-        {CameraParameters::KEY_PREVIEW_FRAME_RATE_FIXED_MODE, FPS_MODE_FIXED}
-};
-
 static int mPreviewFormat;
-static const str_map preview_formats[] = {
-        {CameraParameters::PIXEL_FORMAT_YUV420SP,   CAMERA_YUV_420_NV21},
-        {CameraParameters::PIXEL_FORMAT_YUV420SP_ADRENO, CAMERA_YUV_420_NV21_ADRENO}
-};
 
-static bool parameter_string_initialized = false;
+// Indexes over the str_map tables in camera_attr_tables.h, used by attr_lookup().
+static const AttrTable<str_map> whitebalance_table(whitebalance, sizeof(whitebalance) / sizeof(str_map));
+static const AttrTable<str_map> effects_table(effects, sizeof(effects) / sizeof(str_map));
+static const AttrTable<str_map> autoexposure_table(autoexposure, sizeof(autoexposure) / sizeof(str_map));
+static const AttrTable<str_map> antibanding_table(antibanding, sizeof(antibanding) / sizeof(str_map));
+static const AttrTable<str_map> scenemode_table(scenemode, sizeof(scenemode) / sizeof(str_map));
+static const AttrTable<str_map> scenedetect_table(scenedetect, sizeof(scenedetect) / sizeof(str_map));
+static const AttrTable<str_map> flash_table(flash, sizeof(flash) / sizeof(str_map));
+static const AttrTable<str_map> iso_table(iso, sizeof(iso) / sizeof(str_map));
+static const AttrTable<str_map> focus_modes_table(focus_modes, sizeof(focus_modes) / sizeof(str_map));
+static const AttrTable<str_map> lensshade_table(lensshade, sizeof(lensshade) / sizeof(str_map));
+static const AttrTable<str_map> continuous_af_table(continuous_af, sizeof(continuous_af) / sizeof(str_map));
+static const AttrTable<str_map> selectable_zone_af_table(selectable_zone_af, sizeof(selectable_zone_af) / sizeof(str_map));
+static const AttrTable<str_map> facedetection_table(facedetection, sizeof(facedetection) / sizeof(str_map));
+static const AttrTable<str_map> touchafaec_table(touchafaec, sizeof(touchafaec) / sizeof(str_map));
+static const AttrTable<str_map> picture_formats_table(picture_formats, sizeof(picture_formats) / sizeof(str_map));
+static const AttrTable<str_map> frame_rate_modes_table(frame_rate_modes, sizeof(frame_rate_modes) / sizeof(str_map));
+static const AttrTable<str_map> preview_formats_table(preview_formats, sizeof(preview_formats) / sizeof(str_map));
+static const AttrTable<str_map> histogram_delivery_table(histogram_delivery, sizeof(histogram_delivery) / sizeof(str_map));
+
+static int attr_lookup(const AttrTable<str_map> &table, const char *name)
+{
+    return table.lookup(name, NOT_FOUND);
+}
+
 static String8 preview_size_values;
 static String8 picture_size_values;
 static String8 fps_ranges_supported_values;
@@ -824,150 +696,202 @@ static String8 preview_format_values;
 static String8 selectable_zone_af_values;
 static String8 facedetection_values;
 
+// Capability strings and the filtered size tables only depend on the
+// sensor (and whether its driver reports autofocus), so they are built on
+// the first open of each sensor type and reused for the lifetime of the
+// mediaserver process.
+struct sensor_capabilities {
+    bool initialized;
+    camera_size_type previewSizes[PREVIEW_SIZE_COUNT];
+    unsigned int previewSizeCount;
+    const camera_size_type *pictureSizes;
+    int pictureSizeCount;
+    int32_t maxZoom;
+    bool zoomSupported;
+    String8 preview_size_values;
+    String8 picture_size_values;
+    String8 fps_ranges_supported_values;
+    String8 jpeg_thumbnail_size_values;
+    String8 antibanding_values;
+    String8 effect_values;
+    String8 autoexposure_values;
+    String8 whitebalance_values;
+    String8 flash_values;
+    String8 focus_mode_values;
+    String8 iso_values;
+    String8 lensshade_values;
+    String8 histogram_values;
+    String8 skinToneEnhancement_values;
+    String8 touchafaec_values;
+    String8 picture_format_values;
+    String8 scenemode_values;
+    String8 continuous_af_values;
+    String8 zoom_ratio_values;
+    String8 preview_frame_rate_values;
+    String8 frame_rate_mode_values;
+    String8 scenedetect_values;
+    String8 preview_format_values;
+    String8 selectable_zone_af_values;
+    String8 facedetection_values;
+};
+static sensor_capabilities sensor_caps[sizeof(sensorTypes) / sizeof(SensorType)][2];
+
+// Every list entry below fits in this, so a builder stops one entry short
+// of the end of its buffer rather than truncating mid value.
+#define CAPABILITY_ENTRY_MAX 32
+#define CAPABILITY_STR_MAX 2048
+
 static String8 create_sizes_str(const camera_size_type *sizes, int len) {
-    String8 str;
-    char buffer[32];
+    char buffer[CAPABILITY_STR_MAX];
+    int n = 0;
 
-    if (len > 0) {
-        snprintf(buffer, sizeof(buffer), "%dx%d", sizes[0].width, sizes[0].height);
-        str.append(buffer);
-    }
-    for (int i = 1; i < len; i++) {
-        snprintf(buffer, sizeof(buffer), ",%dx%d", sizes[i].width, sizes[i].height);
-        str.append(buffer);
-    }
-    return str;
+    for (int i = 0; i < len && n < CAPABILITY_STR_MAX - CAPABILITY_ENTRY_MAX; i++)
+        n += snprintf(buffer + n, CAPABILITY_ENTRY_MAX, i ? ",%dx%d" : "%dx%d",
+                      sizes[i].width, sizes[i].height);
+    return String8(buffer, n);
 }
 
 static String8 create_fps_str(const android:: FPSRange* fps, int len) {
-    String8 str;
-    char buffer[32];
+    char buffer[CAPABILITY_STR_MAX];
+    int n = 0;
 
-    if (len > 0) {
-        snprintf(buffer, sizeof(buffer), "(%d,%d)", fps[0].minFPS, fps[0].maxFPS);
-        str.append(buffer);
-    }
-    for (int i = 1; i < len; i++) {
-        snprintf(buffer, sizeof(buffer), ",(%d,%d)", fps[i].minFPS, fps[i].maxFPS);
-        str.append(buffer);
-    }
-    return str;
+    for (int i = 0; i < len && n < CAPABILITY_STR_MAX - CAPABILITY_ENTRY_MAX; i++)
+        n += snprintf(buffer + n, CAPABILITY_ENTRY_MAX, i ? ",(%d,%d)" : "(%d,%d)",
+                      fps[i].minFPS, fps[i].maxFPS);
+    return String8(buffer, n);
 }
 
 static String8 create_values_str(const str_map *values, int len) {
-    String8 str;
+    char buffer[CAPABILITY_STR_MAX];
+    int n = 0;
 
-    if (len > 0) {
-        str.append(values[0].desc);
-    }
-    for (int i = 1; i < len; i++) {
-        str.append(",");
-        str.append(values[i].desc);
+    for (int i = 0; i < len; i++) {
+        size_t l = strlen(values[i].desc);
+        if (n + l + 1 > CAPABILITY_STR_MAX)
+            break;
+        if (i)
+            buffer[n++] = ',';
+        memcpy(buffer + n, values[i].desc, l);
+        n += l;
     }
-    return str;
+    return String8(buffer, n);
 }
 
 static String8 create_str(int16_t *arr, int length){
-    String8 str;
-    char buffer[32];
-
-    if(length > 0){
-        snprintf(buffer, sizeof(buffer), "%d", arr[0]);
-        str.append(buffer);
-    }
+    char buffer[CAPABILITY_STR_MAX];
+    int n = 0;
 
-    for (int i =1;i<length;i++){
-        snprintf(buffer, sizeof(buffer), ",%d",arr[i]);
-        str.append(buffer);
-    }
-    return str;
+    for (int i = 0; i < length && n < CAPABILITY_STR_MAX - CAPABILITY_ENTRY_MAX; i++)
+        n += snprintf(buffer + n, CAPABILITY_ENTRY_MAX, i ? ",%d" : "%d", arr[i]);
+    return String8(buffer, n);
 }
 
 static String8 create_values_range_str(int min, int max){
-    String8 str;
-    char buffer[32];
+    char buffer[CAPABILITY_STR_MAX];
+    int n = 0;
 
-    if(min <= max){
-        snprintf(buffer, sizeof(buffer), "%d", min);
-        str.append(buffer);
-
-        for (int i = min + 1; i <= max; i++) {
-            snprintf(buffer, sizeof(buffer), ",%d", i);
-            str.append(buffer);
-        }
-    }
-    return str;
+    for (int i = min; i <= max && n < CAPABILITY_STR_MAX - CAPABILITY_ENTRY_MAX; i++)
+        n += snprintf(buffer + n, CAPABILITY_ENTRY_MAX, i > min ? ",%d" : "%d", i);
+    return String8(buffer, n);
 }
 
-
-extern "C" {
 //------------------------------------------------------------------------
 //   : 720p busyQ funcitons
 //   --------------------------------------------------------------------
-static struct fifo_queue g_busy_frame_queue =
-    {0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, "frame_queue"};
-};
+/* Busy video frames, posted by the camframe video callback and drained by
+ * the video thread. The ring never allocates and the producer side takes
+ * no lock; g_busy_frame_lock only serializes the consumers (the video
+ * thread and the flushes done while it is stopped). */
+static struct spsc_ring g_busy_frame_ring = { 0, 0, 0, -1 };
+static pthread_mutex_t g_busy_frame_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*===========================================================================
+ * FUNCTION      cam_frame_init_video
+ *
+ * DESCRIPTION    this function sets up the busy queue for count buffers
+ * ===========================================================================*/
+static bool cam_frame_init_video (unsigned int count)
+{
+    if (count > SPSC_RING_MAX) {
+        LOGE("cam_frame_init_video: %u buffers, busy queue holds %d",
+             count, SPSC_RING_MAX);
+        return false;
+    }
+    pthread_mutex_lock(&g_busy_frame_lock);
+    spsc_ring_destroy(&g_busy_frame_ring);
+    bool ret = spsc_ring_init(&g_busy_frame_ring, count);
+    pthread_mutex_unlock(&g_busy_frame_lock);
+    if (!ret)
+        LOGE("cam_frame_init_video: eventfd failed: %s", strerror(errno));
+    return ret;
+}
+
+static void cam_frame_deinit_video (void)
+{
+    pthread_mutex_lock(&g_busy_frame_lock);
+    spsc_ring_destroy(&g_busy_frame_ring);
+    pthread_mutex_unlock(&g_busy_frame_lock);
+}
+
 /*===========================================================================
  * FUNCTION      cam_frame_wait_video
  *
- * DESCRIPTION    this function waits a video in the busy queue
+ * DESCRIPTION    this function waits a video in the busy queue, or until
+ *                cam_frame_wake_video() is called
  * ===========================================================================*/
 
 static void cam_frame_wait_video (void)
 {
     LOGV("cam_frame_wait_video E ");
-    if ((g_busy_frame_queue.num_of_frames) <=0){
-        pthread_cond_wait(&(g_busy_frame_queue.wait), &(g_busy_frame_queue.mut));
-    }
+    spsc_ring_wait(&g_busy_frame_ring);
     LOGV("cam_frame_wait_video X");
     return;
 }
 
+static void cam_frame_wake_video (void)
+{
+    spsc_ring_wake(&g_busy_frame_ring);
+}
+
+static unsigned int cam_frame_count_video (void)
+{
+    return spsc_ring_count(&g_busy_frame_ring);
+}
+
 /*===========================================================================
- * FUNCTION      cam_frame_flush_video
+ * FUNCTION      cam_frame_get_video
  *
- * DESCRIPTION    this function deletes all the buffers in  busy queue
+ * DESCRIPTION    this function returns a video frame from the head, or
+ *                NULL if the busy queue is empty
  * ===========================================================================*/
-void cam_frame_flush_video (void)
+static struct msm_frame * cam_frame_get_video()
 {
-    LOGV("cam_frame_flush_video: in n = %d\n", g_busy_frame_queue.num_of_frames);
-    pthread_mutex_lock(&(g_busy_frame_queue.mut));
-
-    while (g_busy_frame_queue.front)
-    {
-       //dequeue from the busy queue
-       struct fifo_node *node  = dequeue (&g_busy_frame_queue);
-       if(node)
-           free(node);
+    intptr_t p = 0;
 
-       LOGV("cam_frame_flush_video: node \n");
-    }
-    pthread_mutex_unlock(&(g_busy_frame_queue.mut));
-    LOGV("cam_frame_flush_video: out n = %d\n", g_busy_frame_queue.num_of_frames);
-    return ;
+    pthread_mutex_lock(&g_busy_frame_lock);
+    if (!spsc_ring_pop(&g_busy_frame_ring, &p))
+        p = 0;
+    pthread_mutex_unlock(&g_busy_frame_lock);
+    LOGV("cam_frame_get_video... out = %p\n", (void *)p);
+    return (struct msm_frame *)p;
 }
+
 /*===========================================================================
- * FUNCTION      cam_frame_get_video
+ * FUNCTION      cam_frame_flush_video
  *
- * DESCRIPTION    this function returns a video frame from the head
+ * DESCRIPTION    this function deletes all the buffers in  busy queue
  * ===========================================================================*/
-static struct msm_frame * cam_frame_get_video()
+void cam_frame_flush_video (void)
 {
-    struct msm_frame *p = NULL;
-    LOGV("cam_frame_get_video... in\n");
-    LOGV("cam_frame_get_video... got lock\n");
-    if (g_busy_frame_queue.front)
-    {
-        //dequeue
-       struct fifo_node *node  = dequeue (&g_busy_frame_queue);
-       if (node)
-       {
-           p = (struct msm_frame *)node->f;
-           free (node);
-       }
-       LOGV("cam_frame_get_video... out = %lx\n", p->buffer);
-    }
-    return p;
+    intptr_t p;
+
+    LOGV("cam_frame_flush_video: in n = %u\n", cam_frame_count_video());
+    pthread_mutex_lock(&g_busy_frame_lock);
+    while (spsc_ring_pop(&g_busy_frame_ring, &p))
+        ;
+    pthread_mutex_unlock(&g_busy_frame_lock);
+    LOGV("cam_frame_flush_video: out n = %u\n", cam_frame_count_video());
+    return ;
 }
 
 /*===========================================================================
@@ -983,26 +907,13 @@ static void cam_frame_post_video (struct msm_frame *p)
         return;
     }
     LOGV("cam_frame_post_video... in = %x\n", (unsigned int)(p->buffer));
-    pthread_mutex_lock(&(g_busy_frame_queue.mut));
-    LOGV("post_video got lock. q count before enQ %d", g_busy_frame_queue.num_of_frames);
-    //enqueue to busy queue
-    struct fifo_node *node = (struct fifo_node *)malloc (sizeof (struct fifo_node));
-    if (node)
-    {
-        LOGV(" post video , enqueing in busy queue");
-        node->f = p;
-        node->next = NULL;
-        enqueue (&g_busy_frame_queue, node);
-        LOGV("post_video got lock. q count after enQ %d", g_busy_frame_queue.num_of_frames);
-    }
-    else
-    {
-        LOGE("cam_frame_post_video error... out of memory\n");
+    // Sized for every record buffer, so this only fails if a buffer is
+    // posted twice; hand it back rather than lose it.
+    if (!spsc_ring_push(&g_busy_frame_ring, (intptr_t)p)) {
+        LOGE("cam_frame_post_video error... busy queue full\n");
+        LINK_camframe_free_video(p);
     }
 
-    pthread_mutex_unlock(&(g_busy_frame_queue.mut));
-    pthread_cond_signal(&(g_busy_frame_queue.wait));
-
     LOGV("cam_frame_post_video... out = %lx\n", p->buffer);
 
     return;
@@ -1077,7 +988,13 @@ QualcommCameraHardware::QualcommCameraHardware()
       mCameraRunning(false),
       mPreviewInitialized(false),
       mFrameThreadRunning(false),
+      mDisplayThreadExit(false),
+      mDisplayThreadRunning(false),
       mVideoThreadRunning(false),
+      mStatsOn(CAMERA_HISTOGRAM_DISABLE),
+      mCurrent(-1),
+      mSendData(false),
+      mStatDelivery(STATS_DELIVER_FULL),
       mSnapshotThreadRunning(false),
       mJpegThreadRunning(false),
       mInSnapshotMode(false),
@@ -1091,6 +1008,9 @@ QualcommCameraHardware::QualcommCameraHardware()
       mCameraControlFd(-1),
       mAutoFocusThreadRunning(false),
       mAutoFocusFd(-1),
+      mAfWorkerRunning(false),
+      mAfCommands(0),
+      mAfMode(-1),
       mInitialized(false),
       mBrightness(0),
       mSkinToneEnhancement(0),
@@ -1113,9 +1033,14 @@ QualcommCameraHardware::QualcommCameraHardware()
       mThumbnailWidth(0),
       mThumbnailHeight(0),
       strTexturesOn(false),
-      mPrevHeapDeallocRunning(false)
+      mPrevHeapDeallocRunning(false),
+      mPreviewStartTime(0),
+      mTakePictureTime(0),
+      mParametersApplied(false)
 {
     LOGI("QualcommCameraHardware constructor E");
+    frame_interval_reset(&mPreviewIntervals, 0);
+    frame_interval_reset(&mVideoIntervals, 0);
     mMMCameraDLRef = MMCameraDL::getInstance();
     libmmcamera = mMMCameraDLRef->pointer();
     LOGV("%s, libmmcamera: %p\n", __FUNCTION__, libmmcamera);
@@ -1140,16 +1065,26 @@ QualcommCameraHardware::QualcommCameraHardware()
         kPreviewBufferCountActual = kPreviewBufferCount;
         kRecordBufferCount = RECORD_BUFFERS;
         recordframes = new msm_frame[kRecordBufferCount];
-        record_buffers_tracking_flag = new bool[kRecordBufferCount];
+        record_buffer_owner = new uint8_t[kRecordBufferCount];
     }
     else {
         kPreviewBufferCountActual = kPreviewBufferCount + NUM_MORE_BUFS;
         if( mCurrentTarget == TARGET_QSD8250 ) {
             kRecordBufferCount = RECORD_BUFFERS_8x50;
             recordframes = new msm_frame[kRecordBufferCount];
-            record_buffers_tracking_flag = new bool[kRecordBufferCount];
+            record_buffer_owner = new uint8_t[kRecordBufferCount];
         }
     }
+    if( mCurrentTarget == TARGET_MSM7630 || mCurrentTarget == TARGET_QSD8250 || mCurrentTarget == TARGET_MSM8660 )
+        cam_frame_init_video(kRecordBufferCount);
+    mRecordBufferBase = 0;
+    mRecordBufferStride = 0;
+    mRecordBadReleases = 0;
+    mRecordLeakedBuffers = 0;
+    mNumCapture = 1;
+    mSnapshotCount = 1;
+    mSnapshotIndex = 0;
+    mJpegSlot = 0;
 
     switch(mCurrentTarget){
         case TARGET_MSM7627:
@@ -1278,6 +1213,77 @@ bool QualcommCameraHardware::supportsFaceDetection() {
    return false;
 }
 
+static void save_capabilities(sensor_capabilities *caps)
+{
+    memcpy(caps->previewSizes, supportedPreviewSizes, sizeof(supportedPreviewSizes));
+    caps->previewSizeCount = previewSizeCount;
+    caps->pictureSizes = picture_sizes_ptr;
+    caps->pictureSizeCount = supportedPictureSizesCount;
+    caps->maxZoom = mMaxZoom;
+    caps->zoomSupported = zoomSupported;
+    caps->preview_size_values = preview_size_values;
+    caps->picture_size_values = picture_size_values;
+    caps->fps_ranges_supported_values = fps_ranges_supported_values;
+    caps->jpeg_thumbnail_size_values = jpeg_thumbnail_size_values;
+    caps->antibanding_values = antibanding_values;
+    caps->effect_values = effect_values;
+    caps->autoexposure_values = autoexposure_values;
+    caps->whitebalance_values = whitebalance_values;
+    caps->flash_values = flash_values;
+    caps->focus_mode_values = focus_mode_values;
+    caps->iso_values = iso_values;
+    caps->lensshade_values = lensshade_values;
+    caps->histogram_values = histogram_values;
+    caps->skinToneEnhancement_values = skinToneEnhancement_values;
+    caps->touchafaec_values = touchafaec_values;
+    caps->picture_format_values = picture_format_values;
+    caps->scenemode_values = scenemode_values;
+    caps->continuous_af_values = continuous_af_values;
+    caps->zoom_ratio_values = zoom_ratio_values;
+    caps->preview_frame_rate_values = preview_frame_rate_values;
+    caps->frame_rate_mode_values = frame_rate_mode_values;
+    caps->scenedetect_values = scenedetect_values;
+    caps->preview_format_values = preview_format_values;
+    caps->selectable_zone_af_values = selectable_zone_af_values;
+    caps->facedetection_values = facedetection_values;
+    caps->initialized = true;
+}
+
+static void restore_capabilities(const sensor_capabilities *caps)
+{
+    memcpy(supportedPreviewSizes, caps->previewSizes, sizeof(supportedPreviewSizes));
+    previewSizeCount = caps->previewSizeCount;
+    picture_sizes_ptr = caps->pictureSizes;
+    supportedPictureSizesCount = caps->pictureSizeCount;
+    mMaxZoom = caps->maxZoom;
+    zoomSupported = caps->zoomSupported;
+    preview_size_values = caps->preview_size_values;
+    picture_size_values = caps->picture_size_values;
+    fps_ranges_supported_values = caps->fps_ranges_supported_values;
+    jpeg_thumbnail_size_values = caps->jpeg_thumbnail_size_values;
+    antibanding_values = caps->antibanding_values;
+    effect_values = caps->effect_values;
+    autoexposure_values = caps->autoexposure_values;
+    whitebalance_values = caps->whitebalance_values;
+    flash_values = caps->flash_values;
+    focus_mode_values = caps->focus_mode_values;
+    iso_values = caps->iso_values;
+    lensshade_values = caps->lensshade_values;
+    histogram_values = caps->histogram_values;
+    skinToneEnhancement_values = caps->skinToneEnhancement_values;
+    touchafaec_values = caps->touchafaec_values;
+    picture_format_values = caps->picture_format_values;
+    scenemode_values = caps->scenemode_values;
+    continuous_af_values = caps->continuous_af_values;
+    zoom_ratio_values = caps->zoom_ratio_values;
+    preview_frame_rate_values = caps->preview_frame_rate_values;
+    frame_rate_mode_values = caps->frame_rate_mode_values;
+    scenedetect_values = caps->scenedetect_values;
+    preview_format_values = caps->preview_format_values;
+    selectable_zone_af_values = caps->selectable_zone_af_values;
+    facedetection_values = caps->facedetection_values;
+}
+
 void QualcommCameraHardware::initDefaultParameters()
 {
     LOGI("initDefaultParameters E");
@@ -1296,9 +1302,16 @@ void QualcommCameraHardware::initDefaultParameters()
     if(!strcmp(sensorType->name, "ov7692") || !strcmp(sensorType->name, "mt9m113"))
         mDisEnabled = 0;
 
-    // Initialize constant parameter strings. This will happen only once in the
-    // lifetime of the mediaserver process.
-    if (!parameter_string_initialized) {
+    // Initialize constant parameter strings. This will happen only once per
+    // sensor type in the lifetime of the mediaserver process.
+    sensor_capabilities *caps =
+        &sensor_caps[sensorType - sensorTypes][mHasAutoFocusSupport ? 1 : 0];
+    if (caps->initialized) {
+        restore_capabilities(caps);
+    } else {
+        // Start from the empty entry so lists this sensor does not
+        // support are not inherited from the previously opened one.
+        restore_capabilities(caps);
         antibanding_values = create_values_str(
             antibanding, sizeof(antibanding) / sizeof(str_map));
         effect_values = create_values_str(
@@ -1319,10 +1332,8 @@ void QualcommCameraHardware::initDefaultParameters()
 
         fps_ranges_supported_values = create_fps_str(
             FpsRangesSupported,FPS_RANGES_SUPPORTED_COUNT );
-        mParameters.set(
-            CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE,
-            fps_ranges_supported_values);
-        mParameters.setPreviewFpsRange(MINIMUM_FPS*1000,MAXIMUM_FPS*1000);
+        jpeg_thumbnail_size_values = create_sizes_str(
+            jpeg_thumbnail_sizes, JPEG_THUMBNAIL_SIZE_COUNT);
 
         flash_values = create_values_str(
             flash, sizeof(flash) / sizeof(str_map));
@@ -1403,9 +1414,17 @@ void QualcommCameraHardware::initDefaultParameters()
             facedetection_values = create_values_str(
                 facedetection, sizeof(facedetection) / sizeof(str_map));
         }
-        parameter_string_initialized = true;
+        preview_format_values = create_values_str(
+            preview_formats, sizeof(preview_formats) / sizeof(str_map));
+        frame_rate_mode_values = create_values_str(
+            frame_rate_modes, sizeof(frame_rate_modes) / sizeof(str_map));
+        save_capabilities(caps);
     }
 
+    mParameters.set(
+        CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE,
+        fps_ranges_supported_values);
+
     mParameters.setPreviewSize(DEFAULT_PREVIEW_WIDTH, DEFAULT_PREVIEW_HEIGHT);
     mDimension.display_width = DEFAULT_PREVIEW_WIDTH;
     mDimension.display_height = DEFAULT_PREVIEW_HEIGHT;
@@ -1435,15 +1454,16 @@ void QualcommCameraHardware::initDefaultParameters()
     mParameters.set("power-mode-supported", "false");
 
     mParameters.set(CameraParameters::KEY_JPEG_QUALITY, "85"); // max quality
+    mParameters.set("num-snaps-per-shutter", 1);
+    mParameters.set("max-num-snaps-per-shutter", MAX_SNAPSHOT_BUFFERS);
     mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH,
                     THUMBNAIL_WIDTH_STR); // informative
     mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT,
                     THUMBNAIL_HEIGHT_STR); // informative
     mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY, "90");
 
-    String8 valuesStr = create_sizes_str(jpeg_thumbnail_sizes, JPEG_THUMBNAIL_SIZE_COUNT);
     mParameters.set(CameraParameters::KEY_SUPPORTED_JPEG_THUMBNAIL_SIZES,
-                valuesStr.string());
+                jpeg_thumbnail_size_values.string());
 
     if(zoomSupported){
         mParameters.set(CameraParameters::KEY_ZOOM_SUPPORTED, "true");
@@ -1477,14 +1497,10 @@ void QualcommCameraHardware::initDefaultParameters()
                     CameraParameters::PIXEL_FORMAT_YUV420SP);
     }
     else {
-        preview_format_values = create_values_str(
-            preview_formats, sizeof(preview_formats) / sizeof(str_map));
         mParameters.set(CameraParameters::KEY_SUPPORTED_PREVIEW_FORMATS,
                 preview_format_values.string());
     }
 
-    frame_rate_mode_values = create_values_str(
-            frame_rate_modes, sizeof(frame_rate_modes) / sizeof(str_map));
     if((strcmp(sensorType->name, "2mp")) &&
        (strcmp(sensorType->name, "ov7692")) &&
        (strcmp(sensorType->name, "mt9m113"))){
@@ -1575,6 +1591,8 @@ void QualcommCameraHardware::initDefaultParameters()
                     CameraParameters::HISTOGRAM_DISABLE);
     mParameters.set(CameraParameters::KEY_SUPPORTED_HISTOGRAM_MODES,
                     histogram_values);
+    mParameters.set("histogram-delivery", "full");
+    mParameters.set("histogram-delivery-values", "full,changed,downsampled");
     mParameters.set(CameraParameters::KEY_SKIN_TONE_ENHANCEMENT,
                     CameraParameters::SKIN_TONE_ENHANCEMENT_DISABLE);
     mParameters.set(CameraParameters::KEY_SUPPORTED_SKIN_TONE_ENHANCEMENT_MODES,
@@ -1824,6 +1842,9 @@ bool QualcommCameraHardware::startCamera()
             return FALSE;
         }
     }
+    mBlitLock.lock();
+    mdp_blit_init(&mBlit, fb_fd);
+    mBlitLock.unlock();
 
     /* This will block until the control thread is launched. After that, sensor
      * information becomes available.
@@ -1873,7 +1894,15 @@ status_t QualcommCameraHardware::dump(int fd,
              "and jpeg max size (%d)\n", mPreviewFrameSize, mRawSize,
              mJpegSize, mJpegMaxSize);
     result.append(buffer);
+    snprintf(buffer, 255, "record buffers: bad releases (%u), leaked (%u)\n",
+             mRecordBadReleases, mRecordLeakedBuffers);
+    result.append(buffer);
+    frame_interval_format(&mPreviewIntervals, "preview intervals", buffer, SIZE);
+    result.append(buffer);
+    frame_interval_format(&mVideoIntervals, "video intervals", buffer, SIZE);
+    result.append(buffer);
     write(fd, result.string(), result.size());
+    frame_trace_dump(fd);
 
     // Dump internal objects.
     if (mPreviewHeap != 0) {
@@ -2525,7 +2554,7 @@ bool QualcommCameraHardware::native_jpeg_encode(void)
            (mCurrentTarget == TARGET_MSM8660) ||
            (mCurrentTarget == TARGET_MSM7627) ||
            (strTexturesOn == true)) {
-            thumbnailHeap = (uint8_t *)mRawHeap->mHeap->base();
+            thumbnailHeap = snapshotBuffer();
             thumbfd =  mRawHeap->mHeap->getHeapID();
         } else {
             thumbnailHeap = (uint8_t *)mThumbnailHeap->mHeap->base();
@@ -2581,7 +2610,7 @@ bool QualcommCameraHardware::native_jpeg_encode(void)
         if (!LINK_jpeg_encoder_encode(&mDimension,
                                       thumbnailHeap,
                                       thumbfd,
-                                      (uint8_t *)mRawHeap->mHeap->base(),
+                                      snapshotBuffer(),
                                       mRawHeap->mHeap->getHeapID(),
                                       &mCrop, exif_data, exif_table_numEntries)) {
             LOGE("native_jpeg_encode: jpeg_encoder_encode failed.");
@@ -2591,7 +2620,7 @@ bool QualcommCameraHardware::native_jpeg_encode(void)
         if (!LINK_jpeg_encoder_encode(&mDimension,
                                      thumbnailHeap,
                                      thumbfd,
-                                     (uint8_t *)mRawHeap->mHeap->base(),
+                                     snapshotBuffer(),
                                      mRawHeap->mHeap->getHeapID(),
                                      &mCrop, exif_data, exif_table_numEntries)) {
             LOGE("native_jpeg_encode: jpeg_encoder_encode failed.");
@@ -2716,17 +2745,19 @@ void QualcommCameraHardware::runFrameThread(void *data)
         LOGV("after LINK_cam_frame");
     }
 
+    // The display thread still uses mPreviewHeap, stop it before the
+    // heap goes away.
+    stopDisplayThread();
+
 	LOGV("runFrameThread: clearing mPreviewHeap");
     mPmemWaitLock.lock();
-    mPreviewHeap.clear();
-    mPreviewHeap = NULL;
+    putPmemPool(mPreviewHeap);
     mPrevHeapDeallocRunning = true;
     mPmemWait.signal();
     mPmemWaitLock.unlock();
 
     if((mCurrentTarget == TARGET_MSM7630) || (mCurrentTarget == TARGET_QSD8250) || (mCurrentTarget == TARGET_MSM8660)) {
-        mRecordHeap.clear();
-        mRecordHeap = NULL;
+        putPmemPool(mRecordHeap);
 	}
 
     mFrameThreadWaitLock.lock();
@@ -2737,45 +2768,120 @@ void QualcommCameraHardware::runFrameThread(void *data)
     LOGV("runFrameThread X");
 }
 
-void QualcommCameraHardware::runVideoThread(void *data)
+void *display_thread(void *user);
+
+bool QualcommCameraHardware::startDisplayThread()
 {
-    LOGD("runVideoThread E");
-    msm_frame* vframe = NULL;
+    char value[PROPERTY_VALUE_MAX];
 
-    while(true) {
-        pthread_mutex_lock(&(g_busy_frame_queue.mut));
+    property_get("persist.camera.display.worker", value, "1");
+    if (!atoi(value))
+        return false;
 
-        // Exit the thread , in case of stop recording..
-        mVideoThreadWaitLock.lock();
-        if(mVideoThreadExit){
-            LOGV("Exiting video thread..");
-            mVideoThreadWaitLock.unlock();
-            pthread_mutex_unlock(&(g_busy_frame_queue.mut));
-            break;
+    /* The VFE requeues a preview buffer as soon as receivePreviewFrame
+     * returns and keeps two of them for its ping-pong, and the display
+     * thread holds the frame it is posting, so never queue more frames
+     * than the remaining buffers can cover. With no buffer to spare,
+     * display from the frame callback instead.
+     */
+    if (kPreviewBufferCount <= 3)
+        return false;
+    unsigned int depth = kPreviewBufferCount - 3;
+    if (!spsc_ring_init(&mDisplayRing, depth)) {
+        LOGE("startDisplayThread: eventfd failed: %s", strerror(errno));
+        return false;
+    }
+    mDisplayDropped = 0;
+
+    mDisplayThreadWaitLock.lock();
+    mDisplayThreadExit = false;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    mDisplayThreadRunning = !pthread_create(&mDisplayThread,
+                                            &attr,
+                                            display_thread,
+                                            NULL);
+    mDisplayThreadWaitLock.unlock();
+
+    if (!mDisplayThreadRunning) {
+        LOGE("startDisplayThread: display thread creation failed");
+        spsc_ring_destroy(&mDisplayRing);
+    }
+    return mDisplayThreadRunning;
+}
+
+void QualcommCameraHardware::stopDisplayThread()
+{
+    mDisplayThreadWaitLock.lock();
+    if (mDisplayThreadRunning) {
+        mDisplayThreadExit = true;
+        spsc_ring_wake(&mDisplayRing);
+        while (mDisplayThreadRunning) {
+            LOGV("stopDisplayThread: waiting for display thread to exit");
+            mDisplayThreadWait.wait(mDisplayThreadWaitLock);
         }
-        mVideoThreadWaitLock.unlock();
+        spsc_ring_destroy(&mDisplayRing);
+        if (mDisplayDropped)
+            LOGI("stopDisplayThread: %u preview frames dropped", mDisplayDropped);
+    }
+    mDisplayThreadWaitLock.unlock();
+}
+
+void QualcommCameraHardware::runDisplayThread(void *data)
+{
+    LOGV("runDisplayThread E");
+
+    while (!mDisplayThreadExit) {
+        intptr_t offset;
+
+        if (!spsc_ring_pop(&mDisplayRing, &offset)) {
+            spsc_ring_wait(&mDisplayRing);
+            continue;
+        }
+        // Copy out before the slot can be refilled by the next frame.
+        common_crop_t crop = mDisplayFrames[offset].crop;
+        nsecs_t timeStamp = mDisplayFrames[offset].ts;
 
-        LOGV("in video_thread : wait for video frame ");
-        // check if any frames are available in busyQ and give callback to
-        // services/video encoder
-        cam_frame_wait_video();
-        LOGV("video_thread, wait over..");
+        if (!mCameraRunning)
+            continue;
+        displayPreviewFrame(offset, &crop, timeStamp);
+    }
+
+    mDisplayThreadWaitLock.lock();
+    mDisplayThreadRunning = false;
+    mDisplayThreadWait.signal();
+    mDisplayThreadWaitLock.unlock();
+
+    LOGV("runDisplayThread X");
+}
+
+void QualcommCameraHardware::runVideoThread(void *data)
+{
+    LOGD("runVideoThread E");
+    msm_frame* vframe = NULL;
 
+    while(true) {
         // Exit the thread , in case of stop recording..
         mVideoThreadWaitLock.lock();
         if(mVideoThreadExit){
             LOGV("Exiting video thread..");
             mVideoThreadWaitLock.unlock();
-            pthread_mutex_unlock(&(g_busy_frame_queue.mut));
             break;
         }
         mVideoThreadWaitLock.unlock();
 
-        // Get the video frame to be encoded
+        // Get the video frame to be encoded, or sleep until one is posted
+        // or stop wakes us up.
         vframe = cam_frame_get_video ();
-        pthread_mutex_unlock(&(g_busy_frame_queue.mut));
+        if (vframe == NULL) {
+            LOGV("in video_thread : wait for video frame ");
+            cam_frame_wait_video();
+            continue;
+        }
         LOGV("in video_thread : got video frame ");
 
+        frame_interval_add(&mVideoIntervals, systemTime());
         if (UNLIKELY(mDebugFps)) {
             debugShowVideoFPS();
         }
@@ -2789,8 +2895,9 @@ void QualcommCameraHardware::runVideoThread(void *data)
 
             offset /= mRecordHeap->mAlignedBufferSize;
 
-            //set the track flag to true for this video buffer
-            record_buffers_tracking_flag[offset] = true;
+            mRecordFrameLock.lock();
+            record_buffer_owner[offset] = RECORD_BUFFER_HAL;
+            mRecordFrameLock.unlock();
 
             /* Extract the timestamp of this frame */
 	    nsecs_t timeStamp = nsecs_t(vframe->ts.tv_sec)*1000000000LL + vframe->ts.tv_nsec;
@@ -2826,7 +2933,17 @@ void QualcommCameraHardware::runVideoThread(void *data)
 
             if(rcb != NULL && (msgEnabled & CAMERA_MSG_VIDEO_FRAME) ) {
                 LOGV("in video_thread : got video frame, giving frame to services/encoder");
+                // The encoder may release it before rcb returns.
+                mRecordFrameLock.lock();
+                record_buffer_owner[offset] = RECORD_BUFFER_ENCODER;
+                mRecordFrameLock.unlock();
                 rcb(timeStamp, CAMERA_MSG_VIDEO_FRAME, mRecordHeap->mBuffers[offset], rdata);
+            } else {
+                // Nobody to give it to, hand it straight back.
+                mRecordFrameLock.lock();
+                record_buffer_owner[offset] = RECORD_BUFFER_VFE;
+                mRecordFrameLock.unlock();
+                LINK_camframe_free_video(vframe);
             }
 #else
             // 720p output2  : simulate release frame here:
@@ -2834,7 +2951,7 @@ void QualcommCameraHardware::runVideoThread(void *data)
             LINK_camframe_free_video(vframe);
 #endif
 
-        } else LOGE("in video_thread get frame returned null");
+        }
     } // end of while loop
 
     mVideoThreadWaitLock.lock();
@@ -2869,6 +2986,18 @@ void *frame_thread(void *user)
     return NULL;
 }
 
+void *display_thread(void *user)
+{
+    LOGD("display_thread E");
+    sp<QualcommCameraHardware> obj = QualcommCameraHardware::getInstance();
+    if (obj != 0) {
+        obj->runDisplayThread(user);
+    }
+    else LOGW("not starting display thread: the object went away!");
+    LOGD("display_thread X");
+    return NULL;
+}
+
 static int parse_size(const char *str, int &width, int &height)
 {
     LOGV("%s E", __FUNCTION__);
@@ -3001,11 +3130,11 @@ bool QualcommCameraHardware::initPreview()
 
     if (mPreviewHeap != NULL) {
         LOGI("%s: Clearing previous mPreviewHeap", __FUNCTION__);
-        mPreviewHeap.clear();
+        putPmemPool(mPreviewHeap);
     }
 
     mPrevHeapDeallocRunning = false;
-    mPreviewHeap = new PmemPool(pmem_region,
+    mPreviewHeap = getPmemPool(pmem_region,
                                 MemoryHeapBase::READ_ONLY | MemoryHeapBase::NO_CACHING,
                                 mCameraControlFd,
                                 MSM_PMEM_PREVIEW, //MSM_PMEM_OUTPUT2,
@@ -3043,6 +3172,10 @@ bool QualcommCameraHardware::initPreview()
             frames[cnt].path = OUTPUT_TYPE_P; // MSM_FRAME_ENC;
         }
 
+        // Started first so that it is running before the first frame
+        // arrives; the frame thread stops it on the way out.
+        startDisplayThread();
+
         mFrameThreadWaitLock.lock();
         pthread_attr_t attr;
         pthread_attr_init(&attr);
@@ -3065,6 +3198,9 @@ bool QualcommCameraHardware::initPreview()
                                               (void*)&(frame_parms));
         ret = mFrameThreadRunning;
         mFrameThreadWaitLock.unlock();
+
+        if (!ret)
+            stopDisplayThread();
     }
     mFirstFrame = true;
 
@@ -3305,12 +3441,12 @@ bool QualcommCameraHardware::initRaw(bool initJpegHeap)
 
     LOGV("initRaw: initializing mRawHeap.");
     mRawHeap =
-        new PmemPool(pmem_region,
+        getPmemPool(pmem_region,
                      MemoryHeapBase::READ_ONLY | MemoryHeapBase::NO_CACHING,
                      mCameraControlFd,
                      MSM_PMEM_MAINIMG,
                      mJpegMaxSize,
-                     kRawBufferCount,
+                     mSnapshotCount,
                      mRawSize,
                      mCbCrOffsetRaw,
                      yOffset,
@@ -3340,9 +3476,10 @@ bool QualcommCameraHardware::initRaw(bool initJpegHeap)
         LOGV("initRaw: initializing mJpegHeap.");
         mJpegHeap =
             new AshmemPool(mJpegMaxSize,
-                           kJpegBufferCount,
+                           mSnapshotCount > 1 ? kJpegBurstBufferCount : kJpegBufferCount,
                            0, // we do not know how big the picture will be
                            "jpeg");
+        mJpegSlot = 0;
 
         if (!mJpegHeap->initialized()) {
             mJpegHeap.clear();
@@ -3370,10 +3507,10 @@ bool QualcommCameraHardware::initRaw(bool initJpegHeap)
         pmem_region = "/dev/pmem_adsp";
 
         if (mThumbnailHeap != NULL)
-            mThumbnailHeap.clear();
+            putPmemPool(mThumbnailHeap);
 
         mThumbnailHeap =
-            new PmemPool(pmem_region,
+            getPmemPool(pmem_region,
                          MemoryHeapBase::READ_ONLY | MemoryHeapBase::NO_CACHING,
                          mCameraControlFd,
                          MSM_PMEM_THUMBNAIL,
@@ -3401,6 +3538,94 @@ bool QualcommCameraHardware::initRaw(bool initJpegHeap)
 }
 
 
+// Raw buffer the current shot of a burst was captured into.
+uint8_t *QualcommCameraHardware::snapshotBuffer()
+{
+    return (uint8_t *)mRawHeap->mHeap->base() +
+        mSnapshotIndex * mRawHeap->mAlignedBufferSize;
+}
+
+// Preview and record pools released by a mode switch are parked here
+// unregistered but still mapped, so switching back at the same size only
+// has to hand the buffers to the driver again instead of reallocating and
+// mapping pmem. The multi-MB snapshot and thumbnail pools are never kept:
+// they would hold pmem_adsp away from gralloc, the overlay and the encoder.
+static bool isCachedPmemType(int pmem_type)
+{
+    return pmem_type == MSM_PMEM_PREVIEW || pmem_type == MSM_PMEM_VIDEO;
+}
+
+sp<QualcommCameraHardware::PmemPool> QualcommCameraHardware::getPmemPool(
+        const char *pmem_pool, int flags, int camera_control_fd, int pmem_type,
+        int buffer_size, int num_buffers, int frame_size, int cbcr_offset,
+        int yoffset, const char *name)
+{
+    {
+        Mutex::Autolock l(&mHeapCacheLock);
+        for (size_t i = 0; i < mHeapCache.size(); i++) {
+            sp<PmemPool> pool = mHeapCache[i];
+            if (!strcmp(pool->mRegion, pmem_pool) && pool->mFlags == flags &&
+                pool->mPmemType == pmem_type &&
+                pool->mBufferSize == buffer_size &&
+                pool->mNumBuffers == num_buffers &&
+                pool->mFrameSize == frame_size &&
+                pool->mCbCrOffset == cbcr_offset && pool->myOffset == yoffset &&
+                !strcmp(pool->mName, name)) {
+                mHeapCache.removeAt(i);
+                LOGV("getPmemPool: reusing cached %s pool", name);
+                pool->registerBuffers(true);
+                return pool;
+            }
+        }
+        // A cached pool of this type at another size is stale now.
+        for (size_t i = mHeapCache.size(); i-- > 0; ) {
+            if (mHeapCache[i]->mPmemType == pmem_type)
+                mHeapCache.removeAt(i);
+        }
+    }
+
+    sp<PmemPool> pool = new PmemPool(pmem_pool, flags, camera_control_fd,
+                                     pmem_type, buffer_size, num_buffers,
+                                     frame_size, cbcr_offset, yoffset, name);
+    if (!pool->initialized() && flushHeapCache()) {
+        // The pmem regions are small; give back what the cache holds
+        // and try once more.
+        LOGI("getPmemPool: %s allocation failed, retrying with empty cache", name);
+        pool.clear();
+        pool = new PmemPool(pmem_pool, flags, camera_control_fd,
+                            pmem_type, buffer_size, num_buffers,
+                            frame_size, cbcr_offset, yoffset, name);
+    }
+    return pool;
+}
+
+// Unregister a preview or record pool from the driver and keep it for a
+// later getPmemPool() with the same geometry; any other pool is freed.
+// Always clears the reference.
+void QualcommCameraHardware::putPmemPool(sp<PmemPool> &pool)
+{
+    if (pool == NULL)
+        return;
+    if (pool->initialized() && isCachedPmemType(pool->mPmemType)) {
+        Mutex::Autolock l(&mHeapCacheLock);
+        pool->registerBuffers(false);
+        if (mHeapCache.size() >= kHeapCacheSize)
+            mHeapCache.removeAt(0);
+        mHeapCache.push(pool);
+    }
+    pool.clear();
+    pool = NULL;
+}
+
+// Returns whether anything was freed.
+bool QualcommCameraHardware::flushHeapCache()
+{
+    Mutex::Autolock l(&mHeapCacheLock);
+    bool freed = !mHeapCache.isEmpty();
+    mHeapCache.clear();
+    return freed;
+}
+
 void QualcommCameraHardware::deinitRawSnapshot()
 {
     LOGV("deinitRawSnapshot E");
@@ -3415,11 +3640,9 @@ void QualcommCameraHardware::deinitRaw()
 
     mJpegHeap.clear();
     mJpegHeap = NULL;
-    mRawHeap.clear();
-    mRawHeap = NULL;
+    putPmemPool(mRawHeap);
     if(mCurrentTarget != TARGET_MSM8660){
-       mThumbnailHeap.clear();
-       mThumbnailHeap = NULL;
+       putPmemPool(mThumbnailHeap);
        mDisplayHeap.clear();
        mDisplayHeap = NULL;
     }
@@ -3453,6 +3676,7 @@ void QualcommCameraHardware::release()
         stopPreviewInternal();
         LOGI("release: stopPreviewInternal done.");
     }
+    stopAutoFocusThread();
     LINK_jpeg_encoder_join();
     //Signal the snapshot thread
     mJpegThreadWaitLock.lock();
@@ -3500,14 +3724,19 @@ void QualcommCameraHardware::release()
     }
     if (mStatHeap != NULL) {
        LOGV("release: clearing mStatHeap");
+       mStatsWaitLock.lock();
+       for (int i = 0; i < 3; i++)
+           mStatSmallBuffers[i].clear();
        mStatHeap.clear();
        mStatHeap = NULL;
+       mStatsWaitLock.unlock();
     }
     if (mMetaDataHeap != NULL) {
        LOGV("release: clearing mMetaDataHeap");
        mMetaDataHeap.clear();
        mMetaDataHeap = NULL;
     }
+    flushHeapCache();
 
     // ctrlCmd.timeout_ms = 5000;
     // ctrlCmd.length = 0;
@@ -3520,6 +3749,14 @@ void QualcommCameraHardware::release()
     LINK_mm_camera_config_deinit(&mCfgControl);
     close(mCameraControlFd);
     mCameraControlFd = -1;
+    mBlitLock.lock();
+    if (mBlit.stats.flushes)
+        LOGI("release: %u blits (%u mdp, %u cpu, %u failed), avg %u us, max flush %u us",
+             mBlit.stats.mdp_blits + mBlit.stats.cpu_blits, mBlit.stats.mdp_blits,
+             mBlit.stats.cpu_blits, mBlit.stats.failures,
+             mdp_blit_average_us(&mBlit), mBlit.stats.max_us);
+    mdp_blit_init(&mBlit, -1);
+    mBlitLock.unlock();
     if(fb_fd >= 0) {
         close(fb_fd);
         fb_fd = -1;
@@ -3547,8 +3784,9 @@ QualcommCameraHardware::~QualcommCameraHardware()
     if( mCurrentTarget == TARGET_MSM7630 || mCurrentTarget == TARGET_QSD8250 || mCurrentTarget == TARGET_MSM8660 ) {
         delete [] recordframes;
         recordframes = NULL;
-        delete [] record_buffers_tracking_flag;
-        record_buffers_tracking_flag = NULL;
+        delete [] record_buffer_owner;
+        record_buffer_owner = NULL;
+        cam_frame_deinit_video();
     }
     singleton.clear();
     singleton_releasing = false;
@@ -3577,6 +3815,8 @@ status_t QualcommCameraHardware::startPreviewInternal()
         LOGV("startPreview X: preview already running.");
         return NO_ERROR;
     }
+    mPreviewStartTime = systemTime();
+    frame_interval_reset(&mPreviewIntervals, mParameters.getPreviewFrameRate());
 
     if (!mPreviewInitialized) {
         mLastQueuedFrame = NULL;
@@ -3668,9 +3908,7 @@ void QualcommCameraHardware::stopPreviewInternal()
                 mVideoThreadExit = 1;
                 mVideoThreadWaitLock.unlock();
                 //  720p : signal the video thread , and check in video thread if stop is called, if so exit video thread.
-                pthread_mutex_lock(&(g_busy_frame_queue.mut));
-                pthread_cond_signal(&(g_busy_frame_queue.wait));
-                pthread_mutex_unlock(&(g_busy_frame_queue.mut));
+                cam_frame_wake_video();
                 /* Flush the Busy Q */
                 cam_frame_flush_video();
                 /* Flush the Free Q */
@@ -3700,76 +3938,43 @@ void QualcommCameraHardware::stopPreview()
     LOGV("stopPreview: X");
 }
 
-void QualcommCameraHardware::runAutoFocus()
+// Runs one AF cycle on the worker's control fd; afMode < 0 means the
+// focus mode needs no AF (infinity, continuous video) and only reports
+// success.
+void QualcommCameraHardware::doAutoFocus(int afMode)
 {
     bool status = true;
-    void *libhandle = NULL;
-    int afMode;
 
     LOGV("%s E", __FUNCTION__);
-    mAutoFocusThreadLock.lock();
-    // Skip autofocus if focus mode is infinity.
-    const char * focusMode = mParameters.get(CameraParameters::KEY_FOCUS_MODE);
-    if ((mParameters.get(CameraParameters::KEY_FOCUS_MODE) == 0)
-           || (strcmp(focusMode, CameraParameters::FOCUS_MODE_INFINITY) == 0)
-           || (strcmp(focusMode, CameraParameters::FOCUS_MODE_CONTINUOUS_VIDEO) == 0)) {
-        goto done;
-    }
-
-    mAutoFocusFd = open(MSM_CAMERA_CONTROL, O_RDWR);
-    if (mAutoFocusFd < 0) {
-        LOGE("autofocus: cannot open %s: %s",
-             MSM_CAMERA_CONTROL,
-             strerror(errno));
-        mAutoFocusThreadRunning = false;
-        mAutoFocusThreadLock.unlock();
-        return;
-    }
-
-    LOGV("%s, libmmcamera: %p\n", __FUNCTION__, libmmcamera);
-    if(!libmmcamera){
-        LOGE("FATAL ERROR: could not dlopen liboemcamera.so: %s", dlerror());
-        close(mAutoFocusFd);
-        mAutoFocusFd = -1;
-        mAutoFocusThreadRunning = false;
-        mAutoFocusThreadLock.unlock();
-        return;
-    }
-
-    afMode = (int)attr_lookup(focus_modes,
-                                sizeof(focus_modes) / sizeof(str_map),
-                                mParameters.get(CameraParameters::KEY_FOCUS_MODE));
-
-    /* This will block until either AF completes or is cancelled. */
-    LOGV("af start (fd %d mode %d)", mAutoFocusFd, afMode);
-    status_t err;
-    err = mAfLock.tryLock();
-    if(err == NO_ERROR) {
-        {
-            Mutex::Autolock cameraRunningLock(&mCameraRunningLock);
-            if(mCameraRunning){
-                LOGV("Start AF");
-                status = native_set_afmode(mAutoFocusFd, afMode);
-            }else{
-                LOGV("As Camera preview is not running, AF not issued");
-                status = false;
+    if (afMode >= 0) {
+        /* This will block until either AF completes or is cancelled. */
+        LOGV("af start (fd %d mode %d)", mAutoFocusFd, afMode);
+        status_t err;
+        err = mAfLock.tryLock();
+        if(err == NO_ERROR) {
+            {
+                Mutex::Autolock cameraRunningLock(&mCameraRunningLock);
+                if(mCameraRunning){
+                    LOGV("Start AF");
+                    status = native_set_afmode(mAutoFocusFd, afMode);
+                }else{
+                    LOGV("As Camera preview is not running, AF not issued");
+                    status = false;
+                }
             }
+            mAfLock.unlock();
         }
-        mAfLock.unlock();
-    }
-    else{
-        //AF Cancel would have acquired the lock,
-        //so, no need to perform any AF
-        LOGV("As Cancel auto focus is in progress, auto focus request "
-                "is ignored");
-        status = FALSE;
+        else{
+            //AF Cancel would have acquired the lock,
+            //so, no need to perform any AF
+            LOGV("As Cancel auto focus is in progress, auto focus request "
+                    "is ignored");
+            status = FALSE;
+        }
+        LOGV("af done: %d", (int)status);
     }
 
-    LOGV("af done: %d", (int)status);
-    close(mAutoFocusFd);
-    mAutoFocusFd = -1;
-
-done:
+    mAutoFocusThreadLock.lock();
     mAutoFocusThreadRunning = false;
     mAutoFocusThreadLock.unlock();
 
@@ -3782,6 +3987,114 @@ done:
         cb(CAMERA_MSG_FOCUS, status, 0, data);
 }
 
+void QualcommCameraHardware::runAutoFocus()
+{
+    LOGV("%s E", __FUNCTION__);
+
+    mAutoFocusThreadLock.lock();
+    for (;;) {
+        while (!mAfCommands)
+            mAutoFocusThreadWait.wait(mAutoFocusThreadLock);
+        int cmds = mAfCommands;
+        mAfCommands = 0;
+        if (cmds & AF_CMD_EXIT)
+            break;
+        int afMode = mAfMode;
+        cam_set_aec_roi_t aec_roi_value = mAfAecRoi;
+        roi_info_t af_roi_value = mAfRoi;
+        mAutoFocusThreadLock.unlock();
+
+        // A touch region posted with a start applies to that start.
+        if (cmds & AF_CMD_ROI) {
+            native_set_parm(CAMERA_SET_PARM_AEC_ROI, sizeof(cam_set_aec_roi_t), (void *)&aec_roi_value);
+            native_set_parm(CAMERA_SET_PARM_AF_ROI, sizeof(roi_info_t), (void*)&af_roi_value);
+        }
+        if (cmds & AF_CMD_START)
+            doAutoFocus(afMode);
+
+        mAutoFocusThreadLock.lock();
+    }
+    // A start dropped by the exit still owes its caller the flag reset.
+    mAutoFocusThreadRunning = false;
+    close(mAutoFocusFd);
+    mAutoFocusFd = -1;
+    mAutoFocusThreadLock.unlock();
+
+    LOGV("%s X", __FUNCTION__);
+}
+
+void *auto_focus_thread(void *user);
+
+bool QualcommCameraHardware::startAutoFocusThread()
+{
+    Mutex::Autolock l(&mAutoFocusThreadLock);
+    if (mAfWorkerRunning)
+        return true;
+    if (mAutoFocusFd >= 0) {
+        // The stopped worker has not picked up its exit yet (it closes
+        // the fd under this lock when it does): withdraw the exit and let
+        // it carry on with the fd it has open.
+        LOGV("%s: reviving the exiting worker", __FUNCTION__);
+        mAfCommands &= ~AF_CMD_EXIT;
+        mAfWorkerRunning = true;
+        return true;
+    }
+
+    LOGV("%s, libmmcamera: %p\n", __FUNCTION__, libmmcamera);
+    if(!libmmcamera){
+        LOGE("FATAL ERROR: could not dlopen liboemcamera.so: %s", dlerror());
+        return false;
+    }
+
+    mAutoFocusFd = open(MSM_CAMERA_CONTROL, O_RDWR);
+    if (mAutoFocusFd < 0) {
+        LOGE("autofocus: cannot open %s: %s",
+             MSM_CAMERA_CONTROL,
+             strerror(errno));
+        return false;
+    }
+
+    // Detached: stopping never waits for it, since it may be inside the
+    // focus callback.
+    pthread_t thr;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    mAfCommands = 0;
+    mAfWorkerRunning = !pthread_create(&thr, &attr, auto_focus_thread, NULL);
+    if (!mAfWorkerRunning) {
+        LOGE("failed to start autofocus thread");
+        close(mAutoFocusFd);
+        mAutoFocusFd = -1;
+        return false;
+    }
+    return true;
+}
+
+void QualcommCameraHardware::stopAutoFocusThread()
+{
+    Mutex::Autolock l(&mAutoFocusThreadLock);
+    if (!mAfWorkerRunning)
+        return;
+    mAfCommands |= AF_CMD_EXIT;
+    mAutoFocusThreadWait.signal();
+    mAfWorkerRunning = false;
+}
+
+// Queue cmd for the worker. Returns false, leaving the caller to do the
+// work inline, when the worker is not running.
+bool QualcommCameraHardware::postAutoFocusCommand(int cmd)
+{
+    Mutex::Autolock l(&mAutoFocusThreadLock);
+    if (!mAfWorkerRunning)
+        return false;
+    if (mAfCommands & cmd)
+        LOGV("%s: coalesced command 0x%x", __FUNCTION__, cmd);
+    mAfCommands |= cmd;
+    mAutoFocusThreadWait.signal();
+    return true;
+}
+
 status_t QualcommCameraHardware::cancelAutoFocusInternal()
 {
     LOGV("cancelAutoFocusInternal E");
@@ -3791,7 +4104,15 @@ status_t QualcommCameraHardware::cancelAutoFocusInternal()
         return NO_ERROR;
     }
 
-    if (mAutoFocusFd < 0) {
+    mAutoFocusThreadLock.lock();
+    if (mAfCommands & AF_CMD_START) {
+        // Not picked up by the worker yet, just drop it.
+        mAfCommands &= ~AF_CMD_START;
+        mAutoFocusThreadRunning = false;
+    }
+    bool inProgress = mAutoFocusThreadRunning;
+    mAutoFocusThreadLock.unlock();
+    if (!inProgress) {
         LOGV("cancelAutoFocusInternal X: not in progress");
         return NO_ERROR;
     }
@@ -3855,6 +4176,18 @@ status_t QualcommCameraHardware::autoFocus()
         return UNKNOWN_ERROR;
     }
 
+    if (!startAutoFocusThread())
+        return UNKNOWN_ERROR;
+
+    // Skip autofocus if focus mode is infinity.
+    int afMode = -1;
+    const char *focusMode = mParameters.get(CameraParameters::KEY_FOCUS_MODE);
+    if (focusMode != NULL
+           && strcmp(focusMode, CameraParameters::FOCUS_MODE_INFINITY)
+           && strcmp(focusMode, CameraParameters::FOCUS_MODE_CONTINUOUS_VIDEO)) {
+        afMode = attr_lookup(focus_modes_table, focusMode);
+    }
+
     {
         mAutoFocusThreadLock.lock();
         if (!mAutoFocusThreadRunning) {
@@ -3865,23 +4198,15 @@ status_t QualcommCameraHardware::autoFocus()
             } else {
                 mSnapshotPrepare = TRUE;
             }
-
-            // Create a detached thread here so that we don't have to wait
-            // for it when we cancel AF.
-            pthread_t thr;
-            pthread_attr_t attr;
-            pthread_attr_init(&attr);
-            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-            mAutoFocusThreadRunning =
-                !pthread_create(&thr, &attr,
-                                auto_focus_thread, NULL);
-            if (!mAutoFocusThreadRunning) {
-                LOGE("failed to start autofocus thread");
-                mAutoFocusThreadLock.unlock();
-                return UNKNOWN_ERROR;
-            }
+            mAfMode = afMode;
+            mAutoFocusThreadRunning = true;
+            mAutoFocusThreadLock.unlock();
+            postAutoFocusCommand(AF_CMD_START);
+        } else {
+            // Already running or queued; that cycle answers this one too.
+            LOGV("autoFocus: request coalesced with the one in progress");
+            mAutoFocusThreadLock.unlock();
         }
-        mAutoFocusThreadLock.unlock();
     }
 
     LOGV("autoFocus X");
@@ -3914,9 +4239,13 @@ void QualcommCameraHardware::runSnapshotThread(void *data)
     }
 
     if(mSnapshotFormat == PICTURE_FORMAT_JPEG){
-        if (native_start_snapshot(mCameraControlFd))
-            ret = receiveRawPicture();
-        else {
+        if (native_start_snapshot(mCameraControlFd)) {
+            // In a burst the VFE fills one raw buffer per shot. Each shot
+            // is fetched while the previous one is still being encoded.
+            for (mSnapshotIndex = 0; ret && mSnapshotIndex < mSnapshotCount; mSnapshotIndex++)
+                ret = receiveRawPicture();
+            mSnapshotIndex = 0;
+        } else {
             LOGE("main: native_start_snapshot failed!");
             ret = false;
         }
@@ -3986,6 +4315,7 @@ status_t QualcommCameraHardware::takePicture()
 {
     LOGV("takePicture(%d)", mMsgEnabled);
     Mutex::Autolock l(&mLock);
+    mTakePictureTime = systemTime();
 
     if(strTexturesOn == true){
         mEncodePendingWaitLock.lock();
@@ -4012,6 +4342,15 @@ status_t QualcommCameraHardware::takePicture()
     else
         mSnapshotFormat = PICTURE_FORMAT_JPEG;
 
+    mSnapshotCount = 1;
+    if(mSnapshotFormat == PICTURE_FORMAT_JPEG && mNumCapture > 1 && strTexturesOn != true) {
+        int burst = mNumCapture;
+        if (mCfgControl.mm_camera_set_parm(CAMERA_PARM_SNAPSHOT_BURST_NUM, &burst) == MM_CAMERA_SUCCESS)
+            mSnapshotCount = burst;
+        else
+            LOGE("takePicture: burst of %d not supported, taking one shot", burst);
+    }
+
     if(mSnapshotFormat == PICTURE_FORMAT_JPEG){
         if(!mSnapshotPrepare){
             if(!native_prepare_snapshot(mCameraControlFd)) {
@@ -4140,6 +4479,7 @@ bool QualcommCameraHardware::initLiveSnapshot(int videowidth, int videoheight)
                        kJpegBufferCount,
                        0, // we do not know how big the picture will be
                        "jpeg");
+    mJpegSlot = 0;
 
     if (!mJpegHeap->initialized()) {
         mJpegHeap.clear();
@@ -4173,6 +4513,26 @@ status_t QualcommCameraHardware::cancelPicture()
     return rc;
 }
 
+// Whether any of keys (up to count, stopping at the first NULL) has a
+// different value in a than in b. An empty list always counts as changed.
+static bool params_differ(const CameraParameters& a, const CameraParameters& b,
+                          const char * const *keys, size_t count)
+{
+    if (count == 0 || keys[0] == NULL)
+        return true;
+    for (size_t i = 0; i < count && keys[i] != NULL; i++) {
+        const char *va = a.get(keys[i]);
+        const char *vb = b.get(keys[i]);
+        if (va == NULL || vb == NULL) {
+            if (va != vb)
+                return true;
+        } else if (strcmp(va, vb)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 status_t QualcommCameraHardware::setParameters(const CameraParameters& params)
 {
     LOGV("setParameters: E params = %p", &params);
@@ -4190,53 +4550,128 @@ status_t QualcommCameraHardware::setParameters(const CameraParameters& params)
     }
 #define CHECK_RESULT if (final_rc) { LOGV("Param set error at line %d", __LINE__); final_rc = NO_ERROR; }
 
-    if ((rc = setPreviewSize(params))) final_rc = rc; CHECK_RESULT;
-    if ((rc = setRecordSize(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setPictureSize(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setJpegThumbnailSize(params))) final_rc = rc; CHECK_RESULT;
-    if ((rc = setJpegQuality(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setPictureFormat(params))) final_rc = rc; CHECK_RESULT;
-    if ((rc = setRecordSize(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setPreviewFormat(params)))   final_rc = rc; CHECK_RESULT;
-    if ((rc = setEffect(params)))       final_rc = rc; CHECK_RESULT;
-    if ((rc = setGpsLocation(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setRotation(params)))     final_rc = rc; CHECK_RESULT;
-    if ((rc = setZoom(params)))         final_rc = rc; CHECK_RESULT;
-    if ((rc = setOrientation(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setLensshadeValue(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setPictureFormat(params))) final_rc = rc; CHECK_RESULT;
-    if ((rc = setSharpness(params)))    final_rc = rc; CHECK_RESULT;
-    if ((rc = setSaturation(params)))   final_rc = rc; CHECK_RESULT;
-    if ((rc = setContinuousAf(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setSelectableZoneAf(params)))   final_rc = rc; CHECK_RESULT;
-    if ((rc = setTouchAfAec(params)))   final_rc = rc; CHECK_RESULT;
-    if ((rc = setSceneMode(params)))    final_rc = rc; CHECK_RESULT;
-    if ((rc = setContrast(params)))     final_rc = rc; CHECK_RESULT;
-    if ((rc = setRecordSize(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setSceneDetect(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setStrTextures(params)))   final_rc = rc; CHECK_RESULT;
-    if ((rc = setPreviewFormat(params)))   final_rc = rc; CHECK_RESULT;
-    if ((rc = setSkinToneEnhancement(params)))   final_rc = rc; CHECK_RESULT;
-    if ((rc = setAntibanding(params)))  final_rc = rc; CHECK_RESULT;
-    if ((rc = setPreviewFpsRange(params)))  final_rc = rc; CHECK_RESULT;
+    // Handlers in the order they have to run, with the keys each one
+    // reads. After the first full pass a handler only runs again when one
+    // of its keys differs from what was last applied, so an unchanged set
+    // (apps resend everything on each touch-to-focus) costs no ioctls. An
+    // empty key list always runs.
+    static const struct {
+        status_t (QualcommCameraHardware::*set)(const CameraParameters&);
+        bool bestshotOffOnly;
+        const char *keys[6];
+    } handlers[] = {
+        { &QualcommCameraHardware::setPreviewSize, false,
+          { CameraParameters::KEY_PREVIEW_SIZE } },
+        { &QualcommCameraHardware::setRecordSize, false,
+          { CameraParameters::KEY_VIDEO_SIZE, CameraParameters::KEY_PREVIEW_SIZE } },
+        { &QualcommCameraHardware::setPictureSize, false,
+          { CameraParameters::KEY_PICTURE_SIZE } },
+        { &QualcommCameraHardware::setJpegThumbnailSize, false,
+          { CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH,
+            CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT } },
+        { &QualcommCameraHardware::setJpegQuality, false,
+          { CameraParameters::KEY_JPEG_QUALITY,
+            CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY } },
+        { &QualcommCameraHardware::setNumSnapsPerShutter, false,
+          { "num-snaps-per-shutter" } },
+        { &QualcommCameraHardware::setPictureFormat, false,
+          { CameraParameters::KEY_PICTURE_FORMAT } },
+        { &QualcommCameraHardware::setRecordSize, false,
+          { CameraParameters::KEY_VIDEO_SIZE, CameraParameters::KEY_PREVIEW_SIZE } },
+        { &QualcommCameraHardware::setPreviewFormat, false,
+          { CameraParameters::KEY_PREVIEW_FORMAT } },
+        { &QualcommCameraHardware::setEffect, false,
+          { CameraParameters::KEY_EFFECT } },
+        // Removed GPS keys have to be dropped from the EXIF data too.
+        { &QualcommCameraHardware::setGpsLocation, false, { NULL } },
+        { &QualcommCameraHardware::setRotation, false,
+          { CameraParameters::KEY_ROTATION } },
+        { &QualcommCameraHardware::setZoom, false, { "zoom" } },
+        { &QualcommCameraHardware::setOrientation, false, { "orientation" } },
+        { &QualcommCameraHardware::setLensshadeValue, false,
+          { CameraParameters::KEY_LENSSHADE } },
+        { &QualcommCameraHardware::setPictureFormat, false,
+          { CameraParameters::KEY_PICTURE_FORMAT } },
+        { &QualcommCameraHardware::setSharpness, false,
+          { CameraParameters::KEY_SHARPNESS } },
+        { &QualcommCameraHardware::setSaturation, false,
+          { CameraParameters::KEY_SATURATION, CameraParameters::KEY_EFFECT } },
+        { &QualcommCameraHardware::setContinuousAf, false,
+          { CameraParameters::KEY_CONTINUOUS_AF } },
+        { &QualcommCameraHardware::setSelectableZoneAf, false,
+          { CameraParameters::KEY_SELECTABLE_ZONE_AF } },
+        { &QualcommCameraHardware::setTouchAfAec, false,
+          { CameraParameters::KEY_TOUCH_AF_AEC, "touch-index-aec",
+            "touch-index-af", "touchAfAec-dx", "touchAfAec-dy" } },
+        { &QualcommCameraHardware::setSceneMode, false,
+          { CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setContrast, false,
+          { CameraParameters::KEY_CONTRAST, CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setRecordSize, false,
+          { CameraParameters::KEY_VIDEO_SIZE, CameraParameters::KEY_PREVIEW_SIZE } },
+        { &QualcommCameraHardware::setSceneDetect, false,
+          { CameraParameters::KEY_SCENE_DETECT } },
+        { &QualcommCameraHardware::setStrTextures, false, { "strtextures" } },
+        { &QualcommCameraHardware::setHistogramDelivery, false, { "histogram-delivery" } },
+        { &QualcommCameraHardware::setPreviewFormat, false,
+          { CameraParameters::KEY_PREVIEW_FORMAT } },
+        { &QualcommCameraHardware::setSkinToneEnhancement, false,
+          { "skinToneEnhancement" } },
+        { &QualcommCameraHardware::setAntibanding, false,
+          { CameraParameters::KEY_ANTIBANDING } },
+        { &QualcommCameraHardware::setPreviewFpsRange, false,
+          { CameraParameters::KEY_PREVIEW_FPS_RANGE } },
+
+        // Only applied while no bestshot scene is active, so a scene mode
+        // change re-applies all of them.
+        { &QualcommCameraHardware::setPreviewFrameRate, true,
+          { CameraParameters::KEY_PREVIEW_FRAME_RATE, CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setPreviewFrameRateMode, true,
+          { "preview-frame-rate-mode", CameraParameters::KEY_PREVIEW_FRAME_RATE,
+            CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setAutoExposure, true,
+          { CameraParameters::KEY_AUTO_EXPOSURE, CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setExposureCompensation, true,
+          { CameraParameters::KEY_EXPOSURE_COMPENSATION, CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setWhiteBalance, true,
+          { CameraParameters::KEY_WHITE_BALANCE, CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setFlash, true,
+          { CameraParameters::KEY_FLASH_MODE, CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setFocusMode, true,
+          { CameraParameters::KEY_FOCUS_MODE, CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setBrightness, true,
+          { "luma-adaptation", CameraParameters::KEY_SCENE_MODE } },
+        { &QualcommCameraHardware::setISOValue, true,
+          { CameraParameters::KEY_ISO_MODE, CameraParameters::KEY_SCENE_MODE } },
+
+        //selectableZoneAF needs to be invoked after continuous AF
+        { &QualcommCameraHardware::setSelectableZoneAf, false,
+          { CameraParameters::KEY_SELECTABLE_ZONE_AF,
+            CameraParameters::KEY_CONTINUOUS_AF } },
+    };
 
     const char *str = params.get(CameraParameters::KEY_SCENE_MODE);
-    int32_t value = attr_lookup(scenemode, sizeof(scenemode) / sizeof(str_map), str);
-
-    if((value != NOT_FOUND) && (value == CAMERA_BESTSHOT_OFF)) {
-        if ((rc = setPreviewFrameRate(params))) final_rc = rc; CHECK_RESULT;
-        if ((rc = setPreviewFrameRateMode(params))) final_rc = rc; CHECK_RESULT;
-        if ((rc = setAutoExposure(params))) final_rc = rc; CHECK_RESULT;
-        if ((rc = setExposureCompensation(params))) final_rc = rc; CHECK_RESULT;
-        if ((rc = setWhiteBalance(params))) final_rc = rc; CHECK_RESULT;
-        if ((rc = setFlash(params)))        final_rc = rc; CHECK_RESULT;
-        if ((rc = setFocusMode(params)))    final_rc = rc; CHECK_RESULT;
-        if ((rc = setBrightness(params)))   final_rc = rc; CHECK_RESULT;
-        if ((rc = setISOValue(params)))  final_rc = rc; CHECK_RESULT;
-    }
-    //selectableZoneAF needs to be invoked after continuous AF
-    if ((rc = setSelectableZoneAf(params)))   final_rc = rc; CHECK_RESULT;
-
+    int32_t value = attr_lookup(scenemode_table, str);
+    bool bestshotOff = (value != NOT_FOUND) && (value == CAMERA_BESTSHOT_OFF);
+
+    // Compare against what was applied before this call; the handlers
+    // update mParameters as they go. params may be mParameters itself
+    // (initDefaultParameters), which is always a full pass.
+    bool full = !mParametersApplied;
+    const CameraParameters applied(mParameters);
+    int run = 0;
+    for (size_t i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+        if (handlers[i].bestshotOffOnly && !bestshotOff)
+            continue;
+        if (!full && !params_differ(params, applied, handlers[i].keys,
+                                    sizeof(handlers[i].keys) / sizeof(handlers[i].keys[0])))
+            continue;
+        run++;
+        if ((rc = (this->*handlers[i].set)(params))) final_rc = rc; CHECK_RESULT;
+    }
+    mParametersApplied = true;
+
+    LOGV("setParameters: %d handlers run%s", run, full ? " (full pass)" : "");
     LOGV("setParameters: X, ret: %d", final_rc);
     return final_rc;
 }
@@ -4258,33 +4693,34 @@ status_t QualcommCameraHardware::setHistogramOn()
         return NO_ERROR;
      }
 
-    if (mStatHeap != NULL) {
-        LOGV("setHistogram on: clearing old mStatHeap.");
-        mStatHeap.clear();
-        mStatHeap = NULL;
+    // The heap outlives histogram-off, so toggling only costs the ioctl.
+    if (mStatHeap == NULL) {
+        mStatSize = sizeof(uint32_t)* HISTOGRAM_STATS_SIZE;
+        /*Currently the Ashmem is multiplying the buffer size with total number
+        of buffers and page aligning. This causes a crash in JNI as each buffer
+        individually expected to be page aligned  */
+        int page_size_minus_1 = getpagesize() - 1;
+        int32_t mAlignedStatSize = ((mStatSize + page_size_minus_1) & (~page_size_minus_1));
+
+        mStatHeap =
+                new AshmemPool(mAlignedStatSize,
+                               3,
+                               mStatSize,
+                               "stat");
+        if (!mStatHeap->initialized()) {
+            LOGE("Stat Heap X failed ");
+            mStatHeap.clear();
+            mStatHeap = NULL;
+            LOGE("setHistogramOn X: error initializing mStatHeap");
+            mStatsWaitLock.unlock();
+            return UNKNOWN_ERROR;
+        }
+        for (int i = 0; i < 3; i++)
+            mStatSmallBuffers[i] = new MemoryBase(mStatHeap->mHeap,
+                                                  i * mStatHeap->mBufferSize,
+                                                  sizeof(uint32_t) * HISTOGRAM_SMALL_STATS_SIZE);
     }
-
-    mStatSize = sizeof(uint32_t)* HISTOGRAM_STATS_SIZE;
     mCurrent = -1;
-    /*Currently the Ashmem is multiplying the buffer size with total number
-    of buffers and page aligning. This causes a crash in JNI as each buffer
-    individually expected to be page aligned  */
-    int page_size_minus_1 = getpagesize() - 1;
-    int32_t mAlignedStatSize = ((mStatSize + page_size_minus_1) & (~page_size_minus_1));
-
-    mStatHeap =
-            new AshmemPool(mAlignedStatSize,
-                           3,
-                           mStatSize,
-                           "stat");
-      if (!mStatHeap->initialized()) {
-          LOGE("Stat Heap X failed ");
-          mStatHeap.clear();
-          mStatHeap = NULL;
-          LOGE("setHistogramOn X: error initializing mStatHeap");
-          mStatsWaitLock.unlock();
-          return UNKNOWN_ERROR;
-      }
     mStatsOn = CAMERA_HISTOGRAM_ENABLE;
 
     mStatsWaitLock.unlock();
@@ -4306,14 +4742,30 @@ status_t QualcommCameraHardware::setHistogramOff()
 
     mCfgControl.mm_camera_set_parm(CAMERA_PARM_HISTOGRAM, &mStatsOn);
 
-    mStatsWaitLock.lock();
-    mStatHeap.clear();
-    mStatHeap = NULL;
-    mStatsWaitLock.unlock();
-
     return NO_ERROR;
 }
 
+status_t QualcommCameraHardware::setHistogramDelivery(const CameraParameters& params)
+{
+    const char *str = params.get("histogram-delivery");
+    if (str != NULL) {
+        int value = attr_lookup(histogram_delivery_table, str);
+        if (value != NOT_FOUND) {
+            mParameters.set("histogram-delivery", str);
+            mStatsWaitLock.lock();
+            if (mStatDelivery != value) {
+                // slots filled in the old mode are no base for "changed"
+                mStatDelivery = value;
+                mCurrent = -1;
+            }
+            mStatsWaitLock.unlock();
+            return NO_ERROR;
+        }
+    }
+    LOGE("Invalid histogram delivery value: %s", (str == NULL) ? "NULL" : str);
+    return BAD_VALUE;
+}
+
 //status_t QualcommCameraHardware::runFaceDetection()
 //{
 //    bool ret = true;
@@ -4404,7 +4856,6 @@ extern "C" sp<CameraHardwareInterface> openCameraHardware(int id)
 {
     LOGI("openCameraHardware: call createInstance");
     HAL_currentCameraId = id;
-    parameter_string_initialized = false;
     return QualcommCameraHardware::createInstance();
 }
 
@@ -4490,6 +4941,9 @@ void QualcommCameraHardware::receiveRecordingFrame(struct msm_frame *frame)
     // post busy frame
     if (frame)
     {
+        if (mRecordHeap != 0)
+            frame_trace(FRAME_TRACE_VFE, FRAME_TRACE_VIDEO,
+                        frame->buffer - (uint32_t)mRecordHeap->mHeap->base(), 0);
         cam_frame_post_video (frame);
     }
     else LOGE("in  receiveRecordingFrame frame is NULL");
@@ -4499,92 +4953,70 @@ void QualcommCameraHardware::receiveRecordingFrame(struct msm_frame *frame)
 
 bool QualcommCameraHardware::native_zoom_image(int fd, int srcOffset, int dstOffSet, common_crop_t *crop)
 {
-    int result = 0;
-    struct mdp_blit_req *e;
-    struct timeval td1, td2;
+    mdp_blit_frame_t src, dst;
+    struct mdp_rect src_rect, dst_rect;
 
     LOGV("%s E", __FUNCTION__);
-    /* Initialize yuv structure */
-    zoomImage.list.count = 1;
-
-    e = &zoomImage.list.req[0];
-
-    e->src.width = previewWidth;
-    e->src.height = previewHeight;
-    e->src.format = MDP_Y_CBCR_H2V2;
-    e->src.offset = srcOffset;
-    e->src.memory_id = fd;
-
-    e->dst.width = previewWidth;
-    e->dst.height = previewHeight;
-    e->dst.format = MDP_Y_CBCR_H2V2;
-    e->dst.offset = dstOffSet;
-    e->dst.memory_id = fd;
-
-    e->transp_mask = 0xffffffff;
-    e->flags = 0;
-    e->alpha = 0xff;
+    src.memory_id = fd;
+    src.base = (uint8_t *)mPreviewHeap->mHeap->base();
+    src.y_offset = srcOffset;
+    src.cbcr_offset = srcOffset + previewWidth * previewHeight;
+    src.width = previewWidth;
+    src.height = previewHeight;
+
+    dst = src;
+    dst.y_offset = dstOffSet;
+    dst.cbcr_offset = dstOffSet + previewWidth * previewHeight;
+
     if (crop->in1_w != 0 || crop->in1_h != 0) {
-        e->src_rect.x = (crop->out1_w - crop->in1_w + 1) / 2 - 1;
-        e->src_rect.y = (crop->out1_h - crop->in1_h + 1) / 2 - 1;
-        e->src_rect.w = crop->in1_w;
-        e->src_rect.h = crop->in1_h;
+        src_rect.x = (crop->out1_w - crop->in1_w + 1) / 2 - 1;
+        src_rect.y = (crop->out1_h - crop->in1_h + 1) / 2 - 1;
+        src_rect.w = crop->in1_w;
+        src_rect.h = crop->in1_h;
     } else {
-        e->src_rect.x = 0;
-        e->src_rect.y = 0;
-        e->src_rect.w = previewWidth;
-        e->src_rect.h = previewHeight;
+        src_rect.x = 0;
+        src_rect.y = 0;
+        src_rect.w = previewWidth;
+        src_rect.h = previewHeight;
     }
     //LOGV(" native_zoom : SRC_RECT : x,y = %d,%d \t w,h = %d, %d",
-    //        e->src_rect.x, e->src_rect.y, e->src_rect.w, e->src_rect.h);
+    //        src_rect.x, src_rect.y, src_rect.w, src_rect.h);
 
-    e->dst_rect.x = 0;
-    e->dst_rect.y = 0;
-    e->dst_rect.w = previewWidth;
-    e->dst_rect.h = previewHeight;
+    dst_rect.x = 0;
+    dst_rect.y = 0;
+    dst_rect.w = previewWidth;
+    dst_rect.h = previewHeight;
 
-    result = ioctl(fb_fd, MSMFB_BLIT, &zoomImage.list);
-    if (result < 0) {
-        LOGE("MSM_FBIOBLT failed! line=%d\n", __LINE__);
+    Mutex::Autolock l(&mBlitLock);
+    mdp_blit_queue(&mBlit, &dst, &dst_rect, &src, &src_rect);
+    if (mdp_blit_flush(&mBlit)) {
+        LOGE("preview zoom blit failed! line=%d\n", __LINE__);
         return FALSE;
     }
     return TRUE;
 }
 
+// Logs a stream's frame-interval statistics about once a second at 30fps.
+static void showIntervals(const frame_interval_t *t, const char *name)
+{
+    char line[192];
+
+    if (t->count % 32)
+        return;
+    int len = frame_interval_format(t, name, line, sizeof(line));
+    if (len > 0 && line[len - 1] == '\n')
+        line[len - 1] = '\0';
+    LOGI("%s", line);
+}
+
 void QualcommCameraHardware::debugShowPreviewFPS() const
 {
-    static int mFrameCount;
-    static int mLastFrameCount = 0;
-    static nsecs_t mLastFpsTime = 0;
-    static float mFps = 0;
-    LOGV("%s E", __FUNCTION__);
-    mFrameCount++;
-    nsecs_t now = systemTime();
-    nsecs_t diff = now - mLastFpsTime;
-    if (diff > ms2ns(250)) {
-        mFps =  ((mFrameCount - mLastFrameCount) * float(s2ns(1))) / diff;
-        LOGI("Preview Frames Per Second: %.4f", mFps);
-        mLastFpsTime = now;
-        mLastFrameCount = mFrameCount;
-    }
+    showIntervals(&mPreviewIntervals, "preview");
 }
 
 void QualcommCameraHardware::debugShowVideoFPS() const
 {
-    static int mFrameCount;
-    static int mLastFrameCount = 0;
-    static nsecs_t mLastFpsTime = 0;
-    static float mFps = 0;
-    LOGV("%s E", __FUNCTION__);
-    mFrameCount++;
-    nsecs_t now = systemTime();
-    nsecs_t diff = now - mLastFpsTime;
-    if (diff > ms2ns(250)) {
-        mFps =  ((mFrameCount - mLastFrameCount) * float(s2ns(1))) / diff;
-        LOGI("Video Frames Per Second: %.4f", mFps);
-        mLastFpsTime = now;
-        mLastFrameCount = mFrameCount;
-    }
+    showIntervals(&mVideoIntervals, "video");
 }
 
 void QualcommCameraHardware::receiveLiveSnapshot(uint32_t jpeg_size)
@@ -4634,16 +5066,14 @@ void QualcommCameraHardware::receivePreviewFrame(struct msm_frame *frame)
         return;
     }
 
+    frame_interval_add(&mPreviewIntervals, systemTime());
     if (UNLIKELY(mDebugFps)) {
         debugShowPreviewFPS();
     }
 
     mCallbackLock.lock();
     int msgEnabled = mMsgEnabled;
-    data_callback pcb = mDataCallback;
-    void *pdata = mCallbackCookie;
     data_callback_timestamp rcb = mDataCallbackTimestamp;
-    void *rdata = mCallbackCookie;
     data_callback mcb = mDataCallback;
     void *mdata = mCallbackCookie;
     mCallbackLock.unlock();
@@ -4654,8 +5084,21 @@ void QualcommCameraHardware::receivePreviewFrame(struct msm_frame *frame)
     ssize_t offset_addr =
         (ssize_t)frame->buffer - (ssize_t)mPreviewHeap->mHeap->base();
     ssize_t offset = offset_addr / mPreviewHeap->mAlignedBufferSize;
+    frame_trace(FRAME_TRACE_VFE, FRAME_TRACE_PREVIEW, offset_addr, 0);
 
     common_crop_t *crop = (common_crop_t *) (frame->cropinfo);
+    nsecs_t timeStamp = nsecs_t(frame->ts.tv_sec)*1000000000LL + frame->ts.tv_nsec;
+
+    if (UNLIKELY(mPreviewStartTime)) {
+        nsecs_t now = systemTime();
+        LOGI("receivePreviewFrame: first frame %lld us after startPreview",
+             (now - mPreviewStartTime) / 1000);
+        if (mTakePictureTime)
+            LOGI("receivePreviewFrame: first frame %lld us after takePicture",
+                 (now - mTakePictureTime) / 1000);
+        mPreviewStartTime = 0;
+        mTakePictureTime = 0;
+    }
 
 #ifdef DUMP_PREVIEW_FRAMES
     static int frameCnt = 0;
@@ -4681,6 +5124,78 @@ void QualcommCameraHardware::receivePreviewFrame(struct msm_frame *frame)
           frameCnt++;
 #endif
 
+#if 0
+    if ( mCurrentTarget == TARGET_MSM8660 ) {
+        mMetaDataWaitLock.lock();
+        if (mFaceDetectOn == true && mSendMetaData == true) {
+            mSendMetaData = false;
+            fd_roi_t *fd = (fd_roi_t *)(frame->roi_info.info);
+            int faces_detected = fd->rect_num;
+            int max_faces_detected = MAX_ROI * 4;
+            int array[max_faces_detected + 1];
+
+            array[0] = faces_detected * 4;
+            for (int i = 1, j = 0;j < MAX_ROI; j++, i = i + 4) {
+                if (j < faces_detected) {
+                    array[i]   = fd->faces[j].x;
+                    array[i+1] = fd->faces[j].y;
+                    array[i+2] = fd->faces[j].dx;
+                    array[i+3] = fd->faces[j].dx;
+                } else {
+                    array[i]   = -1;
+                    array[i+1] = -1;
+                    array[i+2] = -1;
+                    array[i+3] = -1;
+                }
+            }
+            memcpy((uint32_t *)mMetaDataHeap->mHeap->base(), (uint32_t *)array, (sizeof(int)*(MAX_ROI*4+1)));
+            if  (mcb != NULL && (msgEnabled & CAMERA_MSG_PREVIEW_METADATA)) {
+                mcb(CAMERA_MSG_PREVIEW_METADATA, mMetaDataHeap->mBuffers[0], mdata);
+            }
+        }
+        mMetaDataWaitLock.unlock();
+    }
+#endif
+
+    /* Recording from preview buffers (targets other than 7x30, 8x50 and
+     * 8x60) relies on this callback blocking until the encoder releases
+     * the frame, since the VFE reuses the buffer as soon as we return.
+     * Everything else is handed to the display thread.
+     */
+    bool recordFromPreview =
+        (mCurrentTarget != TARGET_MSM7630) && (mCurrentTarget != TARGET_QSD8250) &&
+        (mCurrentTarget != TARGET_MSM8660) &&
+        rcb != NULL && (msgEnabled & CAMERA_MSG_VIDEO_FRAME);
+
+    if (mDisplayThreadRunning && !recordFromPreview) {
+        mDisplayFrames[offset].crop = *crop;
+        mDisplayFrames[offset].ts = timeStamp;
+        if (!spsc_ring_push(&mDisplayRing, offset)) {
+            mDisplayDropped++;
+            LOGV("receivePreviewFrame: display thread busy, dropping frame %d", offset);
+        }
+    } else {
+        displayPreviewFrame(offset, crop, timeStamp);
+    }
+
+    LOGV("receivePreviewFrame X");
+}
+
+void QualcommCameraHardware::displayPreviewFrame(ssize_t offset, common_crop_t *crop,
+                                                 nsecs_t timeStamp)
+{
+    LOGV("displayPreviewFrame E");
+
+    mCallbackLock.lock();
+    int msgEnabled = mMsgEnabled;
+    data_callback pcb = mDataCallback;
+    void *pdata = mCallbackCookie;
+    data_callback_timestamp rcb = mDataCallbackTimestamp;
+    void *rdata = mCallbackCookie;
+    mCallbackLock.unlock();
+
+    ssize_t offset_addr = offset * mPreviewHeap->mAlignedBufferSize;
+
     mInPreviewCallback = true;
     if(mUseOverlay) {
         mOverlayLock.lock();
@@ -4727,16 +5242,15 @@ void QualcommCameraHardware::receivePreviewFrame(struct msm_frame *frame)
                to check if snapshot is currently in progress ensures that the resources being
                used by the snapshot thread are not incorrectly deallocated by preview thread*/
             if ((mCurrentTarget == TARGET_MSM8660)&&(mFirstFrame == true)&&(!mSnapshotThreadRunning)) {
-                LOGD(" receivePreviewFrame : first frame queued, display heap being deallocated");
-                mThumbnailHeap.clear();
-                mThumbnailHeap = NULL;
+                LOGD(" displayPreviewFrame : first frame queued, display heap being deallocated");
+                putPmemPool(mThumbnailHeap);
                 mDisplayHeap.clear();
                 mDisplayHeap = NULL;
                 mFirstFrame = false;
                 mPostViewHeap.clear();
                 mPostViewHeap = NULL;
             }
-            mLastQueuedFrame = (void *)frame->buffer;
+            mLastQueuedFrame = (void *)((ssize_t)mPreviewHeap->mHeap->base() + offset_addr);
         }
         mOverlayLock.unlock();
     } else {
@@ -4759,9 +5273,6 @@ void QualcommCameraHardware::receivePreviewFrame(struct msm_frame *frame)
             pdata);
 
     // If output  is NOT enabled (targets otherthan 7x30 , 8x50 and 8x60 currently..)
-
-    nsecs_t timeStamp = nsecs_t(frame->ts.tv_sec)*1000000000LL + frame->ts.tv_nsec;
-
     if( (mCurrentTarget != TARGET_MSM7630 ) &&  (mCurrentTarget != TARGET_QSD8250) && (mCurrentTarget != TARGET_MSM8660)) {
         if(rcb != NULL && (msgEnabled & CAMERA_MSG_VIDEO_FRAME)) {
             rcb(timeStamp, CAMERA_MSG_VIDEO_FRAME, mPreviewHeap->mBuffers[offset], rdata);
@@ -4774,41 +5285,9 @@ void QualcommCameraHardware::receivePreviewFrame(struct msm_frame *frame)
             mReleasedRecordingFrame = false;
         }
     }
-#if 0
-    if ( mCurrentTarget == TARGET_MSM8660 ) {
-        mMetaDataWaitLock.lock();
-        if (mFaceDetectOn == true && mSendMetaData == true) {
-            mSendMetaData = false;
-            fd_roi_t *fd = (fd_roi_t *)(frame->roi_info.info);
-            int faces_detected = fd->rect_num;
-            int max_faces_detected = MAX_ROI * 4;
-            int array[max_faces_detected + 1];
-
-            array[0] = faces_detected * 4;
-            for (int i = 1, j = 0;j < MAX_ROI; j++, i = i + 4) {
-                if (j < faces_detected) {
-                    array[i]   = fd->faces[j].x;
-                    array[i+1] = fd->faces[j].y;
-                    array[i+2] = fd->faces[j].dx;
-                    array[i+3] = fd->faces[j].dx;
-                } else {
-                    array[i]   = -1;
-                    array[i+1] = -1;
-                    array[i+2] = -1;
-                    array[i+3] = -1;
-                }
-            }
-            memcpy((uint32_t *)mMetaDataHeap->mHeap->base(), (uint32_t *)array, (sizeof(int)*(MAX_ROI*4+1)));
-            if  (mcb != NULL && (msgEnabled & CAMERA_MSG_PREVIEW_METADATA)) {
-                mcb(CAMERA_MSG_PREVIEW_METADATA, mMetaDataHeap->mBuffers[0], mdata);
-            }
-        }
-        mMetaDataWaitLock.unlock();
-    }
-#endif
     mInPreviewCallback = false;
 
-    LOGV("receivePreviewFrame X");
+    LOGV("displayPreviewFrame X");
 }
 
 void QualcommCameraHardware::receiveCameraStats(camstats_type stype, camera_preview_histogram_info* histinfo)
@@ -4828,26 +5307,71 @@ void QualcommCameraHardware::receiveCameraStats(camstats_type stype, camera_prev
     data_callback scb = mDataCallback;
     void *sdata = mCallbackCookie;
     mCallbackLock.unlock();
+
+    // Only the state checks and the slot choice happen under the lock;
+    // the bins are written into the slot after it is dropped.
     mStatsWaitLock.lock();
-    if(mStatsOn == CAMERA_HISTOGRAM_DISABLE) {
-      mStatsWaitLock.unlock();
-      return;
-    }
-    if(!mSendData) {
+    if(mStatsOn == CAMERA_HISTOGRAM_DISABLE || !mSendData || mStatHeap == NULL) {
         mStatsWaitLock.unlock();
-     } else {
-        mSendData = false;
-        mCurrent = (mCurrent+1)%3;
+        return;
+    }
+    mSendData = false;
+    int delivery = mStatDelivery;
+    int last = mCurrent;
+    int slot = (mCurrent + 1) % 3;
+    sp<AshmemPool> heap = mStatHeap;
+    sp<MemoryBase> small = mStatSmallBuffers[slot];
+    mStatsWaitLock.unlock();
+
+    uint32_t *bins = (uint32_t *)((uint8_t *)heap->mHeap->base() +
+                                  heap->mBufferSize * slot);
+    if (delivery == STATS_DELIVER_CHANGED && last >= 0) {
+        const uint32_t *prev = (const uint32_t *)((uint8_t *)heap->mHeap->base() +
+                                                  heap->mBufferSize * last);
+        if (prev[0] == (uint32_t)histinfo->max_value &&
+            !memcmp(prev + 1, histinfo->buffer, sizeof(int32_t) * 256)) {
+            // Nothing new; keep the request open for the next change.
+            mStatsWaitLock.lock();
+            if (mStatsOn == CAMERA_HISTOGRAM_ENABLE)
+                mSendData = true;
+            mStatsWaitLock.unlock();
+            return;
+        }
+    }
+
     // The first element of the array will contain the maximum hist value provided by driver.
-        *(uint32_t *)(mStatHeap->mHeap->base()+ (mStatHeap->mBufferSize * mCurrent)) = histinfo->max_value;
-        memcpy((uint32_t *)((unsigned int)mStatHeap->mHeap->base()+ (mStatHeap->mBufferSize * mCurrent)+ sizeof(int32_t)), (uint32_t *)histinfo->buffer,(sizeof(int32_t) * 256));
+    if (delivery == STATS_DELIVER_DOWNSAMPLED) {
+        uint32_t max = 0;
+        for (int i = 0; i < 256 / HISTOGRAM_DOWNSAMPLE; i++) {
+            const int32_t *in = histinfo->buffer + i * HISTOGRAM_DOWNSAMPLE;
+            uint32_t sum = in[0] + in[1] + in[2] + in[3];
+            bins[1 + i] = sum;
+            if (sum > max)
+                max = sum;
+        }
+        bins[0] = max;
+    } else {
+        bins[0] = histinfo->max_value;
+        memcpy(bins + 1, histinfo->buffer, sizeof(int32_t) * 256);
+    }
 
+    // Publish the slot unless histogram-on or a delivery change reset the
+    // rotation while it was being filled; then the request stays open.
+    mStatsWaitLock.lock();
+    if (mStatsOn != CAMERA_HISTOGRAM_ENABLE || mCurrent != last ||
+        mStatDelivery != delivery) {
+        if (mStatsOn == CAMERA_HISTOGRAM_ENABLE)
+            mSendData = true;
         mStatsWaitLock.unlock();
+        return;
+    }
+    mCurrent = slot;
+    mStatsWaitLock.unlock();
 
-        if (scb != NULL && (msgEnabled & CAMERA_MSG_STATS_DATA))
-            scb(CAMERA_MSG_STATS_DATA, mStatHeap->mBuffers[mCurrent],
-                sdata);
-     }
+    if (scb != NULL && (msgEnabled & CAMERA_MSG_STATS_DATA))
+        scb(CAMERA_MSG_STATS_DATA,
+            delivery == STATS_DELIVER_DOWNSAMPLED ? small : heap->mBuffers[slot],
+            sdata);
   //  LOGV("receiveCameraStats X");
 }
 
@@ -4896,11 +5420,11 @@ bool QualcommCameraHardware::initRecord()
     }
 
     if (mRecordHeap != NULL) {
-        LOGI("%s: Clearing previous mPreviewHeap", __FUNCTION__);
-        mRecordHeap.clear();
+        LOGI("%s: Clearing previous mRecordHeap", __FUNCTION__);
+        putPmemPool(mRecordHeap);
     }
 
-    mRecordHeap = new PmemPool(pmem_region,
+    mRecordHeap = getPmemPool(pmem_region,
                                MemoryHeapBase::READ_ONLY | MemoryHeapBase::NO_CACHING,
                                 mCameraControlFd,
                                 MSM_PMEM_VIDEO,
@@ -4924,12 +5448,19 @@ bool QualcommCameraHardware::initRecord()
         recordframes[cnt].y_off = 0;
         recordframes[cnt].cbcr_off = CbCrOffset;
         recordframes[cnt].path = OUTPUT_TYPE_V;
-        record_buffers_tracking_flag[cnt] = false;
+        record_buffer_owner[cnt] = RECORD_BUFFER_VFE;
         LOGV ("initRecord :  record heap , video buffers  buffer=%lu fd=%d y_off=%d cbcr_off=%d \n",
           (unsigned long)recordframes[cnt].buffer, recordframes[cnt].fd, recordframes[cnt].y_off,
           recordframes[cnt].cbcr_off);
     }
 
+    // Record buffers are evenly spaced, so a released buffer maps back to
+    // its recordframes[] index arithmetically.
+    mRecordBufferBase = recordframes[0].buffer;
+    mRecordBufferStride = mRecordHeap->mAlignedBufferSize;
+    mRecordBadReleases = 0;
+    mRecordLeakedBuffers = 0;
+
     // initial setup : buffers 1,2,3 with kernel , 4 with camframe , 5,6,7,8 in free Q
     // flush the busy Q
     cam_frame_flush_video();
@@ -5019,6 +5550,7 @@ status_t QualcommCameraHardware::startRecording()
     int ret;
     Mutex::Autolock l(&mLock);
     mReleasedRecordingFrame = false;
+    frame_interval_reset(&mVideoIntervals, mParameters.getPreviewFrameRate());
     if( (ret=startPreviewInternal())== NO_ERROR){
         if(mVpeEnabled){
             LOGI("startRecording: VPE enabled, setting vpe parameters");
@@ -5035,21 +5567,26 @@ status_t QualcommCameraHardware::startRecording()
             // Remove the left out frames in busy Q and them in free Q.
             // this should be done before starting video_thread so that,
             // frames in previous recording are flushed out.
-            LOGV("frames in busy Q = %d", g_busy_frame_queue.num_of_frames);
-            while((g_busy_frame_queue.num_of_frames) >0){
-                msm_frame* vframe = cam_frame_get_video ();
+            LOGV("frames in busy Q = %u", cam_frame_count_video());
+            msm_frame* vframe;
+            while((vframe = cam_frame_get_video ()) != NULL){
                 LINK_camframe_free_video(vframe);
             }
-            LOGV("frames in busy Q = %d after deQueing", g_busy_frame_queue.num_of_frames);
+            LOGV("frames in busy Q = %u after deQueing", cam_frame_count_video());
 
             //Clear the dangling buffers and put them in free queue
+            mRecordFrameLock.lock();
             for(int cnt = 0; cnt < kRecordBufferCount; cnt++) {
-                if(record_buffers_tracking_flag[cnt] == true) {
-                    LOGI("Dangling buffer: offset = %d, buffer = %d", cnt, (unsigned int)recordframes[cnt].buffer);
+                if(record_buffer_owner[cnt] != RECORD_BUFFER_VFE) {
+                    mRecordLeakedBuffers++;
                     LINK_camframe_free_video(&recordframes[cnt]);
-                    record_buffers_tracking_flag[cnt] = false;
+                    record_buffer_owner[cnt] = RECORD_BUFFER_VFE;
                 }
             }
+            if (mRecordLeakedBuffers)
+                LOGI("startRecording: %u record buffers were never released",
+                     mRecordLeakedBuffers);
+            mRecordFrameLock.unlock();
 
             // Start video thread and wait for busy frames to be encoded, this thread
             // should be closed in stopRecording
@@ -5092,9 +5629,7 @@ void QualcommCameraHardware::stopRecording()
         mVideoThreadWaitLock.unlock();
         native_stop_recording(mCameraControlFd);
 
-        pthread_mutex_lock(&(g_busy_frame_queue.mut));
-        pthread_cond_signal(&(g_busy_frame_queue.wait));
-        pthread_mutex_unlock(&(g_busy_frame_queue.mut));
+        cam_frame_wake_video();
     }
     else  // for other targets where output2 is not enabled
         stopPreviewInternal();
@@ -5105,47 +5640,49 @@ void QualcommCameraHardware::stopRecording()
         mJpegHeap = NULL;
     }
     recordingState = 0; // recording not started
+    if (mRecordBadReleases)
+        LOGE("stopRecording: %u bad record frame releases", mRecordBadReleases);
     LOGV("stopRecording: X");
 }
 
+int QualcommCameraHardware::recordFrameIndex(const sp<IMemory>& mem)
+{
+    ssize_t offset;
+    size_t size;
+    sp<IMemoryHeap> heap = mem->getMemory(&offset, &size);
+    uint32_t delta = (uint32_t)heap->base() + offset - mRecordBufferBase;
+
+    if (!mRecordBufferStride || delta % mRecordBufferStride)
+        return -1;
+    delta /= mRecordBufferStride;
+    return delta < (uint32_t)kRecordBufferCount ? (int)delta : -1;
+}
+
 void QualcommCameraHardware::releaseRecordingFrame(
        const sp<IMemory>& mem __attribute__((unused)))
 {
     LOGV("releaseRecordingFrame E");
+    frame_trace(FRAME_TRACE_RELEASE, FRAME_TRACE_VIDEO, mem->offset(), 0);
     Mutex::Autolock rLock(&mRecordFrameLock);
     mReleasedRecordingFrame = true;
     mRecordWait.signal();
 
     // Ff 7x30 : add the frame to the free camframe queue
     if( (mCurrentTarget == TARGET_MSM7630 )  || (mCurrentTarget == TARGET_QSD8250) || (mCurrentTarget == TARGET_MSM8660)) {
-        ssize_t offset;
-        size_t size;
-        sp<IMemoryHeap> heap = mem->getMemory(&offset, &size);
-        msm_frame* releaseframe = NULL;
-        LOGV(" in release recording frame :  heap base %p offset %lu buffer %lx ", heap->base(), offset, (unsigned long)heap->base() + offset );
-        int cnt;
-        for (cnt = 0; cnt < kRecordBufferCount; cnt++) {
-            if((unsigned int)recordframes[cnt].buffer == ((unsigned int)heap->base()+ offset)){
-                LOGV("in release recording frame found match , releasing buffer %d", (unsigned int)recordframes[cnt].buffer);
-                releaseframe = &recordframes[cnt];
-                break;
-            }
-        }
-        if(cnt < kRecordBufferCount) {
+        int cnt = recordFrameIndex(mem);
+        if (cnt < 0 || record_buffer_owner[cnt] != RECORD_BUFFER_ENCODER) {
+            // Unknown buffer or released twice; counted, not logged per
+            // frame, see stopRecording().
+            mRecordBadReleases++;
+            LOGV("releaseRecordingFrame: bad release of buffer %d", cnt);
+        } else {
             // do this only if frame thread is running
             mFrameThreadWaitLock.lock();
             if(mFrameThreadRunning ) {
-                //Reset the track flag for this frame buffer
-                record_buffers_tracking_flag[cnt] = false;
-                LINK_camframe_free_video(releaseframe);
+                record_buffer_owner[cnt] = RECORD_BUFFER_VFE;
+                LINK_camframe_free_video(&recordframes[cnt]);
             }
-
             mFrameThreadWaitLock.unlock();
-        } else {
-            LOGE("in release recordingframe XXXXX error , buffer not found");
-            for (int i=0; i< kRecordBufferCount; i++) {
-                 LOGE(" recordframes[%d].buffer = %d", i, (unsigned int)recordframes[i].buffer);
-            }
         }
     }
 
@@ -5275,119 +5812,81 @@ static void receive_shutter_callback(common_crop_t *crop)
     LOGV("receive_shutter_callback: X");
 }
 
-// Crop the picture in place.
-static void crop_yuv420(uint32_t width, uint32_t height,
-                 uint32_t cropped_width, uint32_t cropped_height,
-                 uint8_t *image, const char *name)
-{
-    uint32_t i;
-    uint32_t x, y;
-    uint8_t* chroma_src, *chroma_dst;
-    int yOffsetSrc, yOffsetDst, CbCrOffsetSrc, CbCrOffsetDst;
-    int mSrcSize, mDstSize;
-
-    LOGV("%s E", __FUNCTION__);
-    //check if all fields needed eg. size and also how to set y offset. If condition for 7x27
-    //and need to check if needed for 7x30.
-
-    LINK_jpeg_encoder_get_buffer_offset(width, height, (uint32_t *)&yOffsetSrc,
-                                       (uint32_t *)&CbCrOffsetSrc, (uint32_t *)&mSrcSize);
-
-    LINK_jpeg_encoder_get_buffer_offset(cropped_width, cropped_height, (uint32_t *)&yOffsetDst,
-                                       (uint32_t *)&CbCrOffsetDst, (uint32_t *)&mDstSize);
+// Where the planes of a picture buffer handed to crop_yuv420() live.
+enum crop_layout {
+    CROP_LAYOUT_ENCODER,    // at the JPEG encoder's offsets for the size
+    CROP_LAYOUT_PACKED,     // luma at 0, chroma right after it
+};
 
-    // Calculate the start position of the cropped area.
-    x = (width - cropped_width) / 2;
-    y = (height - cropped_height) / 2;
-    x &= ~1;
-    y &= ~1;
-
-    if((mCurrentTarget == TARGET_MSM7627)
-       || (mCurrentTarget == TARGET_MSM7630)
-       || (mCurrentTarget == TARGET_MSM8660)) {
-        if (!strcmp("snapshot camera", name)) {
-            chroma_src = image + CbCrOffsetSrc;
-            chroma_dst = image + CbCrOffsetDst;
-        } else {
-            chroma_src = image + width * height;
-            chroma_dst = image + cropped_width * cropped_height;
-            yOffsetSrc = 0;
-            yOffsetDst = 0;
-            CbCrOffsetSrc = width * height;
-            CbCrOffsetDst = cropped_width * cropped_height;
-        }
-    } else {
-       chroma_src = image + CbCrOffsetSrc;
-       chroma_dst = image + CbCrOffsetDst;
-    }
-
-    int32_t bufDst = yOffsetDst;
-    int32_t bufSrc = yOffsetSrc + (width * y) + x;
-
-    if( bufDst > bufSrc ){
-        LOGV("crop yuv Y destination position follows source position");
-        /*
-         * If buffer destination follows buffer source, memcpy
-         * of lines will lead to overwriting subsequent lines. In order
-         * to prevent this, reverse copying of lines is performed
-         * for the set of lines where destination follows source and
-         * forward copying of lines is performed for lines where source
-         * follows destination. To calculate the position to switch,
-         * the initial difference between source and destination is taken
-         * and divided by difference between width and cropped width. For
-         * every line copied the difference between source destination
-         * drops by width - cropped width
-         */
-        //calculating inversion
-        int position = ( bufDst - bufSrc ) / (width - cropped_width);
-        // Copy luma component.
-        for(i=position+1; i < cropped_height; i++){
-            memmove(image + yOffsetDst + i * cropped_width,
-                    image + yOffsetSrc + width * (y + i) + x,
-                    cropped_width);
-        }
-        for(int j=position; j>=0; j--){
-            memmove(image + yOffsetDst + j * cropped_width,
-                    image + yOffsetSrc + width * (y + j) + x,
-                    cropped_width);
+// LINK_jpeg_encoder_get_buffer_offset() for the last few sizes; a zoomed
+// capture asks for the same full and cropped sizes every time. Callers
+// hold mBlitLock.
+static void encoder_offsets(uint32_t width, uint32_t height,
+                            uint32_t *yOffset, uint32_t *cbcrOffset)
+{
+    static struct {
+        uint32_t width, height, yOffset, cbcrOffset;
+    } cache[4];
+    static int next;
+    uint32_t size;
+
+    for (int i = 0; i < 4; i++) {
+        if (cache[i].width == width && cache[i].height == height) {
+            *yOffset = cache[i].yOffset;
+            *cbcrOffset = cache[i].cbcrOffset;
+            return;
         }
+    }
+    LINK_jpeg_encoder_get_buffer_offset(width, height, yOffset, cbcrOffset, &size);
+    cache[next].width = width;
+    cache[next].height = height;
+    cache[next].yOffset = *yOffset;
+    cache[next].cbcrOffset = *cbcrOffset;
+    next = (next + 1) % 4;
+}
+
+static void crop_frame(mdp_blit_frame_t *f, crop_layout layout, uint8_t *base,
+                       uint32_t width, uint32_t height)
+{
+    f->memory_id = -1;
+    f->base = base;
+    f->width = width;
+    f->height = height;
+    if (layout == CROP_LAYOUT_ENCODER) {
+        encoder_offsets(width, height, &f->y_offset, &f->cbcr_offset);
     } else {
-        // Copy luma component.
-        for(i = 0; i < cropped_height; i++)
-            memcpy(image + yOffsetDst + i * cropped_width,
-                   image + yOffsetSrc + width * (y + i) + x,
-                   cropped_width);
+        f->y_offset = 0;
+        f->cbcr_offset = width * height;
     }
+}
 
-    // Copy chroma components.
-    cropped_height /= 2;
-    y /= 2;
+// Queue a centered crop of the picture in image on blit; the caller
+// flushes. The result goes to dest in the same layout, or back into
+// image when dest is NULL, which only the CPU can do.
+static void crop_yuv420(mdp_blit_t *blit, crop_layout layout,
+                 uint32_t width, uint32_t height,
+                 uint32_t cropped_width, uint32_t cropped_height,
+                 uint8_t *image, uint8_t *dest)
+{
+    mdp_blit_frame_t src, dst;
+    struct mdp_rect src_rect, dst_rect;
 
-    bufDst = CbCrOffsetDst;
-    bufSrc = CbCrOffsetSrc + (width * y) + x;
+    LOGV("%s E", __FUNCTION__);
+    crop_frame(&src, layout, image, width, height);
+    crop_frame(&dst, layout, dest ? dest : image, cropped_width, cropped_height);
 
-    if( bufDst > bufSrc ) {
-        LOGV("crop yuv Chroma destination position follows source position");
-        /*
-         * Similar to y
-         */
-        int position = ( bufDst - bufSrc ) / (width - cropped_width);
-        for(i=position+1; i < cropped_height; i++){
-            memmove(chroma_dst + i * cropped_width,
-                    chroma_src + width * (y + i) + x,
-                    cropped_width);
-        }
-        for(int j=position; j >=0; j--){
-            memmove(chroma_dst + j * cropped_width,
-                    chroma_src + width * (y + j) + x,
-                    cropped_width);
-        }
-    } else {
-        for(i = 0; i < cropped_height; i++)
-            memcpy(chroma_dst + i * cropped_width,
-                   chroma_src + width * (y + i) + x,
-                   cropped_width);
-    }
+    // Calculate the start position of the cropped area.
+    src_rect.x = (width - cropped_width) / 2;
+    src_rect.y = (height - cropped_height) / 2;
+    src_rect.w = cropped_width;
+    src_rect.h = cropped_height;
+    dst_rect.x = 0;
+    dst_rect.y = 0;
+    dst_rect.w = cropped_width;
+    dst_rect.h = cropped_height;
+
+    if (!mdp_blit_queue(blit, &dst, &dst_rect, &src, &src_rect))
+        LOGE("%s: blit queue full, picture not cropped", __FUNCTION__);
 }
 
 bool QualcommCameraHardware::receiveRawSnapshot(){
@@ -5428,8 +5927,10 @@ bool QualcommCameraHardware::receiveRawPicture()
 {
     LOGV("receiveRawPicture: E");
 
+    {
     Mutex::Autolock cbLock(&mCallbackLock);
-    if (mDataCallback && ((mMsgEnabled & CAMERA_MSG_RAW_IMAGE) || mSnapshotDone)) {
+    if (mDataCallback && ((mMsgEnabled & CAMERA_MSG_RAW_IMAGE) || mSnapshotDone ||
+                          mSnapshotIndex > 0)) {
         if(native_get_picture(mCameraControlFd, &mCrop) == false) {
             LOGE("getPicture failed!");
             return false;
@@ -5453,9 +5954,11 @@ bool QualcommCameraHardware::receiveRawPicture()
             notifyShutter(&mCrop, FALSE);
             {
                 Mutex::Autolock l(&mRawPictureHeapLock);
+                Mutex::Autolock blitLock(&mBlitLock);
                 if(mRawHeap != NULL){
-                  crop_yuv420(mCrop.out2_w, mCrop.out2_h, (mCrop.in2_w + jpegPadding), (mCrop.in2_h + jpegPadding),
-                            (uint8_t *)mRawHeap->mHeap->base(), mRawHeap->mName);
+                  crop_yuv420(&mBlit, CROP_LAYOUT_ENCODER,
+                            mCrop.out2_w, mCrop.out2_h, (mCrop.in2_w + jpegPadding), (mCrop.in2_h + jpegPadding),
+                            snapshotBuffer(), NULL);
                 }
                 if( (mThumbnailHeap != NULL) &&
                     (mCurrentTarget != TARGET_MSM7630) &&
@@ -5463,9 +5966,14 @@ bool QualcommCameraHardware::receiveRawPicture()
                     //Don't crop the mThumbnailHeap for 7630. As this heap
                     //is used for postview rather than for thumbnail. (thumbnail is generated from main image).
                     //overlay's setCrop will take of cropping while displaying postview.
-                    crop_yuv420(mCrop.out1_w, mCrop.out1_h, (mCrop.in1_w + jpegPadding), (mCrop.in1_h + jpegPadding),
-                            (uint8_t *)mThumbnailHeap->mHeap->base(), mThumbnailHeap->mName);
+                    crop_yuv420(&mBlit,
+                            mCurrentTarget == TARGET_MSM7627 ? CROP_LAYOUT_PACKED : CROP_LAYOUT_ENCODER,
+                            mCrop.out1_w, mCrop.out1_h, (mCrop.in1_w + jpegPadding), (mCrop.in1_h + jpegPadding),
+                            (uint8_t *)mThumbnailHeap->mHeap->base(), NULL);
                 }
+                // Snapshot and postview crops go out as one batch.
+                if (mdp_blit_flush(&mBlit))
+                    LOGE("snapshot crop blit failed");
             }
 
             // We do not need jpeg encoder to upscale the image. Set the new
@@ -5533,10 +6041,24 @@ bool QualcommCameraHardware::receiveRawPicture()
         }
     }
     else LOGV("Raw-picture callback was canceled--skipping.");
+    }
 
     if(strTexturesOn != true) {
-        if (mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE)) {
+        mCallbackLock.lock();
+        bool encode = mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE);
+        mCallbackLock.unlock();
+        if (encode) {
+            // The previous shot of a burst may still be encoding. Wait
+            // without mCallbackLock, its jpeg callback needs it.
+            if (mSnapshotIndex > 0) {
+                mJpegThreadWaitLock.lock();
+                while (mJpegThreadRunning)
+                    mJpegThreadWait.wait(mJpegThreadWaitLock);
+                mJpegThreadWaitLock.unlock();
+                LINK_jpeg_encoder_join();
+            }
             mJpegSize = 0;
+            mJpegSlot = mSnapshotIndex % mJpegHeap->mNumBuffers;
             mJpegThreadWaitLock.lock();
             if (LINK_jpeg_encoder_init()) {
                 mJpegThreadRunning = true;
@@ -5564,9 +6086,9 @@ void QualcommCameraHardware::receiveJpegPictureFragment(
     uint8_t *buff_ptr, uint32_t buff_size)
 {
     LOGV("receiveJpegPictureFragment size %d", buff_size);
-    uint32_t remaining = mJpegHeap->mHeap->virtualSize();
-    remaining -= mJpegSize;
-    uint8_t *base = (uint8_t *)mJpegHeap->mHeap->base();
+    uint32_t remaining = mJpegHeap->mBufferSize - mJpegSize;
+    uint8_t *base = (uint8_t *)mJpegHeap->mHeap->base() +
+                    mJpegSlot * mJpegHeap->mBufferSize;
 
     if (buff_size > remaining) {
         LOGE("receiveJpegPictureFragment: size %d exceeds what "
@@ -5575,6 +6097,8 @@ void QualcommCameraHardware::receiveJpegPictureFragment(
              remaining);
         buff_size = remaining;
     }
+    frame_trace(FRAME_TRACE_JPEG_FRAGMENT, FRAME_TRACE_SNAPSHOT,
+                mJpegSize, buff_size);
     memcpy(base + mJpegSize, buff_ptr, buff_size);
     mJpegSize += buff_size;
 }
@@ -5583,9 +6107,12 @@ void QualcommCameraHardware::receiveJpegPicture(void)
 {
     LOGV("receiveJpegPicture: E image (%d uint8_ts out of %d)",
          mJpegSize, mJpegHeap->mBufferSize);
+    frame_trace(FRAME_TRACE_JPEG_DONE, FRAME_TRACE_SNAPSHOT, mJpegSize, 0);
     Mutex::Autolock cbLock(&mCallbackLock);
 
-    int index = 0;
+    // In a burst each shot has its own buffer of the ring, so the next
+    // one encodes elsewhere while the client reads this one.
+    int index = mJpegSlot;
 
     if (mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE)) {
         // The reason we do not allocate into mJpegHeap->mBuffers[offset] is
@@ -5750,7 +6277,7 @@ status_t QualcommCameraHardware::setPreviewFrameRateMode(const CameraParameters&
         LOGV("frame rate mode same as previous mode %s", previousMode);
         return NO_ERROR;
     }
-    int32_t frameRateMode = attr_lookup(frame_rate_modes, sizeof(frame_rate_modes) / sizeof(str_map),str);
+    int32_t frameRateMode = attr_lookup(frame_rate_modes_table, str);
     if(frameRateMode != NOT_FOUND) {
         LOGV("setPreviewFrameRateMode: %s ", str);
         mParameters.setPreviewFrameRateMode(str);
@@ -5841,14 +6368,30 @@ status_t QualcommCameraHardware::setJpegQuality(const CameraParameters& params)
     return rc;
 }
 
+status_t QualcommCameraHardware::setNumSnapsPerShutter(const CameraParameters& params)
+{
+    const char *str = params.get("num-snaps-per-shutter");
+    if (str == NULL)
+        return NO_ERROR;
+
+    int num = atoi(str);
+    if (num < 1 || num > MAX_SNAPSHOT_BUFFERS) {
+        LOGE("Invalid num-snaps-per-shutter = %s", str);
+        return BAD_VALUE;
+    }
+    mParameters.set("num-snaps-per-shutter", num);
+    mNumCapture = num;
+    return NO_ERROR;
+}
+
 status_t QualcommCameraHardware::setEffect(const CameraParameters& params)
 {
     const char *str_wb = mParameters.get(CameraParameters::KEY_WHITE_BALANCE);
-    int32_t value_wb = attr_lookup(whitebalance, sizeof(whitebalance) / sizeof(str_map), str_wb);
+    int32_t value_wb = attr_lookup(whitebalance_table, str_wb);
     const char *str = params.get(CameraParameters::KEY_EFFECT);
 
     if (str != NULL) {
-        int32_t value = attr_lookup(effects, sizeof(effects) / sizeof(str_map), str);
+        int32_t value = attr_lookup(effects_table, str);
         if (value != NOT_FOUND) {
            if((!strcmp(sensorType->name, "2mp") ||
                (!strcmp(sensorType->name, "mt9m113")) ||
@@ -5916,7 +6459,7 @@ status_t QualcommCameraHardware::setAutoExposure(const CameraParameters& params)
     }
     const char *str = params.get(CameraParameters::KEY_AUTO_EXPOSURE);
     if (str != NULL) {
-        int32_t value = attr_lookup(autoexposure, sizeof(autoexposure) / sizeof(str_map), str);
+        int32_t value = attr_lookup(autoexposure_table, str);
         if (value != NOT_FOUND) {
             mParameters.set(CameraParameters::KEY_AUTO_EXPOSURE, str);
             bool ret = native_set_parm(CAMERA_SET_PARM_EXPOSURE, sizeof(value),
@@ -5957,7 +6500,7 @@ status_t QualcommCameraHardware::setContrast(const CameraParameters& params)
         return NO_ERROR;
     }
     const char *str = params.get(CameraParameters::KEY_SCENE_MODE);
-    int32_t value = attr_lookup(scenemode, sizeof(scenemode) / sizeof(str_map), str);
+    int32_t value = attr_lookup(scenemode_table, str);
 
     if(value == CAMERA_BESTSHOT_OFF) {
         int contrast = params.getInt(CameraParameters::KEY_CONTRAST);
@@ -5986,7 +6529,7 @@ status_t QualcommCameraHardware::setSaturation(const CameraParameters& params)
         return NO_ERROR;
     }
     const char *str = params.get(CameraParameters::KEY_EFFECT);
-    int32_t value = attr_lookup(effects, sizeof(effects) / sizeof(str_map), str);
+    int32_t value = attr_lookup(effects_table, str);
 
     if( (value != CAMERA_EFFECT_MONO) && (value != CAMERA_EFFECT_NEGATIVE)
 	    && (value != CAMERA_EFFECT_AQUA) && (value != CAMERA_EFFECT_SEPIA)) {
@@ -6010,7 +6553,7 @@ status_t QualcommCameraHardware::setSaturation(const CameraParameters& params)
 
 status_t QualcommCameraHardware::setPreviewFormat(const CameraParameters& params) {
     const char *str = params.getPreviewFormat();
-    int32_t previewFormat = attr_lookup(preview_formats, sizeof(preview_formats) / sizeof(str_map), str);
+    int32_t previewFormat = attr_lookup(preview_formats_table, str);
     if(previewFormat != NOT_FOUND) {
         mParameters.set(CameraParameters::KEY_PREVIEW_FORMAT, str);
         mPreviewFormat = previewFormat;
@@ -6084,14 +6627,14 @@ status_t QualcommCameraHardware::setWhiteBalance(const CameraParameters& params)
         return NO_ERROR;
     }
     const char *str_effect = mParameters.get(CameraParameters::KEY_EFFECT);
-    int32_t value_effect = attr_lookup(effects, sizeof(effects) / sizeof(str_map), str_effect);
+    int32_t value_effect = attr_lookup(effects_table, str_effect);
 
     if( (value_effect != CAMERA_EFFECT_MONO) && (value_effect != CAMERA_EFFECT_NEGATIVE)
     && (value_effect != CAMERA_EFFECT_AQUA) && (value_effect != CAMERA_EFFECT_SEPIA)) {
         const char *str = params.get(CameraParameters::KEY_WHITE_BALANCE);
 
         if (str != NULL) {
-            int32_t value = attr_lookup(whitebalance, sizeof(whitebalance) / sizeof(str_map), str);
+            int32_t value = attr_lookup(whitebalance_table, str);
             if (value != NOT_FOUND) {
                 mParameters.set(CameraParameters::KEY_WHITE_BALANCE, str);
                 bool ret = native_set_parm(CAMERA_SET_PARM_WB, sizeof(value),
@@ -6116,7 +6659,7 @@ status_t QualcommCameraHardware::setFlash(const CameraParameters& params)
     }
     const char *str = params.get(CameraParameters::KEY_FLASH_MODE);
     if (str != NULL) {
-        int32_t value = attr_lookup(flash, sizeof(flash) / sizeof(str_map), str);
+        int32_t value = attr_lookup(flash_table, str);
         if (value != NOT_FOUND) {
             mParameters.set(CameraParameters::KEY_FLASH_MODE, str);
             bool ret = native_set_parm(CAMERA_SET_PARM_LED_MODE,
@@ -6139,8 +6682,7 @@ status_t QualcommCameraHardware::setAntibanding(const CameraParameters& params)
     return NO_ERROR;
     const char *str = params.get(CameraParameters::KEY_ANTIBANDING);
     if (str != NULL) {
-        int value = (camera_antibanding_type)attr_lookup(
-          antibanding, sizeof(antibanding) / sizeof(str_map), str);
+        int value = (camera_antibanding_type)attr_lookup(antibanding_table, str);
         if (value != NOT_FOUND) {
             camera_antibanding_type temp = (camera_antibanding_type) value;
             mParameters.set(CameraParameters::KEY_ANTIBANDING, str);
@@ -6175,8 +6717,7 @@ status_t QualcommCameraHardware::setLensshadeValue(const CameraParameters& param
     }
     const char *str = params.get(CameraParameters::KEY_LENSSHADE);
     if (str != NULL) {
-        int value = attr_lookup(lensshade,
-                                    sizeof(lensshade) / sizeof(str_map), str);
+        int value = attr_lookup(lensshade_table, str);
         if (value != NOT_FOUND) {
             int8_t temp = (int8_t)value;
             mParameters.set(CameraParameters::KEY_LENSSHADE, str);
@@ -6194,8 +6735,7 @@ status_t QualcommCameraHardware::setContinuousAf(const CameraParameters& params)
     if(sensorType->hasAutoFocusSupport){
         const char *str = params.get(CameraParameters::KEY_CONTINUOUS_AF);
         if (str != NULL) {
-            int value = attr_lookup(continuous_af,
-                    sizeof(continuous_af) / sizeof(str_map), str);
+            int value = attr_lookup(continuous_af_table, str);
             if (value != NOT_FOUND) {
                 int8_t temp = (int8_t)value;
                 mParameters.set(CameraParameters::KEY_CONTINUOUS_AF, str);
@@ -6215,7 +6755,7 @@ status_t QualcommCameraHardware::setSelectableZoneAf(const CameraParameters& par
     if(mHasAutoFocusSupport && supportsSelectableZoneAf()) {
         const char *str = params.get(CameraParameters::KEY_SELECTABLE_ZONE_AF);
         if (str != NULL) {
-            int32_t value = attr_lookup(selectable_zone_af, sizeof(selectable_zone_af) / sizeof(str_map), str);
+            int32_t value = attr_lookup(selectable_zone_af_table, str);
             if (value != NOT_FOUND) {
                 mParameters.set(CameraParameters::KEY_SELECTABLE_ZONE_AF, str);
                 bool ret = native_set_parm(CAMERA_SET_PARM_FOCUS_RECT, sizeof(value),
@@ -6244,8 +6784,7 @@ status_t QualcommCameraHardware::setTouchAfAec(const CameraParameters& params)
         const char *str = params.get(CameraParameters::KEY_TOUCH_AF_AEC);
 
         if (str != NULL) {
-            int value = attr_lookup(touchafaec,
-                    sizeof(touchafaec) / sizeof(str_map), str);
+            int value = attr_lookup(touchafaec_table, str);
             if (value != NOT_FOUND) {
 
                 //Dx,Dy will be same as defined in res/layout/camera.xml
@@ -6299,8 +6838,16 @@ status_t QualcommCameraHardware::setTouchAfAec(const CameraParameters& params)
                     //Set Touch AF params
                     af_roi_value.num_roi = 0;
                 }
-                native_set_parm(CAMERA_SET_PARM_AEC_ROI, sizeof(cam_set_aec_roi_t), (void *)&aec_roi_value);
-                native_set_parm(CAMERA_SET_PARM_AF_ROI, sizeof(roi_info_t), (void*)&af_roi_value);
+                // Hand the region to the AF worker so it lands before
+                // the next start; repeated touches only apply the last.
+                mAutoFocusThreadLock.lock();
+                mAfAecRoi = aec_roi_value;
+                mAfRoi = af_roi_value;
+                mAutoFocusThreadLock.unlock();
+                if (!postAutoFocusCommand(AF_CMD_ROI)) {
+                    native_set_parm(CAMERA_SET_PARM_AEC_ROI, sizeof(cam_set_aec_roi_t), (void *)&aec_roi_value);
+                    native_set_parm(CAMERA_SET_PARM_AF_ROI, sizeof(roi_info_t), (void*)&af_roi_value);
+                }
             }
             return NO_ERROR;
         }
@@ -6317,8 +6864,7 @@ status_t QualcommCameraHardware::setFaceDetection(const char *str)
         return NO_ERROR;
     }
     if (str != NULL) {
-        int value = attr_lookup(facedetection,
-                                    sizeof(facedetection) / sizeof(str_map), str);
+        int value = attr_lookup(facedetection_table, str);
         if (value != NOT_FOUND) {
             mMetaDataWaitLock.lock();
             mFaceDetectOn = value;
@@ -6341,8 +6887,7 @@ status_t  QualcommCameraHardware::setISOValue(const CameraParameters& params) {
     }
     const char *str = params.get(CameraParameters::KEY_ISO_MODE);
     if (str != NULL) {
-        int value = (camera_iso_mode_type)attr_lookup(
-          iso, sizeof(iso) / sizeof(str_map), str);
+        int value = (camera_iso_mode_type)attr_lookup(iso_table, str);
         if (value != NOT_FOUND) {
             camera_iso_mode_type temp = (camera_iso_mode_type) value;
             if (value == CAMERA_ISO_DEBLUR) {
@@ -6380,7 +6925,7 @@ status_t QualcommCameraHardware::setSceneDetect(const CameraParameters& params)
         }
         const char *str = params.get(CameraParameters::KEY_SCENE_DETECT);
         if (str != NULL) {
-            int32_t value = attr_lookup(scenedetect, sizeof(scenedetect) / sizeof(str_map), str);
+            int32_t value = attr_lookup(scenedetect_table, str);
             if (value != NOT_FOUND) {
                 mParameters.set(CameraParameters::KEY_SCENE_DETECT, str);
 
@@ -6418,7 +6963,7 @@ status_t QualcommCameraHardware::setSceneMode(const CameraParameters& params)
     }
     const char *str = params.get(CameraParameters::KEY_SCENE_MODE);
     if (str != NULL) {
-        int32_t value = attr_lookup(scenemode, sizeof(scenemode) / sizeof(str_map), str);
+        int32_t value = attr_lookup(scenemode_table, str);
         if (value != NOT_FOUND) {
             mParameters.set(CameraParameters::KEY_SCENE_MODE, str);
             bool ret = native_set_parm(CAMERA_SET_PARM_BESTSHOT_MODE, sizeof(value),
@@ -6568,8 +7113,7 @@ status_t QualcommCameraHardware::setFocusMode(const CameraParameters& params)
     LOGV("%s E", __FUNCTION__);
     const char *str = params.get(CameraParameters::KEY_FOCUS_MODE);
     if (str != NULL) {
-        int32_t value = attr_lookup(focus_modes,
-                                    sizeof(focus_modes) / sizeof(str_map), str);
+        int32_t value = attr_lookup(focus_modes_table, str);
         if (value != NOT_FOUND) {
             mParameters.set(CameraParameters::KEY_FOCUS_MODE, str);
             if (mHasAutoFocusSupport) {
@@ -6613,8 +7157,7 @@ status_t QualcommCameraHardware::setPictureFormat(const CameraParameters& params
     const char * str = params.get(CameraParameters::KEY_PICTURE_FORMAT);
 
     if(str != NULL){
-        int32_t value = attr_lookup(picture_formats,
-                                    sizeof(picture_formats) / sizeof(str_map), str);
+        int32_t value = attr_lookup(picture_formats_table, str);
         if(value != NOT_FOUND){
             mParameters.set(CameraParameters::KEY_PICTURE_FORMAT, str);
         } else {
@@ -6723,17 +7266,10 @@ QualcommCameraHardware::AshmemPool::AshmemPool(int buffer_size, int num_buffers,
     completeInitialization();
 }
 
-static bool register_buf(int camfd,
-                         int size,
-                         int frame_size,
-                         int cbcr_offset,
-                         int yoffset,
-                         int pmempreviewfd,
-                         uint32_t offset,
-                         uint8_t *buf,
-                         int pmem_type,
-                         bool vfe_can_write,
-                         bool register_buffer = true);
+static int register_bufs(int camfd,
+                         const struct msm_pmem_info *bufs,
+                         int count,
+                         bool register_buffer);
 
 QualcommCameraHardware::PmemPool::PmemPool(const char *pmem_pool,
                                            int flags,
@@ -6749,7 +7285,12 @@ QualcommCameraHardware::PmemPool::PmemPool(const char *pmem_pool,
     mPmemType(pmem_type),
     mCbCrOffset(cbcr_offset),
     myOffset(yOffset),
-    mCameraControlFd(dup(camera_control_fd))
+    mCameraControlFd(dup(camera_control_fd)),
+    mRegion(pmem_pool),
+    mFlags(flags),
+    mRegistered(false),
+    mPmemInfo(NULL),
+    mPmemInfoCount(0)
 {
     LOGI("constructing MemPool %s backed by pmem pool %s: "
          "%d frames @ %d bytes, buffer size %d",
@@ -6797,46 +7338,8 @@ QualcommCameraHardware::PmemPool::PmemPool(const char *pmem_pool,
              mFd,
              mSize.len);
         LOGD("mBufferSize=%d, mAlignedBufferSize=%d\n", mBufferSize, mAlignedBufferSize);
-        // Unregister preview buffers with the camera drivers.  Allow the VFE to write
-        // to all preview buffers except for the last one.
-        // Only Register the preview, snapshot and thumbnail buffers with the kernel.
-        if( (strcmp("postview", mName) != 0) ){
-            int num_buf = num_buffers;
-            if(!strcmp("preview", mName)) num_buf = kPreviewBufferCount;
-            LOGD("num_buffers = %d", num_buf);
-            for (int cnt = 0; cnt < num_buf; ++cnt) {
-                int active = 1;
-                if(pmem_type == MSM_PMEM_VIDEO){
-                     active = (cnt<ACTIVE_VIDEO_BUFFERS);
-                     //When VPE is enabled, set the last record
-                     //buffer as active and pmem type as PMEM_VIDEO_VPE
-                     //as this is a requirement from VPE operation.
-                     //No need to set this pmem type to VIDEO_VPE while unregistering,
-                     //because as per camera stack design: "the VPE AXI is also configured
-                     //when VFE is configured for VIDEO, which is as part of preview
-                     //initialization/start. So during this VPE AXI config camera stack
-                     //will lookup the PMEM_VIDEO_VPE buffer and give it as o/p of VPE and
-                     //change it's type to PMEM_VIDEO".
-                     if( (mVpeEnabled) && (cnt == kRecordBufferCount-1)) {
-                         active = 1;
-                         pmem_type = MSM_PMEM_VIDEO_VPE;
-                     }
-                     LOGV(" pmempool creating video buffers : active %d ", active);
-                }
-                else if (pmem_type == MSM_PMEM_PREVIEW){
-                     active = (cnt < (num_buf-1));
-                }
-                register_buf(mCameraControlFd,
-                         mBufferSize,
-                         mFrameSize, mCbCrOffset, myOffset,
-                         mHeap->getHeapID(),
-                         mAlignedBufferSize * cnt,
-                         (uint8_t *)mHeap->base() + mAlignedBufferSize * cnt,
-                         pmem_type,
-                         active);
-            }
-        }
-
+        buildPmemInfo();
+        registerBuffers(true);
         completeInitialization();
     }
     else LOGE("pmem pool %s error: could not create master heap!",
@@ -6847,28 +7350,9 @@ QualcommCameraHardware::PmemPool::PmemPool(const char *pmem_pool,
 QualcommCameraHardware::PmemPool::~PmemPool()
 {
     LOGI("%s: %s E", __FUNCTION__, mName);
-    if (mHeap != NULL) {
-        // Unregister preview buffers with the camera drivers.
-        //  Only Unregister the preview, snapshot and thumbnail
-        //  buffers with the kernel.
-        if( (strcmp("postview", mName) != 0) ){
-            int num_buffers = mNumBuffers;
-            if(!strcmp("preview", mName)) num_buffers = kPreviewBufferCount;
-            for (int cnt = 0; cnt < num_buffers; ++cnt) {
-                register_buf(mCameraControlFd,
-                         mBufferSize,
-                         mFrameSize,
-                         mCbCrOffset,
-                         myOffset,
-                         mHeap->getHeapID(),
-                         mAlignedBufferSize * cnt,
-                         (uint8_t *)mHeap->base() + mAlignedBufferSize * cnt,
-                         mPmemType,
-                         false,
-                         false /* unregister */);
-            }
-        }
-    }
+    if (mHeap != NULL && mRegistered)
+        registerBuffers(false);
+    delete [] mPmemInfo;
     LOGV("destroying PmemPool %s: closing control fd %d",
          mName,
          mCameraControlFd);
@@ -6877,6 +7361,78 @@ QualcommCameraHardware::PmemPool::~PmemPool()
     LOGI("%s: %s X", __FUNCTION__, mName);
 }
 
+// Fill in the driver descriptors for the buffers this pool hands to the
+// kernel once, so (un)registering is a tight run of ioctls. Only the
+// preview, snapshot and thumbnail buffers are registered with the kernel;
+// postview buffers never are.
+void QualcommCameraHardware::PmemPool::buildPmemInfo()
+{
+    if (!strcmp("postview", mName))
+        return;
+
+    mPmemInfoCount = mNumBuffers;
+    if(!strcmp("preview", mName)) mPmemInfoCount = kPreviewBufferCount;
+    mPmemInfo = new struct msm_pmem_info[mPmemInfoCount];
+    for (int cnt = 0; cnt < mPmemInfoCount; ++cnt) {
+        struct msm_pmem_info *info = &mPmemInfo[cnt];
+        info->type     = mPmemType;
+        info->fd       = mHeap->getHeapID();
+        info->offset   = mAlignedBufferSize * cnt;
+        info->len      = mBufferSize;
+        info->vaddr    = (uint8_t *)mHeap->base() + mAlignedBufferSize * cnt;
+        info->y_off    = myOffset;
+        info->cbcr_off = mCbCrOffset;
+        info->active   = 0;
+    }
+}
+
+// Register (or unregister) the pool's buffers with the camera driver.
+// Allow the VFE to write to all preview buffers except for the last one.
+void QualcommCameraHardware::PmemPool::registerBuffers(bool reg)
+{
+    if (reg == mRegistered)
+        return;
+    mRegistered = reg;
+    if (!mPmemInfoCount)
+        return;
+
+    for (int cnt = 0; cnt < mPmemInfoCount; ++cnt) {
+        struct msm_pmem_info *info = &mPmemInfo[cnt];
+        info->type = mPmemType;
+        if (!reg) {
+            info->active = 0;
+        }
+        else if(mPmemType == MSM_PMEM_VIDEO){
+             info->active = (cnt<ACTIVE_VIDEO_BUFFERS);
+             //When VPE is enabled, set the last record
+             //buffer as active and pmem type as PMEM_VIDEO_VPE
+             //as this is a requirement from VPE operation.
+             //No need to set this pmem type to VIDEO_VPE while unregistering,
+             //because as per camera stack design: "the VPE AXI is also configured
+             //when VFE is configured for VIDEO, which is as part of preview
+             //initialization/start. So during this VPE AXI config camera stack
+             //will lookup the PMEM_VIDEO_VPE buffer and give it as o/p of VPE and
+             //change it's type to PMEM_VIDEO".
+             if( (mVpeEnabled) && (cnt == kRecordBufferCount-1)) {
+                 info->active = 1;
+                 info->type = MSM_PMEM_VIDEO_VPE;
+             }
+        }
+        else if (mPmemType == MSM_PMEM_PREVIEW){
+             info->active = (cnt < (mPmemInfoCount-1));
+        }
+        else {
+             info->active = 1;
+        }
+    }
+
+    nsecs_t start = systemTime();
+    int done = register_bufs(mCameraControlFd, mPmemInfo, mPmemInfoCount, reg);
+    LOGI("%s: %s %d/%d %s buffers in %lld us", __FUNCTION__,
+         reg ? "registered" : "unregistered", done, mPmemInfoCount, mName,
+         (systemTime() - start) / 1000);
+}
+
 QualcommCameraHardware::MemPool::~MemPool()
 {
     LOGV("destroying MemPool %s", mName);
@@ -6886,44 +7442,29 @@ QualcommCameraHardware::MemPool::~MemPool()
     LOGV("destroying MemPool %s completed", mName);
 }
 
-static bool register_buf(int camfd,
-                         int size,
-                         int frame_size,
-                         int cbcr_offset,
-                         int yoffset,
-                         int pmempreviewfd,
-                         uint32_t offset,
-                         uint8_t *buf,
-                         int pmem_type,
-                         bool vfe_can_write,
+// The msm camera driver takes one buffer per REGISTER_PMEM ioctl; submit
+// the whole set back to back. Returns how many were accepted.
+static int register_bufs(int camfd,
+                         const struct msm_pmem_info *bufs,
+                         int count,
                          bool register_buffer)
 {
-    struct msm_pmem_info pmemBuf;
-    CAMERA_HAL_UNUSED(frame_size);
-
-    pmemBuf.type     = pmem_type;
-    pmemBuf.fd       = pmempreviewfd;
-    pmemBuf.offset   = offset;
-    pmemBuf.len      = size;
-    pmemBuf.vaddr    = buf;
-    pmemBuf.y_off    = yoffset;
-    pmemBuf.cbcr_off = cbcr_offset;
-
-    pmemBuf.active   = vfe_can_write;
-
-    LOGV("register_buf: camfd = %d, reg = %d buffer = %p",
-         camfd, !register_buffer, buf);
-    if (ioctl(camfd,
-              register_buffer ?
-              MSM_CAM_IOCTL_REGISTER_PMEM :
-              MSM_CAM_IOCTL_UNREGISTER_PMEM,
-              &pmemBuf) < 0) {
-        LOGE("register_buf: MSM_CAM_IOCTL_(UN)REGISTER_PMEM fd %d error %s",
-             camfd,
-             strerror(errno));
-        return false;
+    int done = 0;
+
+    for (int cnt = 0; cnt < count; ++cnt) {
+        if (ioctl(camfd,
+                  register_buffer ?
+                  MSM_CAM_IOCTL_REGISTER_PMEM :
+                  MSM_CAM_IOCTL_UNREGISTER_PMEM,
+                  &bufs[cnt]) < 0) {
+            LOGE("register_bufs: MSM_CAM_IOCTL_(UN)REGISTER_PMEM fd %d buffer %p error %s",
+                 camfd, bufs[cnt].vaddr,
+                 strerror(errno));
+            continue;
+        }
+        done++;
     }
-    return true;
+    return done;
 }
 
 status_t QualcommCameraHardware::MemPool::dump(int fd, const Vector<String16>& args) const
@@ -7361,7 +7902,6 @@ extern "C" sp<CameraHardwareInterface> HAL_openCameraHardware(int cameraId)
     for(i = 0; i < HAL_numOfCameras; i++) {
         if(i == cameraId) {
             LOGI("openCameraHardware:Valid camera ID %d", cameraId);
-            parameter_string_initialized = false;
             HAL_currentCameraId = cameraId;
             return QualcommCameraHardware::createInstance();
         }
@@ -24,6 +24,9 @@
 #include <utils/threads.h>
 #include <stdint.h>
 #include <ui/OverlayHtc.h>
+#include "spsc_ring.h"
+#include "mdp_blit.h"
+#include "frame_interval.h"
 
 extern "C" {
 #include <linux/android_pmem.h>
@@ -154,19 +157,9 @@ typedef enum {
 #define EXIFTAGID_EXIF_DATE_TIME_CREATED  0x3b9004
 #define EXIFTAGID_FOCAL_LENGTH            0x45920a
 
-typedef enum {
-    AUTO,
-    SPOT,
-    CENTER_WEIGHTED,
-    AVERAGE
-} select_zone_af_t;
-
 // End of closed stuff
 
-struct str_map {
-    const char *const desc;
-    int val;
-};
+#include "camera_attr_tables.h"
 
 typedef enum {
     TARGET_MSM7625,
@@ -255,6 +248,13 @@ public:
     void receive_camframe_error_timeout(camera_error_type err);
     static void getCameraInfo();
 
+    // "histogram-delivery" values
+    enum {
+        STATS_DELIVER_FULL,         // every requested histogram, 256 bins
+        STATS_DELIVER_CHANGED,      // skip histograms equal to the last one
+        STATS_DELIVER_DOWNSAMPLED,  // 64 bins, sums of 4
+    };
+
 private:
     QualcommCameraHardware();
     virtual ~QualcommCameraHardware();
@@ -267,12 +267,19 @@ private:
     void stopPreviewInternal();
     friend void *auto_focus_thread(void *user);
     void runAutoFocus();
+    bool startAutoFocusThread();
+    void stopAutoFocusThread();
+    bool postAutoFocusCommand(int cmd);
+    void doAutoFocus(int afMode);
     status_t cancelAutoFocusInternal();
     bool native_set_dimension (int camfd);
     bool native_jpeg_encode (void);
     bool native_set_parm(cam_ctrl_type type, uint16_t length, void *value);
     bool native_set_parm(cam_ctrl_type type, uint16_t length, void *value, int *result);
     bool native_zoom_image(int fd, int srcOffset, int dstOffset, common_crop_t *crop);
+    // Zoom and crop blits for preview, postview and snapshot; mBlit
+    // itself is the last member.
+    Mutex mBlitLock;
 
     static wp<QualcommCameraHardware> singleton;
 
@@ -283,6 +290,9 @@ private:
     static const int kPreviewBufferCount = NUM_PREVIEW_BUFFERS;
     static const int kRawBufferCount = 1;
     static const int kJpegBufferCount = 1;
+    // a burst encodes each shot into the next of these, round robin, so
+    // the client can still read a shot while the following ones encode
+    static const int kJpegBurstBufferCount = 3;
 
     int jpegPadding;
 
@@ -346,11 +356,18 @@ private:
                  int frame_size, int cbcr_offset,
                  int yoffset, const char *name);
         virtual ~PmemPool();
+        void buildPmemInfo();
+        void registerBuffers(bool reg);
         int mFd;
         int mPmemType;
         int mCbCrOffset;
         int myOffset;
         int mCameraControlFd;
+        const char *mRegion;
+        int mFlags;
+        bool mRegistered;
+        struct msm_pmem_info *mPmemInfo;
+        int mPmemInfoCount;
         uint32_t mAlignedSize;
         struct pmem_region mSize;
         sp<QualcommCameraHardware::MMCameraDL> mMMCameraDLRef;
@@ -367,6 +384,18 @@ private:
     sp<PmemPool> mRawSnapShotPmemHeap;
     sp<PmemPool> mPostViewHeap;
 
+    // Released preview and record pools kept for reuse across mode
+    // switches, at most one of each.
+    enum { kHeapCacheSize = 2 };
+    Mutex mHeapCacheLock;
+    Vector< sp<PmemPool> > mHeapCache;
+    sp<PmemPool> getPmemPool(const char *pmem_pool, int flags,
+                             int camera_control_fd, int pmem_type,
+                             int buffer_size, int num_buffers,
+                             int frame_size, int cbcr_offset,
+                             int yoffset, const char *name);
+    void putPmemPool(sp<PmemPool> &pool);
+    bool flushHeapCache();
 
     sp<MMCameraDL> mMMCameraDLRef;
 
@@ -386,6 +415,25 @@ private:
     friend void *frame_thread(void *user);
     void runFrameThread(void *data);
 
+    // Preview display thread, fed by receivePreviewFrame through
+    // mDisplayRing with preview buffer indices.
+    struct display_frame {
+        common_crop_t crop;
+        nsecs_t ts;
+    };
+    struct spsc_ring mDisplayRing;
+    struct display_frame mDisplayFrames[kPreviewBufferCount];
+    uint32_t mDisplayDropped;
+    bool mDisplayThreadExit;
+    bool mDisplayThreadRunning;
+    Mutex mDisplayThreadWaitLock;
+    Condition mDisplayThreadWait;
+    friend void *display_thread(void *user);
+    void runDisplayThread(void *data);
+    bool startDisplayThread();
+    void stopDisplayThread();
+    void displayPreviewFrame(ssize_t offset, common_crop_t *crop, nsecs_t timeStamp);
+
     //720p recording video thread
     bool mVideoThreadExit;
     bool mVideoThreadRunning;
@@ -395,9 +443,16 @@ private:
     void runVideoThread(void *data);
 
     // For Histogram
+    // mStatHeap is allocated on the first histogram-on and kept until
+    // release(). Its three slots rotate: the stats thread fills the slot
+    // after mCurrent outside mStatsWaitLock, then makes it mCurrent under
+    // the lock and hands it to the client, which may still be reading the
+    // two older ones.
     int mStatsOn;
     int mCurrent;
     bool mSendData;
+    int mStatDelivery;
+    sp<MemoryBase> mStatSmallBuffers[3];
     Mutex mStatsWaitLock;
     Condition mStatsWait;
 
@@ -425,10 +480,19 @@ private:
     Mutex mEncodePendingWaitLock;
     Condition mEncodePendingWait;
 
+    // Always-on frame cadence, see frame_interval.h; with
+    // persist.debug.sf.showfps set it is also logged.
+    frame_interval_t mPreviewIntervals;
+    frame_interval_t mVideoIntervals;
     void debugShowPreviewFPS() const;
     void debugShowVideoFPS() const;
 
     int mSnapshotFormat;
+    int mNumCapture;        // num-snaps-per-shutter
+    int mSnapshotCount;     // shots in the current takePicture
+    int mSnapshotIndex;     // shot being received, indexes mRawHeap
+    int mJpegSlot;          // mJpegHeap buffer the shot is encoded into
+    uint8_t *snapshotBuffer();
     bool mFirstFrame;
     void hasAutoFocusSupport();
     void filterPictureSizes();
@@ -449,6 +513,7 @@ private:
     status_t setRecordSize(const CameraParameters& params);
     status_t setPictureSize(const CameraParameters& params);
     status_t setJpegQuality(const CameraParameters& params);
+    status_t setNumSnapsPerShutter(const CameraParameters& params);
     status_t setAntibanding(const CameraParameters& params);
     status_t setEffect(const CameraParameters& params);
     status_t setExposureCompensation(const CameraParameters &params);
@@ -473,6 +538,7 @@ private:
     status_t setTouchAfAec(const CameraParameters& params);
     status_t setSceneDetect(const CameraParameters& params);
     status_t setStrTextures(const CameraParameters& params);
+    status_t setHistogramDelivery(const CameraParameters& params);
     status_t setPreviewFormat(const CameraParameters& params);
     status_t setSelectableZoneAf(const CameraParameters& params);
     void setGpsParameters();
@@ -517,9 +583,27 @@ private:
     Mutex mAutoFocusThreadLock;
     int mAutoFocusFd;
 
+    // Autofocus worker, started on the first autoFocus(). It keeps
+    // mAutoFocusFd open and serves the AF_CMD_* bits posted to it; a bit
+    // that is already pending absorbs later posts of the same command.
+    // A start while a stopped worker still has its exit pending takes
+    // that worker back instead of opening a second fd.
+    enum {
+        AF_CMD_START = 1 << 0,  // run AF in mAfMode
+        AF_CMD_ROI   = 1 << 1,  // apply mAfAecRoi / mAfRoi
+        AF_CMD_EXIT  = 1 << 2,
+    };
+    bool mAfWorkerRunning;
+    int mAfCommands;
+    int mAfMode;
+    cam_set_aec_roi_t mAfAecRoi;
+    roi_info_t mAfRoi;
+    Condition mAutoFocusThreadWait;
+
     Mutex mAfLock;
 
     pthread_t mFrameThread;
+    pthread_t mDisplayThread;
     pthread_t mVideoThread;
     pthread_t mSnapshotThread;
 
@@ -532,7 +616,18 @@ private:
     int mHJR;
     struct msm_frame frames[kPreviewBufferCount];
     struct msm_frame *recordframes;
-    bool *record_buffers_tracking_flag;
+    // Who holds each record buffer, indexed like recordframes[]
+    enum {
+        RECORD_BUFFER_VFE,      // free queue, kernel or camframe
+        RECORD_BUFFER_HAL,      // dequeued by the video thread
+        RECORD_BUFFER_ENCODER,  // given to the encoder, not released yet
+    };
+    uint8_t *record_buffer_owner;
+    uint32_t mRecordBufferBase;     // recordframes[0].buffer
+    uint32_t mRecordBufferStride;   // distance between record buffers
+    uint32_t mRecordBadReleases;    // unknown or already released buffers
+    uint32_t mRecordLeakedBuffers;  // still with the encoder at restart
+    int recordFrameIndex(const sp<IMemory>& mem);
     bool mInPreviewCallback;
     bool mUseOverlay;
     sp<Overlay>  mOverlay;
@@ -561,6 +656,16 @@ private:
     Mutex mPmemWaitLock;
     Condition mPmemWait;
     bool mPrevHeapDeallocRunning;
+
+    // Mode switch latency, logged on the first preview frame.
+    nsecs_t mPreviewStartTime;
+    nsecs_t mTakePictureTime;
+
+    // setParameters() applied every handler at least once.
+    bool mParametersApplied;
+
+    // Must stay last: it ends in mdp_blit_req_list's flexible array.
+    mdp_blit_t mBlit;
 };
 
 }; // namespace android
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_ATTR_TABLE_H
+#define ANDROID_HARDWARE_ATTR_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Read-only name -> value index over a constant { desc, val } map such as
+ * the HAL's str_map tables. Entries are chained by their first character
+ * when the table object is constructed, so a lookup only strcmp()s the
+ * names that can match instead of scanning the whole map: one comparison
+ * for almost every value, and never more than the linear scan would do.
+ * Duplicate names resolve to the first entry, like the linear scan.
+ * Entries past ATTR_TABLE_MAX are not indexed but still found, by a
+ * linear scan of just those after the chain misses.
+ */
+
+#define ATTR_TABLE_MAX 127      /* entries indexed per map */
+
+template <typename T>
+class AttrTable {
+public:
+    AttrTable(const T *map, int len) : mMap(map), mLen(len) {
+        int8_t last[256];
+
+        memset(mFirst, -1, sizeof(mFirst));
+        memset(last, -1, sizeof(last));
+        for (int i = 0; i < len && i < ATTR_TABLE_MAX; i++) {
+            uint8_t c = map[i].desc[0];
+            mNext[i] = -1;
+            if (last[c] < 0)
+                mFirst[c] = i;
+            else
+                mNext[last[c]] = i;
+            last[c] = i;
+        }
+    }
+
+    // Value stored for name, or missing if name is NULL or not in the map.
+    int lookup(const char *name, int missing) const {
+        if (!name || !name[0])
+            return missing;
+        for (int i = mFirst[(uint8_t)name[0]]; i >= 0; i = mNext[i]) {
+            if (!strcmp(mMap[i].desc + 1, name + 1))
+                return mMap[i].val;
+        }
+        for (int i = ATTR_TABLE_MAX; i < mLen; i++) {
+            if (!strcmp(mMap[i].desc, name))
+                return mMap[i].val;
+        }
+        return missing;
+    }
+
+    const T *map() const { return mMap; }
+    int size() const { return mLen; }
+
+private:
+    const T *mMap;
+    int mLen;
+    int8_t mFirst[256];             /* first entry per leading character */
+    int8_t mNext[ATTR_TABLE_MAX];   /* next entry with the same one */
+};
+
+#endif // ANDROID_HARDWARE_ATTR_TABLE_H
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replay of the attribute lookups setParameters() does for a recorded
+ * parameter set, linear str_map scan against the indexed AttrTable.
+ *
+ *   attr_table_bench [iterations [params]]
+ *
+ * params is a flattened "key=value;key=value" string as returned by
+ * getParameters(); the default was captured from a touch-to-focus call.
+ * The tables are the HAL's own, from camera_attr_tables.h. Both lookups
+ * must agree on every key, and a map longer than the index must resolve
+ * every entry. Exits non-zero on a mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "attr_table.h"
+#include "camera_attr_tables.h"
+
+using namespace android;
+
+#define TABLE(map) map, sizeof(map) / sizeof(str_map)
+
+/* Parameter key -> table, one entry per attr_lookup in setParameters(). */
+static const struct {
+    const char *key;
+    const str_map *map;
+    int len;
+} lookups[] = {
+    { "whitebalance",       TABLE(whitebalance) },
+    { "effect",             TABLE(effects) },
+    { "effect",             TABLE(effects) },   /* setSaturation */
+    { "auto-exposure",      TABLE(autoexposure) },
+    { "antibanding",        TABLE(antibanding) },
+    { "scene-mode",         TABLE(scenemode) },
+    { "scene-mode",         TABLE(scenemode) }, /* setContrast */
+    { "scene-mode",         TABLE(scenemode) }, /* bestshot gate */
+    { "flash-mode",         TABLE(flash) },
+    { "iso",                TABLE(iso) },
+    { "focus-mode",         TABLE(focus_modes) },
+    { "lensshade",          TABLE(lensshade) },
+    { "continuous-af",      TABLE(continuous_af) },
+    { "selectable-zone-af", TABLE(selectable_zone_af) },
+    { "selectable-zone-af", TABLE(selectable_zone_af) },
+    { "touch-af-aec",       TABLE(touchafaec) },
+    { "picture-format",     TABLE(picture_formats) },
+    { "picture-format",     TABLE(picture_formats) },
+    { "preview-format",     TABLE(preview_formats) },
+    { "preview-format",     TABLE(preview_formats) },
+};
+
+#define NUM_LOOKUPS (sizeof(lookups) / sizeof(lookups[0]))
+
+static const char *recorded_params =
+    "antibanding=off;auto-exposure=frame-average;continuous-af=caf-off;"
+    "contrast=5;effect=none;exposure-compensation=0;flash-mode=off;"
+    "focus-mode=auto;iso=auto;jpeg-quality=85;lensshade=enable;"
+    "luma-adaptation=3;picture-format=jpeg;picture-size=2592x1944;"
+    "preview-format=yuv420sp;preview-frame-rate=30;preview-size=640x480;"
+    "rotation=0;saturation=5;scene-detect=off;scene-mode=auto;"
+    "selectable-zone-af=auto;sharpness=10;touch-af-aec=touch-on;"
+    "touch-index-aec=320x240;touch-index-af=320x240;whitebalance=auto;zoom=0";
+
+static int linear_lookup(const str_map arr[], int len, const char *name)
+{
+    if (name) {
+        for (int i = 0; i < len; i++) {
+            if (!strcmp(arr[i].desc, name))
+                return arr[i].val;
+        }
+    }
+    return NOT_FOUND;
+}
+
+/* Parsed copy of the flattened parameters, looked up by key like
+ * CameraParameters::get(). */
+#define MAX_PARAMS 64
+static char *param_keys[MAX_PARAMS];
+static char *param_values[MAX_PARAMS];
+static int num_params;
+
+static void unflatten(char *flat)
+{
+    char *save = NULL;
+
+    for (char *kv = strtok_r(flat, ";", &save); kv && num_params < MAX_PARAMS;
+         kv = strtok_r(NULL, ";", &save)) {
+        char *eq = strchr(kv, '=');
+        if (!eq)
+            continue;
+        *eq = '\0';
+        param_keys[num_params] = kv;
+        param_values[num_params] = eq + 1;
+        num_params++;
+    }
+}
+
+static const char *get(const char *key)
+{
+    for (int i = 0; i < num_params; i++)
+        if (!strcmp(param_keys[i], key))
+            return param_values[i];
+    return NULL;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Every entry of a map longer than ATTR_TABLE_MAX must still be found,
+ * including the ones the index leaves to the trailing scan. */
+struct name_value {
+    const char *desc;
+    int val;
+};
+
+static int check_oversized(void)
+{
+    enum { LEN = ATTR_TABLE_MAX + 64 };
+    static char names[LEN][8];
+    static name_value map[LEN];
+    int failures = 0;
+
+    for (int i = 0; i < LEN; i++) {
+        snprintf(names[i], sizeof(names[i]), "v%d", i);
+        map[i].desc = names[i];
+        map[i].val = i;
+    }
+    AttrTable<name_value> table(map, LEN);
+    for (int i = 0; i < LEN; i++) {
+        int val = table.lookup(names[i], NOT_FOUND);
+        if (val != i) {
+            fprintf(stderr, "oversized map: %s gave %d\n", names[i], val);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 200000;
+
+    if (argc >= 2)
+        iterations = atoi(argv[1]);
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations [params]]\n", argv[0]);
+        return 2;
+    }
+    char *flat = strdup(argc >= 3 ? argv[2] : recorded_params);
+    unflatten(flat);
+
+    const AttrTable<str_map> *tables[NUM_LOOKUPS];
+    const char *values[NUM_LOOKUPS];
+    for (size_t i = 0; i < NUM_LOOKUPS; i++) {
+        tables[i] = new AttrTable<str_map>(lookups[i].map, lookups[i].len);
+        values[i] = get(lookups[i].key);
+    }
+
+    int failures = check_oversized();
+    for (size_t i = 0; i < NUM_LOOKUPS; i++) {
+        int a = linear_lookup(lookups[i].map, lookups[i].len, values[i]);
+        int b = tables[i]->lookup(values[i], NOT_FOUND);
+        if (a != b) {
+            fprintf(stderr, "mismatch for %s=%s: linear %d, indexed %d\n",
+                    lookups[i].key, values[i] ? values[i] : "(null)", a, b);
+            failures++;
+        }
+    }
+
+    /* sink keeps the lookups from being optimized away */
+    volatile int sink = 0;
+    double start = now_ms();
+    for (int n = 0; n < iterations; n++)
+        for (size_t i = 0; i < NUM_LOOKUPS; i++)
+            sink += linear_lookup(lookups[i].map, lookups[i].len, values[i]);
+    double linear_ms = now_ms() - start;
+
+    start = now_ms();
+    for (int n = 0; n < iterations; n++)
+        for (size_t i = 0; i < NUM_LOOKUPS; i++)
+            sink += tables[i]->lookup(values[i], NOT_FOUND);
+    double indexed_ms = now_ms() - start;
+
+    printf("# %d parameters, %d lookups per setParameters, %d replays\n",
+           num_params, (int)NUM_LOOKUPS, iterations);
+    printf("%-8s %8s %14s\n", "lookup", "match", "ns/replay");
+    printf("%-8s %8s %14.1f\n", "linear", failures ? "FAIL" : "ok",
+           linear_ms * 1000000.0 / iterations);
+    printf("%-8s %8s %14.1f\n", "indexed", failures ? "FAIL" : "ok",
+           indexed_ms * 1000000.0 / iterations);
+
+    for (size_t i = 0; i < NUM_LOOKUPS; i++)
+        delete tables[i];
+    free(flat);
+    return failures ? 1 : 0;
+}
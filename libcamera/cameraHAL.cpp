@@ -28,10 +28,14 @@
 
 #include <fcntl.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include <cutils/log.h>
 #include "Overlay.h"
@@ -40,6 +44,17 @@
 #include <binder/IMemory.h>
 #include "CameraHardwareInterface.h"
 #include <cutils/properties.h>
+#include <cutils/native_handle.h>
+#include <utils/Timers.h>
+#include "yuv420sp.h"
+#include "frame_interval.h"
+#include "frame_trace.h"
+#include "perf_counters.h"
+
+extern "C" {
+#include "msm_camera.h"
+#include "QCamera_Intf.h"
+}
 
 #define ALOGV LOGV
 #define ALOGE LOGE
@@ -96,6 +111,45 @@ camera_module_t HAL_MODULE_INFO_SYM = {
     get_camera_info: camera_get_camera_info,
 };
 
+/* Preview display accounting, see account_preview_frame() */
+typedef struct preview_stats {
+    uint32_t frames;        /* frames handed to the queue buffer hook */
+    uint32_t displayed;     /* frames queued to the window */
+    uint32_t dropped;       /* frames never queued to the window */
+    uint32_t late;          /* frames that took longer than a frame interval */
+} preview_stats_t;
+
+/* Client memory for the HAL heaps handed out through data callbacks,
+ * one camera_memory_t per heap with a slot per HAL buffer. A pool
+ * replaced while a callback still uses its memory is retired and
+ * released once no callback runs. */
+#define MAX_HEAP_POOLS 3
+#define MAX_RETIRED_POOLS 8
+#define MAX_HELD_SLOTS 32       /* bits in heap_pool_t.held */
+
+typedef struct heap_pool {
+    const IMemoryHeap *heap;    /* identity only, not a reference */
+    void *base;
+    size_t size;                /* payload size of one buffer */
+    size_t stride;              /* distance between buffers in the heap */
+    unsigned int count;
+    bool mapped;                /* mem maps the heap itself, no copy */
+    camera_memory_t *mem;
+    uint32_t last_used;
+    uint32_t held;              /* copy slots the encoder has not released */
+} heap_pool_t;
+
+/* Metadata-in-buffers recording: instead of a copy of the frame the
+ * encoder gets a descriptor of the registered record buffer, and the
+ * frame is held until release_recording_frame() hands it back. */
+#define MAX_RECORD_META_BUFFERS 16
+#define kMetadataBufferTypeCameraSource 0
+
+typedef struct record_metadata {
+    uint32_t type;              /* kMetadataBufferTypeCameraSource */
+    native_handle_t *handle;    /* pmem fd; offset, size, timestamp lo, hi */
+} record_metadata_t;
+
 typedef struct priv_camera_device {
     camera_device_t base;
     /* specific "private" data can go here (base.priv) */
@@ -110,8 +164,48 @@ typedef struct priv_camera_device {
     /* old world*/
     int preview_width;
     int preview_height;
+    /* layout of a frame in the preview heap */
+    int preview_y_stride;
+    int preview_uv_stride;
+    int preview_cbcr_offset;
     sp<Overlay> overlay;
     gralloc_module_t const *gralloc;
+    /* preview pacing: in non-blocking mode frames arriving before
+     * congested_until are dropped so the newest frame wins */
+    bool preview_nonblock;
+    nsecs_t frame_interval;
+    nsecs_t congested_until;
+    preview_stats_t stats;
+    /* frame cadence per stream, see frame_interval.h */
+    frame_interval_t preview_intervals;
+    frame_interval_t video_intervals;
+    /* snapshot phase timing, from take_picture() */
+    nsecs_t take_picture_time;
+    bool shutter_timed;
+    /* callback memory, see wrap_memory_data() */
+    pthread_mutex_t pool_lock;
+    uint32_t pool_clock;
+    heap_pool_t pools[MAX_HEAP_POOLS];
+    int pool_users;             /* callbacks running on pool memory */
+    int num_retired;
+    camera_memory_t *retired[MAX_RETIRED_POOLS];
+    /* metadata-in-buffers recording, see wrap_record_metadata() */
+    bool store_meta_data;
+    camera_memory_t *record_meta;
+    native_handle_t *record_handles[MAX_RECORD_META_BUFFERS];
+    sp<IMemory> record_frames[MAX_RECORD_META_BUFFERS];
+    bool record_busy[MAX_RECORD_META_BUFFERS];  /* encoder holds the slot */
+    bool record_retiring;       /* freed once no slot is busy */
+    /* parameter caches, see camera_get_parameters() and
+     * camera_set_parameters() */
+    char *params_flat;
+    size_t params_flat_len;
+    char *params_last_set;
+    CameraParameters *params_last;
+    bool params_applied;
+    int params_last_rv;
+    time_t exif_time;
+    char exif_datetime[20];
 } priv_camera_device_t;
 
 
@@ -148,6 +242,44 @@ static void dump_msg(const char *tag, int msg_type)
 #endif
 }
 
+/*******************************************************************
+ * preview pacing
+ *******************************************************************/
+
+/* Account for one frame leaving the queue buffer hook. A frame that
+ * needed more than a frame interval is late; in non-blocking mode the
+ * overrun becomes a window in which new frames are dropped instead of
+ * blocking the camera frame thread on a congested display queue. */
+static void account_preview_frame(priv_camera_device_t *dev,
+                                  nsecs_t start, bool displayed)
+{
+    nsecs_t end = systemTime();
+    nsecs_t elapsed = end - start;
+
+    perf_record_since(PERF_PREVIEW_COPY, start, end);
+    if (displayed) {
+        dev->stats.displayed++;
+        perf_count(PERF_PREVIEW_DISPLAYED, 1);
+    } else {
+        dev->stats.dropped++;
+        perf_count(PERF_PREVIEW_DROPPED, 1);
+    }
+
+    if (dev->frame_interval && elapsed > dev->frame_interval) {
+        dev->stats.late++;
+        if (dev->preview_nonblock)
+            dev->congested_until = end + elapsed - dev->frame_interval;
+        ALOGV("%s: late frame, %lld us", __FUNCTION__, elapsed / 1000);
+    }
+}
+
+static void log_preview_stats(priv_camera_device_t *dev)
+{
+    ALOGI("preview: frames %u displayed %u dropped %u late %u",
+         dev->stats.frames, dev->stats.displayed,
+         dev->stats.dropped, dev->stats.late);
+}
+
 /*******************************************************************
  * overlay hook
  *******************************************************************/
@@ -184,6 +316,11 @@ static void wrap_set_crop_hook(void *data,
     window->set_crop(window, x, y, w, h);
 }
 
+/* Preview frames are copied from the prebuilt HAL's heap into window
+ * buffers. This hook only gets offsets into that heap, and the VFE has no
+ * ownership handshake with the window, so window buffers cannot be handed
+ * to the VFE from here: zero-copy preview needs the HAL itself to queue
+ * window buffers to the VFE. */
 //QiSS ME for preview
 static void wrap_queue_buffer_hook(void *data, void* buffer)
 {
@@ -212,34 +349,61 @@ static void wrap_queue_buffer_hook(void *data, void* buffer)
 
     ALOGV("%s: base:%p offset:%i frame:%p", __FUNCTION__,
          heap->base(), offset, frame);
+    frame_trace(FRAME_TRACE_COPY_START, FRAME_TRACE_PREVIEW, offset, 0);
 
     int stride;
     void *vaddr;
     buffer_handle_t *buf_handle;
+    yuv420sp_image_t src, dst;
 
     int width = dev->preview_width;
     int height = dev->preview_height;
+    nsecs_t start = systemTime();
+    bool displayed = false;
+
+    dev->stats.frames++;
+    perf_count(PERF_PREVIEW_RECEIVED, 1);
+    frame_interval_add(&dev->preview_intervals, start);
+    if (dev->preview_nonblock && start < dev->congested_until) {
+        // the display is still behind; drop this frame, a newer one wins
+        ALOGV("%s: display congested, dropping frame", __FUNCTION__);
+        dev->stats.dropped++;
+        perf_count(PERF_PREVIEW_DROPPED, 1);
+        goto skipframe;
+    }
+
     if (0 != window->dequeue_buffer(window, &buf_handle, &stride)) {
         ALOGE("%s: could not dequeue gralloc buffer", __FUNCTION__);
-        goto skipframe;
+        goto account;
     }
     if (0 == dev->gralloc->lock(dev->gralloc, *buf_handle,
                                 GRALLOC_USAGE_SW_WRITE_MASK,
                                 0, 0, width, height, &vaddr)) {
-        // the code below assumes YUV, not RGB
-        memcpy(vaddr, frame, width * height * 3 / 2);
-        ALOGV("%s: copy frame to gralloc buffer", __FUNCTION__);
+        // the code below assumes YUV, not RGB; copy the visible rows
+        // only, skipping the heap's padding and honouring the window stride
+        yuv420sp_init(&src, frame, width, height,
+                      dev->preview_y_stride, dev->preview_cbcr_offset);
+        src.uv_stride = dev->preview_uv_stride;
+        yuv420sp_init(&dst, vaddr, width, height, stride, stride * height);
+        yuv420sp_copy(&dst, &src);
+        ALOGV("%s: copy frame to gralloc buffer, stride %d", __FUNCTION__, stride);
     } else {
         ALOGE("%s: could not lock gralloc buffer", __FUNCTION__);
-        goto skipframe;
+        window->cancel_buffer(window, buf_handle);
+        goto account;
     }
 
     dev->gralloc->unlock(dev->gralloc, *buf_handle);
 
     if (0 != window->enqueue_buffer(window, buf_handle)) {
-        ALOGE("%s: could not dequeue gralloc buffer", __FUNCTION__);
-        goto skipframe;
+        ALOGE("%s: could not enqueue gralloc buffer", __FUNCTION__);
+        goto account;
     }
+    displayed = true;
+
+account:
+    frame_trace(FRAME_TRACE_COPY_END, FRAME_TRACE_PREVIEW, offset, displayed);
+    account_preview_frame(dev, start, displayed);
 
 skipframe:
 
@@ -275,17 +439,168 @@ skipframe:
  * camera interface callback
  *******************************************************************/
 
+/* Drop a pool. Its memory goes at once unless a callback is using it.
+ * Called with pool_lock held. */
+static void retire_heap_pool(priv_camera_device_t *dev, heap_pool_t *pool)
+{
+    if (pool->mem) {
+        if (!dev->pool_users) {
+            pool->mem->release(pool->mem);
+        } else if (dev->num_retired < MAX_RETIRED_POOLS) {
+            dev->retired[dev->num_retired++] = pool->mem;
+        } else {
+            // cannot happen with fewer callback threads than slots
+            ALOGE("%s: no room to retire pool %p, leaking it",
+                  __FUNCTION__, pool->base);
+        }
+    }
+    memset(pool, 0, sizeof(*pool));
+}
+
+static void release_heap_pools(priv_camera_device_t *dev)
+{
+    pthread_mutex_lock(&dev->pool_lock);
+    for (int i = 0; i < MAX_HEAP_POOLS; i++)
+        retire_heap_pool(dev, &dev->pools[i]);
+    pthread_mutex_unlock(&dev->pool_lock);
+}
+
+/* A callback on pool memory returned; release what was retired under it. */
+static void put_heap_pools(priv_camera_device_t *dev)
+{
+    pthread_mutex_lock(&dev->pool_lock);
+    if (--dev->pool_users == 0) {
+        for (int i = 0; i < dev->num_retired; i++)
+            dev->retired[i]->release(dev->retired[i]);
+        dev->num_retired = 0;
+    }
+    pthread_mutex_unlock(&dev->pool_lock);
+}
+
+/* The encoder gave back a copy slot handed out by wrap_memory_data(). */
+static void release_held_slot(priv_camera_device_t *dev, const void *opaque)
+{
+    pthread_mutex_lock(&dev->pool_lock);
+    for (int i = 0; i < MAX_HEAP_POOLS; i++) {
+        heap_pool_t *pool = &dev->pools[i];
+        if (!pool->mem || pool->mapped)
+            continue;
+        const char *data = (const char *)pool->mem->data;
+        size_t delta = (const char *)opaque - data;
+        if ((const char *)opaque >= data && delta < pool->count * pool->size &&
+            delta % pool->size == 0) {
+            pool->held &= ~(1u << (delta / pool->size));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dev->pool_lock);
+}
+
+/* Find or create the pool for the heap behind dataPtr and return the
+ * slot index of its buffer, or -1 if the buffer does not sit on a slot
+ * boundary. Called with pool_lock held. */
+static int get_heap_pool(priv_camera_device_t *dev, const sp<IMemoryHeap>& heap,
+                         ssize_t offset, size_t size, heap_pool_t **out)
+{
+    size_t stride = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+    heap_pool_t *pool = NULL;
+    int i;
+
+    if (!size || offset % stride)
+        return -1;
+
+    for (i = 0; i < MAX_HEAP_POOLS; i++) {
+        heap_pool_t *p = &dev->pools[i];
+        if (p->mem && p->heap == heap.get() && p->base == heap->base() &&
+            p->size == size) {
+            pool = p;
+            break;
+        }
+    }
+
+    if (!pool) {
+        /* reuse the least recently used entry */
+        pool = &dev->pools[0];
+        for (i = 1; i < MAX_HEAP_POOLS; i++)
+            if (dev->pools[i].last_used < pool->last_used)
+                pool = &dev->pools[i];
+        retire_heap_pool(dev, pool);
+
+        unsigned int count = heap->getSize() / stride;
+        if (!count)
+            return -1;
+
+        /* Map the heap itself when buffers are packed back to back, so
+         * slot i is HAL buffer i. pmem only allows one mapping per file,
+         * in which case fall back to a preallocated copy pool. */
+        camera_memory_t *mem = NULL;
+        if (stride == size && heap->getHeapID() >= 0) {
+            mem = dev->request_memory(heap->getHeapID(), size, count, dev->user);
+            if (mem && (!mem->data || mem->data == MAP_FAILED)) {
+                mem->release(mem);
+                mem = NULL;
+            }
+            pool->mapped = mem != NULL;
+        }
+        if (!mem) {
+            if (count > MAX_HELD_SLOTS)
+                count = MAX_HELD_SLOTS;
+            mem = dev->request_memory(-1, size, count, dev->user);
+        }
+        if (!mem || !mem->data || mem->data == MAP_FAILED) {
+            ALOGE("%s: no memory for %u x %u bytes", __FUNCTION__, count, size);
+            if (mem)
+                mem->release(mem);
+            memset(pool, 0, sizeof(*pool));
+            return -1;
+        }
+
+        pool->heap = heap.get();
+        pool->base = heap->base();
+        pool->size = size;
+        pool->stride = stride;
+        pool->count = count;
+        pool->mem = mem;
+        ALOGI("%s: %s pool for heap %p, %u x %u bytes", __FUNCTION__,
+              pool->mapped ? "mapped" : "copy", pool->base, count, size);
+    }
+
+    if ((size_t)offset / pool->stride >= pool->count)
+        return -1;
+
+    pool->last_used = ++dev->pool_clock;
+    *out = pool;
+    return offset / pool->stride;
+}
+
+/* Wrap a HAL buffer for the client. With use_pool, buffers of a known
+ * heap come from that heap's pool without allocating; the caller must
+ * then count itself in pool_users for as long as it uses the memory.
+ * Anything else gets a one-off copy which the caller must release.
+ *
+ * Pool slots are reused when the HAL buffer comes back around, which is
+ * fine for preview frames (CameraService copies them out). A video frame
+ * outlives the HAL buffer, so hold keeps its copy slot until
+ * release_held_slot(); while a slot is held, or the pool maps the HAL
+ * heap itself, the frame gets a one-off copy. Called with pool_lock held. */
 static camera_memory_t *wrap_memory_data(priv_camera_device_t *dev,
-                                         const sp<IMemory>& dataPtr)
+                                         const sp<IMemory>& dataPtr,
+                                         bool use_pool, bool hold,
+                                         unsigned int *index, bool *pooled)
 {
     void *data;
     size_t size;
     ssize_t offset;
     sp<IMemoryHeap> heap;
     camera_memory_t *mem;
+    heap_pool_t *pool;
+    int slot;
 
     ALOGV("%s+++,dev->request_memory %p", __FUNCTION__,dev->request_memory);
 
+    *index = 0;
+    *pooled = false;
+
     if (!dev->request_memory)
         return NULL;
 
@@ -318,7 +633,27 @@ static camera_memory_t *wrap_memory_data(priv_camera_device_t *dev,
     frameCnt++;
 #endif
 
+    slot = use_pool ? get_heap_pool(dev, heap, offset, size, &pool) : -1;
+    if (slot >= 0 && hold && (pool->mapped || (pool->held & (1u << slot))))
+        slot = -1;
+    if (slot >= 0) {
+        if (!pool->mapped)
+            memcpy((char *)pool->mem->data + slot * size, data, size);
+        if (hold)
+            pool->held |= 1u << slot;
+        *index = slot;
+        *pooled = true;
+        ALOGV("%s---", __FUNCTION__);
+        return pool->mem;
+    }
+
     mem = dev->request_memory(-1, size, 1, dev->user);
+    if (!mem || !mem->data || mem->data == MAP_FAILED) {
+        ALOGE("%s: no memory for %u bytes", __FUNCTION__, size);
+        if (mem)
+            mem->release(mem);
+        return NULL;
+    }
 
     ALOGV(" mem:%p,mem->data%p ",  mem,mem->data);
 
@@ -328,6 +663,127 @@ static camera_memory_t *wrap_memory_data(priv_camera_device_t *dev,
     return mem;
 }
 
+/* Called with pool_lock held. */
+static void delete_record_metadata(priv_camera_device_t *dev)
+{
+    for (int i = 0; i < MAX_RECORD_META_BUFFERS; i++) {
+        if (dev->record_handles[i])
+            native_handle_delete(dev->record_handles[i]);
+        dev->record_handles[i] = NULL;
+        dev->record_busy[i] = false;
+    }
+    if (dev->record_meta)
+        dev->record_meta->release(dev->record_meta);
+    dev->record_meta = NULL;
+    dev->record_retiring = false;
+}
+
+/* Called with pool_lock held. */
+static bool record_metadata_busy(priv_camera_device_t *dev)
+{
+    for (int i = 0; i < MAX_RECORD_META_BUFFERS; i++) {
+        if (dev->record_busy[i])
+            return true;
+    }
+    return false;
+}
+
+/* Give the held frames back to the HAL. The descriptors and their native
+ * handles stay until the encoder has released every slot it still holds,
+ * unless force is set because the device is going away. */
+static void free_record_metadata(priv_camera_device_t *dev, bool force)
+{
+    sp<IMemory> held[MAX_RECORD_META_BUFFERS];
+    int i;
+
+    pthread_mutex_lock(&dev->pool_lock);
+    for (i = 0; i < MAX_RECORD_META_BUFFERS; i++) {
+        held[i] = dev->record_frames[i];
+        dev->record_frames[i].clear();
+    }
+    if (force || !record_metadata_busy(dev))
+        delete_record_metadata(dev);
+    else
+        dev->record_retiring = true;
+    pthread_mutex_unlock(&dev->pool_lock);
+
+    /* frames the encoder never returned */
+    for (i = 0; i < MAX_RECORD_META_BUFFERS; i++) {
+        if (held[i] == NULL)
+            continue;
+        perf_count(PERF_RECORD_OUTSTANDING, -1);
+        if (gCameraHals[dev->cameraid] != NULL)
+            gCameraHals[dev->cameraid]->releaseRecordingFrame(held[i]);
+    }
+}
+
+static bool alloc_record_metadata(priv_camera_device_t *dev)
+{
+    bool ret = true;
+
+    if (!dev->request_memory)
+        return false;
+
+    pthread_mutex_lock(&dev->pool_lock);
+    dev->record_retiring = false;
+    if (!dev->record_meta) {
+        dev->record_meta = dev->request_memory(-1, sizeof(record_metadata_t),
+                                               MAX_RECORD_META_BUFFERS, dev->user);
+        if (!dev->record_meta || !dev->record_meta->data ||
+            dev->record_meta->data == MAP_FAILED) {
+            ALOGE("%s: no memory for record metadata", __FUNCTION__);
+            ret = false;
+        }
+        for (int i = 0; ret && i < MAX_RECORD_META_BUFFERS; i++) {
+            dev->record_handles[i] = native_handle_create(1, 4);
+            if (!dev->record_handles[i])
+                ret = false;
+        }
+    }
+    pthread_mutex_unlock(&dev->pool_lock);
+
+    if (!ret)
+        free_record_metadata(dev, true);
+    return ret;
+}
+
+/* Describe the record buffer behind dataPtr in a free metadata slot and
+ * hold on to the frame until the encoder releases it. Returns the slot
+ * or -1 if all slots are in flight. */
+static int wrap_record_metadata(priv_camera_device_t *dev, nsecs_t timestamp,
+                                const sp<IMemory>& dataPtr)
+{
+    ssize_t offset;
+    size_t size;
+    sp<IMemoryHeap> heap = dataPtr->getMemory(&offset, &size);
+    int slot = -1;
+
+    pthread_mutex_lock(&dev->pool_lock);
+    for (int i = 0; dev->record_meta && i < MAX_RECORD_META_BUFFERS; i++) {
+        if (!dev->record_busy[i]) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0) {
+        record_metadata_t *meta = (record_metadata_t *)dev->record_meta->data + slot;
+        native_handle_t *nh = dev->record_handles[slot];
+
+        nh->data[0] = heap->getHeapID();
+        nh->data[1] = offset;
+        nh->data[2] = size;
+        nh->data[3] = (int)(timestamp & 0xffffffff);
+        nh->data[4] = (int)(timestamp >> 32);
+        meta->type = kMetadataBufferTypeCameraSource;
+        meta->handle = nh;
+        dev->record_frames[slot] = dataPtr;
+        dev->record_busy[slot] = true;
+    }
+    pthread_mutex_unlock(&dev->pool_lock);
+
+    return slot;
+}
+
 static void wrap_notify_callback(int32_t msg_type, int32_t ext1,
                                  int32_t ext2, void* user)
 {
@@ -341,6 +797,14 @@ static void wrap_notify_callback(int32_t msg_type, int32_t ext1,
 
     dev = (priv_camera_device_t*) user;
 
+    // the first shutter of a picture; a second one may follow with the postview
+    if (msg_type == CAMERA_MSG_SHUTTER && dev->take_picture_time &&
+        !dev->shutter_timed) {
+        perf_record_since(PERF_SNAPSHOT_SHUTTER, dev->take_picture_time,
+                          systemTime());
+        dev->shutter_timed = true;
+    }
+
     if (dev->notify_callback)
         dev->notify_callback(msg_type, ext1, ext2, dev->user);
 
@@ -353,6 +817,8 @@ static void wrap_data_callback(int32_t msg_type, const sp<IMemory>& dataPtr,
 {
     camera_memory_t *data = NULL;
     priv_camera_device_t* dev = NULL;
+    unsigned int index;
+    bool pooled;
 
     ALOGV("%s+++: type %i user %p", __FUNCTION__, msg_type,user);
     dump_msg(__FUNCTION__, msg_type);
@@ -368,14 +834,41 @@ static void wrap_data_callback(int32_t msg_type, const sp<IMemory>& dataPtr,
         return;
     }
 
-    data = wrap_memory_data(dev, dataPtr);
+    frame_trace(FRAME_TRACE_APP_CALLBACK,
+                msg_type == CAMERA_MSG_COMPRESSED_IMAGE ?
+                FRAME_TRACE_SNAPSHOT : FRAME_TRACE_PREVIEW,
+                dataPtr->offset(), msg_type);
+    if (msg_type == CAMERA_MSG_COMPRESSED_IMAGE) {
+        size_t size = dataPtr->size();
+
+        perf_count(PERF_JPEG_BYTES, size);
+        if (dev->take_picture_time) {
+            nsecs_t elapsed = systemTime() - dev->take_picture_time;
+
+            perf_record(PERF_SNAPSHOT_JPEG, (uint32_t)(elapsed / 1000));
+            if (elapsed > 0)
+                perf_record(PERF_JPEG_RATE,
+                            (uint32_t)((uint64_t)size * 1000000000LL / 1024 / elapsed));
+            dev->take_picture_time = 0;
+        }
+    }
+
+    // compressed and postview images change size from shot to shot and
+    // are not copied out by CameraService, so only preview frames pool
+    pthread_mutex_lock(&dev->pool_lock);
+    data = wrap_memory_data(dev, dataPtr, msg_type == CAMERA_MSG_PREVIEW_FRAME,
+                            false, &index, &pooled);
+    if (pooled)
+        dev->pool_users++;
+    pthread_mutex_unlock(&dev->pool_lock);
 
     if (dev->data_callback)
-        dev->data_callback(msg_type, data, 0, NULL, dev->user);
+        dev->data_callback(msg_type, data, index, NULL, dev->user);
 
-    if ( NULL != data ) {
+    if (pooled)
+        put_heap_pools(dev);
+    else if (data)
         data->release(data);
-    }
 
     ALOGV("%s---", __FUNCTION__);
 }
@@ -386,6 +879,8 @@ static void wrap_data_callback_timestamp(nsecs_t timestamp, int32_t msg_type,
 {
     priv_camera_device_t* dev = NULL;
     camera_memory_t *data = NULL;
+    unsigned int index;
+    bool pooled;
 
     ALOGV("%s+++: type %i user %p ts %u", __FUNCTION__, msg_type, user, timestamp);
     dump_msg(__FUNCTION__, msg_type);
@@ -394,21 +889,87 @@ static void wrap_data_callback_timestamp(nsecs_t timestamp, int32_t msg_type,
         return;
 
     dev = (priv_camera_device_t*) user;
+    frame_trace(FRAME_TRACE_RECORD_CALLBACK, FRAME_TRACE_VIDEO,
+                dataPtr->offset(), msg_type);
+    if (msg_type == CAMERA_MSG_VIDEO_FRAME)
+        frame_interval_add(&dev->video_intervals, timestamp);
+
+    if (dev->store_meta_data && msg_type == CAMERA_MSG_VIDEO_FRAME) {
+        int slot = wrap_record_metadata(dev, timestamp, dataPtr);
+        if (slot >= 0 && dev->data_timestamp_callback) {
+            perf_count(PERF_VIDEO_DELIVERED, 1);
+            perf_count(PERF_RECORD_OUTSTANDING, 1);
+            dev->data_timestamp_callback(timestamp, msg_type, dev->record_meta,
+                                         slot, dev->user);
+        } else {
+            ALOGE("%s: no metadata slot, dropping frame", __FUNCTION__);
+            perf_count(PERF_VIDEO_DROPPED, 1);
+            gCameraHals[dev->cameraid]->releaseRecordingFrame(dataPtr);
+        }
+        ALOGV("%s---", __FUNCTION__);
+        return;
+    }
 
-    data = wrap_memory_data(dev, dataPtr);
+    pthread_mutex_lock(&dev->pool_lock);
+    data = wrap_memory_data(dev, dataPtr, true,
+                            msg_type == CAMERA_MSG_VIDEO_FRAME, &index, &pooled);
+    if (pooled)
+        dev->pool_users++;
+    pthread_mutex_unlock(&dev->pool_lock);
 
-    if (dev->data_timestamp_callback)
-        dev->data_timestamp_callback(timestamp,msg_type, data, 0, dev->user);
+    if (dev->data_timestamp_callback && data) {
+        perf_count(PERF_VIDEO_DELIVERED, 1);
+        dev->data_timestamp_callback(timestamp,msg_type, data, index, dev->user);
+    } else {
+        perf_count(PERF_VIDEO_DROPPED, 1);
+    }
 
+    frame_trace(FRAME_TRACE_RELEASE, FRAME_TRACE_VIDEO, dataPtr->offset(), 0);
     gCameraHals[dev->cameraid]->releaseRecordingFrame(dataPtr);//QiSS ME need release or record will stop
 
-    if ( NULL != data ) {
+    if (pooled)
+        put_heap_pools(dev);
+    else if (data)
         data->release(data);
-    }
 
     ALOGV("%s---", __FUNCTION__);
 }
 
+/* Anything that goes through the HAL may change its parameters (autofocus
+ * results, zoom, recording size...), so the cached get_parameters()
+ * string is dropped and the next set is applied even if identical. */
+static void invalidate_params(priv_camera_device_t *dev)
+{
+    free(dev->params_flat);
+    dev->params_flat = NULL;
+    dev->params_flat_len = 0;
+    dev->params_applied = false;
+}
+
+static void free_params(priv_camera_device_t *dev)
+{
+    invalidate_params(dev);
+    free(dev->params_last_set);
+    dev->params_last_set = NULL;
+    delete dev->params_last;
+    dev->params_last = NULL;
+}
+
+/* EXIF date for the next picture, reformatted only when the second
+ * changes. Returns whether it did. */
+static bool update_exif_datetime(priv_camera_device_t *dev)
+{
+    const time_t date = time(NULL) + 1;
+
+    if (date == dev->exif_time && dev->exif_datetime[0])
+        return false;
+    dev->exif_time = date;
+    if (strftime(dev->exif_datetime, sizeof(dev->exif_datetime),
+                 "%Y-%m-%d %H.%M.%S", localtime(&date)) == 0)
+        dev->exif_datetime[0] = '\0';
+    return true;
+}
+
 /*******************************************************************
  * implementation of priv_camera_device_ops functions
  *******************************************************************/
@@ -508,6 +1069,33 @@ int camera_set_preview_window(struct camera_device * device,
     dev->preview_width = preview_width;
     dev->preview_height = preview_height;
 
+    /* In non-blocking mode the window runs asynchronously: a queued frame
+     * replaces the one waiting for composition and dequeue does not wait
+     * for the display. */
+    char nonblock[PROPERTY_VALUE_MAX];
+    property_get("persist.camera.preview.nonblock", nonblock, "0");
+    dev->preview_nonblock = atoi(nonblock) != 0;
+    if (dev->preview_nonblock && window->set_swap_interval(window, 0)) {
+        ALOGE("%s: could not set swap interval, blocking preview", __FUNCTION__);
+        dev->preview_nonblock = false;
+    }
+    int fps = params.getPreviewFrameRate();
+    dev->frame_interval = fps > 0 ? seconds(1) / fps : 0;
+    dev->congested_until = 0;
+
+    /* must match the preview heap layout set up by initPreview */
+    if (str_preview_format &&
+        !strcmp(str_preview_format, CameraParameters::PIXEL_FORMAT_YUV420SP_ADRENO)) {
+        dev->preview_y_stride = CEILING32(preview_width);
+        dev->preview_uv_stride = 2 * CEILING32(preview_width / 2);
+        dev->preview_cbcr_offset =
+            PAD_TO_4K(CEILING32(preview_width) * CEILING32(preview_height));
+    } else {
+        dev->preview_y_stride = preview_width;
+        dev->preview_uv_stride = preview_width;
+        dev->preview_cbcr_offset = PAD_TO_WORD(preview_width * preview_height);
+    }
+
     if (dev->overlay == NULL) {
         ALOGI("%s: Allocating new overlay", __FUNCTION__);
         dev->overlay =  new Overlay(wrap_set_fd_hook,
@@ -621,9 +1209,15 @@ int camera_start_preview(struct camera_device * device)
         return rv;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
 
     gCameraHals[dev->cameraid]->enableMsgType(CAMERA_MSG_PREVIEW_FRAME);
-    
+
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    dev->congested_until = 0;
+    frame_interval_reset(&dev->preview_intervals,
+                         gCameraHals[dev->cameraid]->getParameters().getPreviewFrameRate());
+
     rv = gCameraHals[dev->cameraid]->startPreview();
 
     ALOGI("%s--- rv %d", __FUNCTION__,rv);
@@ -640,8 +1234,11 @@ void camera_stop_preview(struct camera_device * device)
         return;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
 
     gCameraHals[dev->cameraid]->stopPreview();
+    log_preview_stats(dev);
+    release_heap_pools(dev);
     ALOGI("%s---", __FUNCTION__);
 }
 
@@ -676,11 +1273,33 @@ int camera_store_meta_data_in_buffers(struct camera_device * device, int enable)
 
     dev = (priv_camera_device_t*) device;
 
-    //  TODO: meta data buffer not current supported
-    //rv = gCameraHals[dev->cameraid]->storeMetaDataInBuffers(enable);
+    /* The HAL records into registered pmem buffers, so metadata mode is
+     * handled here by passing descriptors of those buffers. It is off
+     * unless persist.camera.record.metadata is set, as the encoder has to
+     * understand those descriptors. */
+    char metadata[PROPERTY_VALUE_MAX];
+    property_get("persist.camera.record.metadata", metadata, "0");
+    if (enable && !atoi(metadata)) {
+        dev->store_meta_data = false;
+        ALOGI("%s--- rv %d", __FUNCTION__,rv);
+        return rv;
+    }
+
+    if (enable) {
+        if (!alloc_record_metadata(dev)) {
+            // let the recorder fall back to frame copies
+            dev->store_meta_data = false;
+            ALOGI("%s--- rv %d", __FUNCTION__,rv);
+            return rv;
+        }
+    } else if (dev->record_meta) {
+        free_record_metadata(dev, false);
+    }
+    dev->store_meta_data = enable;
+    rv = 0;
+
     ALOGI("%s--- rv %d", __FUNCTION__,rv);
     return rv;
-    //return enable ? android::INVALID_OPERATION: android::OK;
 }
 
 int camera_start_recording(struct camera_device * device)
@@ -694,7 +1313,10 @@ int camera_start_recording(struct camera_device * device)
         return rv;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
 
+    frame_interval_reset(&dev->video_intervals,
+                         gCameraHals[dev->cameraid]->getParameters().getPreviewFrameRate());
     rv = gCameraHals[dev->cameraid]->startRecording();
 
     ALOGI("%s--- rv %d", __FUNCTION__,rv);
@@ -711,8 +1333,15 @@ void camera_stop_recording(struct camera_device * device)
         return;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
 
+    /* give back the frames the encoder still holds first, the HAL must
+     * not stop with record buffers outstanding */
+    if (dev->record_meta)
+        free_record_metadata(dev, false);
+    dev->store_meta_data = false;
     gCameraHals[dev->cameraid]->stopRecording();
+    release_heap_pools(dev);
 
     //QiSS ME force start preview when recording stop
     gCameraHals[dev->cameraid]->startPreview();
@@ -758,6 +1387,39 @@ void camera_release_recording_frame(struct camera_device * device,
      */
     //gCameraHals[dev->cameraid]->releaseRecordingFrame(opaque);
 
+    /* In copy mode the HAL frame was released right after the callback,
+     * only the copy slot is given back. In metadata mode opaque points
+     * at our descriptor, possibly after recording stopped; map it back to
+     * the held frame and give that back to the HAL. */
+    sp<IMemory> frame;
+    bool meta_slot = false;
+    pthread_mutex_lock(&dev->pool_lock);
+    if (dev->record_meta) {
+        record_metadata_t *meta = (record_metadata_t *)dev->record_meta->data;
+        int slot = (const record_metadata_t *)opaque - meta;
+        if (slot >= 0 && slot < MAX_RECORD_META_BUFFERS) {
+            meta_slot = true;
+            frame = dev->record_frames[slot];
+            dev->record_frames[slot].clear();
+            dev->record_busy[slot] = false;
+            if (dev->record_retiring && !record_metadata_busy(dev))
+                delete_record_metadata(dev);
+        }
+    }
+    pthread_mutex_unlock(&dev->pool_lock);
+
+    if (!meta_slot) {
+        release_held_slot(dev, opaque);
+        ALOGV("%s---", __FUNCTION__);
+        return;
+    }
+
+    if (frame != NULL) {
+        perf_count(PERF_RECORD_OUTSTANDING, -1);
+        frame_trace(FRAME_TRACE_RELEASE, FRAME_TRACE_VIDEO, frame->offset(), 0);
+        gCameraHals[dev->cameraid]->releaseRecordingFrame(frame);
+    }
+
     ALOGV("%s---", __FUNCTION__);
 }
 
@@ -772,6 +1434,7 @@ int camera_auto_focus(struct camera_device * device)
         return rv;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
     
     gCameraHals[dev->cameraid]->enableMsgType(CAMERA_MSG_ALL_MSGS );
 
@@ -792,6 +1455,7 @@ int camera_cancel_auto_focus(struct camera_device * device)
         return rv;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
 
     rv = gCameraHals[dev->cameraid]->cancelAutoFocus();
 
@@ -810,10 +1474,14 @@ int camera_take_picture(struct camera_device * device)
         return rv;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
 
     gCameraHals[dev->cameraid]->enableMsgType(CAMERA_MSG_ALL_MSGS
         );
 
+    dev->take_picture_time = systemTime();
+    dev->shutter_timed = false;
+    perf_count(PERF_SNAPSHOTS, 1);
     rv = gCameraHals[dev->cameraid]->takePicture();
 
     ALOGI("%s--- rv %d", __FUNCTION__,rv);
@@ -831,6 +1499,7 @@ int camera_cancel_picture(struct camera_device * device)
         return rv;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
 
     rv = gCameraHals[dev->cameraid]->cancelPicture();
 
@@ -842,34 +1511,50 @@ int camera_set_parameters(struct camera_device * device, const char *params)
 {
     int rv = -EINVAL;
     priv_camera_device_t* dev = NULL;
-    CameraParameters camParams;
 
     ALOGI("%s+++: device %p", __FUNCTION__, device);
 
-    if(!device)
+    if(!device || !params)
         return rv;
 
     dev = (priv_camera_device_t*) device;
 
-    String8 params_str8(params);
-    camParams.unflatten(params_str8);
+    /* Apps resend the same string on every touch and poll; when nothing
+     * went through the HAL since it was applied, and the EXIF date is
+     * still current, there is nothing to do. Otherwise an identical
+     * string at least skips the unflatten. */
+    bool exif_changed = update_exif_datetime(dev);
+    if (dev->params_last_set && !strcmp(params, dev->params_last_set)) {
+        if (dev->params_applied && !exif_changed) {
+            ALOGV("%s--- unchanged, rv %d", __FUNCTION__, dev->params_last_rv);
+            return dev->params_last_rv;
+        }
+    } else {
+        free_params(dev);
+        dev->params_last = new CameraParameters();
+        dev->params_last->unflatten(String8(params));
+        dev->params_last_set = strdup(params);
+    }
+    CameraParameters &camParams = *dev->params_last;
 
 #ifdef DUMP_PARAMS
     camParams.dump();
 #endif
 
     /* Add timestamp */
-    char str[20] = { 0 };
-    const time_t date = time(NULL) + 1;
-    if (strftime(str, sizeof(str), "%Y-%m-%d %H.%M.%S", localtime(&date)) > 0)
-        camParams.set(CameraParameters::KEY_EXIF_DATETIME, str);
+    if (dev->exif_datetime[0])
+        camParams.set(CameraParameters::KEY_EXIF_DATETIME, dev->exif_datetime);
 
     rv = gCameraHals[dev->cameraid]->setParameters(camParams);
 
 #ifdef DUMP_PARAMS
     camParams.dump();
 #endif
-    
+
+    invalidate_params(dev);
+    dev->params_applied = true;
+    dev->params_last_rv = rv;
+
     ALOGI("%s--- rv %d", __FUNCTION__,rv);
     return rv;
 }
@@ -878,8 +1563,6 @@ char* camera_get_parameters(struct camera_device * device)
 {
     char* params = NULL;
     priv_camera_device_t* dev = NULL;
-    String8 params_str8;
-    CameraParameters camParams;
 
     ALOGI("%s+++: device %p", __FUNCTION__, device);
 
@@ -888,34 +1571,41 @@ char* camera_get_parameters(struct camera_device * device)
 
     dev = (priv_camera_device_t*) device;
 
-    camParams = gCameraHals[dev->cameraid]->getParameters();
-    
+    /* Flatten once and hand out copies until invalidate_params(). */
+    if (!dev->params_flat) {
+        CameraParameters camParams = gCameraHals[dev->cameraid]->getParameters();
+
 #ifdef DUMP_PARAMS
-    camParams.dump();
+        camParams.dump();
 #endif
 
-    CameraHAL_FixupParams(camParams);
-    
+        CameraHAL_FixupParams(camParams);
+
 #ifdef HTC_FFC
-    if (dev->cameraid == 1) {
+        if (dev->cameraid == 1) {
 #ifdef REVERSE_FFC
-        /* Change default parameters for the front camera */
-        camParams.set("front-camera-mode", "reverse"); // default is "mirror"
+            /* Change default parameters for the front camera */
+            camParams.set("front-camera-mode", "reverse"); // default is "mirror"
 #endif
-    } else {
-        camParams.set("front-camera-mode", "mirror");
-    }
+        } else {
+            camParams.set("front-camera-mode", "mirror");
+        }
 #endif
-    camParams.set("orientation", "landscape");
+        camParams.set("orientation", "landscape");
+
+        String8 params_str8 = camParams.flatten();
+        dev->params_flat_len = params_str8.length();
+        dev->params_flat = strdup(params_str8.string());
+        if (!dev->params_flat) {
+            dev->params_flat_len = 0;
+            return NULL;
+        }
+    }
 
-    params_str8 = camParams.flatten();
-    params = (char*) malloc(sizeof(char) * (params_str8.length() + 1));
-    strcpy(params, params_str8.string());
+    params = (char*) malloc(sizeof(char) * (dev->params_flat_len + 1));
+    if (params)
+        memcpy(params, dev->params_flat, dev->params_flat_len + 1);
 
-#ifdef DUMP_PARAMS
-    camParams.dump();
-#endif
-    
     ALOGI("%s---", __FUNCTION__);
     return params;
 }
@@ -940,6 +1630,13 @@ int camera_send_command(struct camera_device * device,
         return rv;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
+
+    if (cmd == CAMERA_CMD_RESET_PERF_COUNTERS) {
+        // ours alone; the prebuilt HAL does not know this vendor command
+        perf_counters_reset();
+        return 0;
+    }
 
     rv = gCameraHals[dev->cameraid]->sendCommand(cmd, arg1, arg2);
 
@@ -957,6 +1654,7 @@ void camera_release(struct camera_device * device)
         return;
 
     dev = (priv_camera_device_t*) device;
+    invalidate_params(dev);
 
     gCameraHals[dev->cameraid]->release();
     ALOGI("%s---", __FUNCTION__);
@@ -973,6 +1671,23 @@ int camera_dump(struct camera_device * device, int fd)
 
     dev = (priv_camera_device_t*) device;
 
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "preview: frames %u displayed %u dropped %u late %u (%s)\n",
+             dev->stats.frames, dev->stats.displayed,
+             dev->stats.dropped, dev->stats.late,
+             dev->preview_nonblock ? "non-blocking" : "blocking");
+    write(fd, buffer, strlen(buffer));
+    int len = frame_interval_format(&dev->preview_intervals, "preview intervals",
+                                    buffer, sizeof(buffer));
+    write(fd, buffer, len);
+    len = frame_interval_format(&dev->video_intervals, "video intervals",
+                                buffer, sizeof(buffer));
+    write(fd, buffer, len);
+    perf_counters_dump(fd);
+    frame_trace_dump(fd);
+    rv = 0;
+
     // rv = gCameraHals[dev->cameraid]->dump(fd);
     return rv;
 }
@@ -996,10 +1711,17 @@ int camera_device_close(hw_device_t* device)
     dev = (priv_camera_device_t*) device;
 
     if (dev) {
+        if (dev->record_meta)
+            free_record_metadata(dev, true);
+        free_params(dev);
+
         gCameraHals[dev->cameraid].clear();
         gCameraHals[dev->cameraid] = NULL;
         gCamerasOpen--;
 
+        release_heap_pools(dev);
+        pthread_mutex_destroy(&dev->pool_lock);
+
         if (dev->base.ops) {
             free(dev->base.ops);
         }
@@ -1051,6 +1773,14 @@ int camera_device_open(const hw_module_t* module, const char* name,
 
     ALOGI("camera_device open+++");
 
+    /* per-frame trace points, dumped by dumpsys media.camera:
+     * "1" for a line per frame, "chrome" for chrome://tracing JSON */
+    char trace[PROPERTY_VALUE_MAX];
+    property_get("persist.camera.trace", trace, "0");
+    frame_trace_set_mode(!strcmp(trace, "chrome") ? FRAME_TRACE_CHROME :
+                         !strcmp(trace, "1") ? FRAME_TRACE_TEXT :
+                         FRAME_TRACE_OFF);
+
     if (name != NULL) {
         cameraid = atoi(name);
 
@@ -1141,6 +1871,7 @@ int camera_device_open(const hw_module_t* module, const char* name,
         // -------- specific stuff --------
 
         priv_camera_device->cameraid = cameraid;
+        pthread_mutex_init(&priv_camera_device->pool_lock, NULL);
 
 #ifdef BOARD_USE_FROYO_LIBCAMERA
         camera = openCameraHardware(cameraid);
@@ -0,0 +1,627 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * End-to-end latencies of the camera HAL, measured through the
+ * camera_device_ops_t table the way CameraService drives it.
+ *
+ *   camera_hal_bench [-n runs] [-c camera] [-s shots] [-f frames]
+ *                    [-p key=value;...] [-w]
+ *
+ * Every run opens the camera, previews for frames frames, records until
+ * the first video frame, takes shots pictures back to back and closes
+ * it again. -p is merged into the HAL's parameters after open. Without
+ * -w no preview window is set and frames are timed at the preview
+ * callback; with -w a window backed by gralloc buffers is set instead,
+ * so frames go through the queue buffer hook and are timed as they are
+ * queued to it.
+ *
+ * One JSON object per metric goes to stdout, in milliseconds:
+ *
+ *   {"metric":"open_to_preview","samples":10,"p50":412.3,"p99":530.1}
+ *
+ *   open_to_preview   device open until the first preview frame
+ *   shutter           take_picture until CAMERA_MSG_SHUTTER
+ *   take_to_jpeg      take_picture until CAMERA_MSG_COMPRESSED_IMAGE
+ *   shot_to_shot      take_picture until preview is back for the next
+ *   record_to_video   start_recording until the first video frame
+ *   preview_interval  time between preview frames
+ *   preview_jitter    distance of each interval from its run's median
+ *
+ * To run against the simulator instead of the sensor:
+ *
+ *   LD_PRELOAD=/data/camera_sim/liboemcamera.so camera_hal_bench
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/camera.h>
+#include <hardware/gralloc.h>
+#include <hardware/hardware.h>
+
+#define EVENT_TIMEOUT_MS 10000
+#define MAX_INTERVALS    1024
+#define MAX_WINDOW_BUFFERS 8
+
+/* Samples of one metric, in milliseconds. */
+typedef struct {
+    const char *name;
+    double *v;
+    int n;
+    int cap;
+} metric_t;
+
+static metric_t open_to_preview = { "open_to_preview", NULL, 0, 0 };
+static metric_t shutter = { "shutter", NULL, 0, 0 };
+static metric_t take_to_jpeg = { "take_to_jpeg", NULL, 0, 0 };
+static metric_t shot_to_shot = { "shot_to_shot", NULL, 0, 0 };
+static metric_t record_to_video = { "record_to_video", NULL, 0, 0 };
+static metric_t preview_interval = { "preview_interval", NULL, 0, 0 };
+static metric_t preview_jitter = { "preview_jitter", NULL, 0, 0 };
+
+static metric_t *metrics[] = {
+    &open_to_preview, &shutter, &take_to_jpeg, &shot_to_shot,
+    &record_to_video, &preview_interval, &preview_jitter,
+};
+
+/* Callback events, each the time it last happened and how often. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int64_t preview_ns, shutter_ns, jpeg_ns, video_ns;
+static int preview_count, shutter_count, jpeg_count, video_count;
+static double intervals[MAX_INTERVALS];
+static int interval_count;
+
+static camera_device_t *device;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add_sample(metric_t *m, double ms)
+{
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 64;
+        m->v = (double *)realloc(m->v, m->cap * sizeof(double));
+    }
+    m->v[m->n++] = ms;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of sorted samples. */
+static double percentile(const double *sorted, int n, int p)
+{
+    int rank = (int)ceil(p / 100.0 * n);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void report(const metric_t *m)
+{
+    if (!m->n) {
+        printf("{\"metric\":\"%s\",\"samples\":0}\n", m->name);
+        return;
+    }
+    qsort(m->v, m->n, sizeof(double), compare_double);
+    printf("{\"metric\":\"%s\",\"samples\":%d,\"p50\":%.3f,\"p99\":%.3f}\n",
+           m->name, m->n, percentile(m->v, m->n, 50), percentile(m->v, m->n, 99));
+}
+
+/* Waits until *count exceeds seen; returns the event time, 0 on timeout. */
+static int64_t wait_event(const int *count, int seen, const int64_t *when)
+{
+    struct timespec deadline;
+    int64_t t = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += EVENT_TIMEOUT_MS / 1000;
+
+    pthread_mutex_lock(&lock);
+    while (*count <= seen &&
+           pthread_cond_timedwait(&cond, &lock, &deadline) != ETIMEDOUT)
+        ;
+    if (*count > seen)
+        t = *when;
+    pthread_mutex_unlock(&lock);
+    return t;
+}
+
+static int counter(const int *count)
+{
+    pthread_mutex_lock(&lock);
+    int n = *count;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+/* ---- CameraService side of the callbacks ---- */
+
+typedef struct {
+    camera_memory_t mem;
+    size_t buffer_size;
+    bool mapped;
+} bench_memory_t;
+
+static void release_memory(camera_memory_t *mem)
+{
+    bench_memory_t *m = (bench_memory_t *)mem;
+
+    if (m->mapped)
+        munmap(mem->data, mem->size);
+    else
+        free(mem->data);
+    free(m);
+}
+
+/* NULL if the memory cannot be had, as CameraService does. */
+static camera_memory_t *get_memory(int fd, size_t buf_size, unsigned int num_bufs,
+                                   void *user)
+{
+    bench_memory_t *m = (bench_memory_t *)calloc(1, sizeof(*m));
+    (void)user;
+
+    if (!m)
+        return NULL;
+    m->mem.size = buf_size * num_bufs;
+    m->mem.release = release_memory;
+    m->buffer_size = buf_size;
+    if (fd >= 0) {
+        m->mem.data = mmap(NULL, m->mem.size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+        if (m->mem.data == MAP_FAILED) {
+            fprintf(stderr, "mmap of %zu bytes failed: %s\n", m->mem.size,
+                    strerror(errno));
+            free(m);
+            return NULL;
+        }
+        m->mapped = true;
+    } else {
+        m->mem.data = malloc(m->mem.size);
+        if (!m->mem.data) {
+            free(m);
+            return NULL;
+        }
+    }
+    return &m->mem;
+}
+
+static void preview_event(int64_t t)
+{
+    if (preview_count && interval_count < MAX_INTERVALS)
+        intervals[interval_count++] = (t - preview_ns) / 1e6;
+    preview_ns = t;
+    preview_count++;
+}
+
+static void notify_cb(int32_t msg_type, int32_t ext1, int32_t ext2, void *user)
+{
+    (void)ext1; (void)ext2; (void)user;
+
+    if (msg_type != CAMERA_MSG_SHUTTER)
+        return;
+    pthread_mutex_lock(&lock);
+    shutter_ns = now_ns();
+    shutter_count++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static void data_cb(int32_t msg_type, const camera_memory_t *data,
+                    unsigned int index, camera_frame_metadata_t *metadata,
+                    void *user)
+{
+    int64_t t = now_ns();
+    (void)data; (void)index; (void)metadata; (void)user;
+
+    pthread_mutex_lock(&lock);
+    if (msg_type & CAMERA_MSG_PREVIEW_FRAME)
+        preview_event(t);
+    if (msg_type & CAMERA_MSG_COMPRESSED_IMAGE) {
+        jpeg_ns = t;
+        jpeg_count++;
+    }
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static void data_timestamp_cb(nsecs_t timestamp, int32_t msg_type,
+                              const camera_memory_t *data, unsigned int index,
+                              void *user)
+{
+    const bench_memory_t *m = (const bench_memory_t *)data;
+    (void)timestamp; (void)user;
+
+    if (!(msg_type & CAMERA_MSG_VIDEO_FRAME))
+        return;
+    pthread_mutex_lock(&lock);
+    video_ns = now_ns();
+    video_count++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+
+    /* the encoder is done with it at once */
+    device->ops->release_recording_frame(device,
+            (char *)data->data + index * m->buffer_size);
+}
+
+/* ---- SurfaceFlinger side of the preview window ---- */
+
+/* A window that shows nothing: buffers come from gralloc with the
+ * geometry and usage the HAL asks for, and a queued buffer is free
+ * again at once. */
+typedef struct {
+    preview_stream_ops_t ops;
+    alloc_device_t *alloc;
+    int width, height, format, usage;
+    int count;
+    buffer_handle_t buffers[MAX_WINDOW_BUFFERS];
+    int strides[MAX_WINDOW_BUFFERS];
+    bool dequeued[MAX_WINDOW_BUFFERS];
+} bench_window_t;
+
+static bench_window_t window;
+
+static bench_window_t *to_window(const preview_stream_ops_t *w)
+{
+    return (bench_window_t *)w;
+}
+
+static void window_free_buffers(bench_window_t *win)
+{
+    for (int i = 0; i < MAX_WINDOW_BUFFERS; i++) {
+        if (win->buffers[i])
+            win->alloc->free(win->alloc, win->buffers[i]);
+        win->buffers[i] = NULL;
+        win->dequeued[i] = false;
+    }
+}
+
+static int window_dequeue_buffer(preview_stream_ops_t *w,
+                                 buffer_handle_t **buffer, int *stride)
+{
+    bench_window_t *win = to_window(w);
+
+    for (int i = 0; i < win->count; i++) {
+        if (win->dequeued[i])
+            continue;
+        if (!win->buffers[i] &&
+            win->alloc->alloc(win->alloc, win->width, win->height, win->format,
+                              win->usage, &win->buffers[i], &win->strides[i])) {
+            fprintf(stderr, "gralloc alloc %dx%d failed\n",
+                    win->width, win->height);
+            win->buffers[i] = NULL;
+            return -ENOMEM;
+        }
+        win->dequeued[i] = true;
+        *buffer = &win->buffers[i];
+        *stride = win->strides[i];
+        return 0;
+    }
+    return -EBUSY;
+}
+
+static int window_slot(bench_window_t *win, buffer_handle_t *buffer)
+{
+    int i = buffer - win->buffers;
+    return i >= 0 && i < win->count && win->dequeued[i] ? i : -1;
+}
+
+static int window_enqueue_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+{
+    bench_window_t *win = to_window(w);
+    int i = window_slot(win, buffer);
+
+    if (i < 0)
+        return -EINVAL;
+    win->dequeued[i] = false;
+    pthread_mutex_lock(&lock);
+    preview_event(now_ns());
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+static int window_cancel_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+{
+    bench_window_t *win = to_window(w);
+    int i = window_slot(win, buffer);
+
+    if (i < 0)
+        return -EINVAL;
+    win->dequeued[i] = false;
+    return 0;
+}
+
+static int window_set_buffer_count(preview_stream_ops_t *w, int count)
+{
+    bench_window_t *win = to_window(w);
+
+    if (count <= 0 || count > MAX_WINDOW_BUFFERS)
+        return -EINVAL;
+    window_free_buffers(win);
+    win->count = count;
+    return 0;
+}
+
+static int window_set_buffers_geometry(preview_stream_ops_t *w, int width,
+                                       int height, int format)
+{
+    bench_window_t *win = to_window(w);
+
+    window_free_buffers(win);
+    win->width = width;
+    win->height = height;
+    win->format = format;
+    return 0;
+}
+
+static int window_set_usage(preview_stream_ops_t *w, int usage)
+{
+    bench_window_t *win = to_window(w);
+
+    // the queue buffer hook fills the buffers with the CPU
+    window_free_buffers(win);
+    win->usage = usage | GRALLOC_USAGE_SW_WRITE_OFTEN;
+    return 0;
+}
+
+static int window_set_crop(preview_stream_ops_t *w, int left, int top,
+                           int right, int bottom)
+{
+    (void)w; (void)left; (void)top; (void)right; (void)bottom;
+    return 0;
+}
+
+static int window_set_swap_interval(preview_stream_ops_t *w, int interval)
+{
+    (void)w; (void)interval;
+    return 0;
+}
+
+static int window_get_min_undequeued_buffer_count(const preview_stream_ops_t *w,
+                                                  int *count)
+{
+    (void)w;
+    *count = 1;
+    return 0;
+}
+
+static int window_lock_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+{
+    (void)w; (void)buffer;
+    return 0;
+}
+
+static int window_set_timestamp(preview_stream_ops_t *w, int64_t timestamp)
+{
+    (void)w; (void)timestamp;
+    return 0;
+}
+
+static int window_init(void)
+{
+    const hw_module_t *module;
+
+    if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) ||
+        gralloc_open(module, &window.alloc)) {
+        fprintf(stderr, "no gralloc HAL\n");
+        return -1;
+    }
+    window.ops.dequeue_buffer = window_dequeue_buffer;
+    window.ops.enqueue_buffer = window_enqueue_buffer;
+    window.ops.cancel_buffer = window_cancel_buffer;
+    window.ops.set_buffer_count = window_set_buffer_count;
+    window.ops.set_buffers_geometry = window_set_buffers_geometry;
+    window.ops.set_crop = window_set_crop;
+    window.ops.set_usage = window_set_usage;
+    window.ops.set_swap_interval = window_set_swap_interval;
+    window.ops.get_min_undequeued_buffer_count =
+        window_get_min_undequeued_buffer_count;
+    window.ops.lock_buffer = window_lock_buffer;
+    window.ops.set_timestamp = window_set_timestamp;
+    window.count = 0;
+    return 0;
+}
+
+/* ---- one open/preview/record/snapshot/close cycle ---- */
+
+static void merge_parameters(const char *extra)
+{
+    char *current = device->ops->get_parameters(device);
+    size_t len = strlen(current) + strlen(extra) + 2;
+    char *merged = (char *)malloc(len);
+
+    /* unflatten() keeps the last value of a repeated key */
+    snprintf(merged, len, "%s;%s", current, extra);
+    if (device->ops->set_parameters(device, merged))
+        fprintf(stderr, "set_parameters(%s) failed\n", extra);
+    free(merged);
+    if (device->ops->put_parameters)
+        device->ops->put_parameters(device, current);
+    else
+        free(current);
+}
+
+static void take_interval_samples(int first)
+{
+    double run[MAX_INTERVALS];
+    int n = 0;
+
+    pthread_mutex_lock(&lock);
+    for (int i = first; i < interval_count; i++)
+        run[n++] = intervals[i];
+    pthread_mutex_unlock(&lock);
+    if (!n)
+        return;
+
+    for (int i = 0; i < n; i++)
+        add_sample(&preview_interval, run[i]);
+    qsort(run, n, sizeof(double), compare_double);
+    double median = percentile(run, n, 50);
+    for (int i = 0; i < n; i++)
+        add_sample(&preview_jitter, fabs(run[i] - median));
+}
+
+static int run_once(camera_module_t *module, const char *id, int shots,
+                    int frames, const char *params, bool use_window)
+{
+    hw_device_t *hw;
+    int64_t t, start;
+    int seen;
+
+    pthread_mutex_lock(&lock);
+    preview_count = 0;      /* no interval across the reopen */
+    interval_count = 0;
+    pthread_mutex_unlock(&lock);
+
+    start = now_ns();
+    if (module->common.methods->open(&module->common, id, &hw)) {
+        fprintf(stderr, "open camera %s failed\n", id);
+        return -1;
+    }
+    device = (camera_device_t *)hw;
+    device->ops->set_callbacks(device, notify_cb, data_cb, data_timestamp_cb,
+                               get_memory, NULL);
+    // with a window, preview is timed at the window, not the callback
+    device->ops->enable_msg_type(device, CAMERA_MSG_SHUTTER |
+                                 CAMERA_MSG_COMPRESSED_IMAGE |
+                                 (use_window ? 0 : CAMERA_MSG_PREVIEW_FRAME));
+    if (params)
+        merge_parameters(params);
+    if (use_window && device->ops->set_preview_window(device, &window.ops))
+        fprintf(stderr, "set_preview_window failed\n");
+
+    /* preview, and its frame pacing once it has settled */
+    seen = counter(&preview_count);
+    device->ops->start_preview(device);
+    if ((t = wait_event(&preview_count, seen, &preview_ns)))
+        add_sample(&open_to_preview, (t - start) / 1e6);
+    int first_interval = counter(&interval_count);
+    seen = counter(&preview_count);
+    wait_event(&preview_count, seen + frames - 1, &preview_ns);
+    take_interval_samples(first_interval);
+
+    /* recording */
+    device->ops->enable_msg_type(device, CAMERA_MSG_VIDEO_FRAME);
+    seen = counter(&video_count);
+    start = now_ns();
+    if (!device->ops->start_recording(device)) {
+        if ((t = wait_event(&video_count, seen, &video_ns)))
+            add_sample(&record_to_video, (t - start) / 1e6);
+        device->ops->stop_recording(device);
+    }
+    device->ops->disable_msg_type(device, CAMERA_MSG_VIDEO_FRAME);
+
+    /* back to back pictures, preview restarted after each like the app */
+    for (int i = 0; i < shots; i++) {
+        int shutters = counter(&shutter_count);
+        int jpegs = counter(&jpeg_count);
+
+        start = now_ns();
+        if (device->ops->take_picture(device)) {
+            fprintf(stderr, "take_picture failed\n");
+            break;
+        }
+        if ((t = wait_event(&shutter_count, shutters, &shutter_ns)))
+            add_sample(&shutter, (t - start) / 1e6);
+        if (!(t = wait_event(&jpeg_count, jpegs, &jpeg_ns)))
+            break;
+        add_sample(&take_to_jpeg, (t - start) / 1e6);
+
+        seen = counter(&preview_count);
+        device->ops->start_preview(device);
+        if ((t = wait_event(&preview_count, seen, &preview_ns)))
+            add_sample(&shot_to_shot, (t - start) / 1e6);
+    }
+
+    device->ops->stop_preview(device);
+    if (use_window)
+        device->ops->set_preview_window(device, NULL);
+    device->ops->release(device);
+    device->common.close(&device->common);
+    device = NULL;
+    if (use_window)
+        window_free_buffers(&window);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *id = "0";
+    const char *params = NULL;
+    int runs = 10;
+    int shots = 3;
+    int frames = 60;
+    bool use_window = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:s:f:p:w")) != -1) {
+        switch (opt) {
+        case 'n': runs = atoi(optarg); break;
+        case 'c': id = optarg; break;
+        case 's': shots = atoi(optarg); break;
+        case 'f': frames = atoi(optarg); break;
+        case 'p': params = optarg; break;
+        case 'w': use_window = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-n runs] [-c camera] [-s shots] "
+                    "[-f frames] [-p key=value;...] [-w]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs <= 0 || shots < 0 || frames < 2) {
+        fprintf(stderr, "%s: bad arguments\n", argv[0]);
+        return 2;
+    }
+
+    camera_module_t *module;
+    if (hw_get_module(CAMERA_HARDWARE_MODULE_ID, (const hw_module_t **)&module)) {
+        fprintf(stderr, "no camera HAL\n");
+        return 1;
+    }
+    if (use_window && window_init())
+        return 1;
+
+    int failures = 0;
+    for (int i = 0; i < runs; i++) {
+        fprintf(stderr, "run %d/%d\n", i + 1, runs);
+        if (run_once(module, id, shots, frames, params, use_window))
+            failures++;
+    }
+
+    if (use_window)
+        gralloc_close(window.alloc);
+
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++)
+        report(metrics[i]);
+    return failures ? 1 : 0;
+}
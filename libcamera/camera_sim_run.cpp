@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drives the host liboemcamera simulator through the same sequence the
+ * HAL uses: startCamera() symbol lookup and sensor probe, preview with
+ * histogram stats, recording, autofocus, and a snapshot with its JPEG.
+ *
+ *   camera_sim_run [seconds]
+ *
+ * seconds is how long preview and recording each run (default 2). Exits
+ * non-zero if a stage produced nothing.
+ */
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/android_pmem.h>
+
+extern "C" {
+#include "msm_camera.h"
+#include "QCamera_Intf.h"
+}
+
+#define MSM_CAMERA_CONTROL "/dev/msm_camera/control0"
+
+#define PREVIEW_WIDTH    640
+#define PREVIEW_HEIGHT   480
+#define PICTURE_WIDTH    2592
+#define PICTURE_HEIGHT   1944
+#define THUMB_WIDTH      512
+#define THUMB_HEIGHT     384
+#define PREVIEW_BUFFERS  4
+#define VIDEO_BUFFERS    4
+
+/* Signatures as QualcommCameraHardware.cpp declares them; opaque
+ * arguments the run never fills in are void pointers. */
+typedef void *(*cam_frame_fn)(void *);
+typedef void (*void_fn)(void);
+typedef void (*frame_fn)(struct msm_frame *);
+typedef bool (*encode_fn)(const cam_ctrl_dimension_t *, const uint8_t *, int,
+                          const uint8_t *, int, void *, void *, int);
+typedef mm_camera_status_t (*config_fn)(mm_camera_config *);
+
+static struct {
+    const char *name;
+    void *sym;
+} symbols[] = {
+    { "cam_frame", NULL },                      /* 0 */
+    { "camframe_terminate", NULL },             /* 1 */
+    { "cam_frame_add_free_video", NULL },       /* 2 */
+    { "cam_frame_flush_free_video", NULL },     /* 3 */
+    { "jpeg_encoder_init", NULL },              /* 4 */
+    { "jpeg_encoder_encode", NULL },            /* 5 */
+    { "jpeg_encoder_join", NULL },              /* 6 */
+    { "mm_camera_config_init", NULL },          /* 7 */
+    { "mmcamera_camframe_callback", NULL },     /* 8 */
+    { "mmcamera_camframe_videocallback", NULL },/* 9 */
+    { "mmcamera_camstats_callback", NULL },     /* 10 */
+    { "mmcamera_jpegfragment_callback", NULL }, /* 11 */
+    { "mmcamera_jpeg_callback", NULL },         /* 12 */
+    { "mmcamera_shutter_callback", NULL },      /* 13 */
+    { "cam_conf", NULL },
+    { "jpeg_encoder_setMainImageQuality", NULL },
+    { "jpeg_encoder_setThumbnailQuality", NULL },
+    { "jpeg_encoder_setRotation", NULL },
+    { "jpeg_encoder_get_buffer_offset", NULL },
+    { "jpeg_encoder_setLocation", NULL },
+    { "default_sensor_get_snapshot_sizes", NULL },
+    { "launch_cam_conf_thread", NULL },
+    { "release_cam_conf_thread", NULL },
+    { "mm_camera_config_deinit", NULL },
+    { "mmcamera_liveshot_callback", NULL },
+    { "cancel_liveshot", NULL },
+    { "set_liveshot_params", NULL },
+    { "zoom_crop_upscale", NULL },
+    { "camframe_error_callback", NULL },
+};
+
+#define NUM_SYMBOLS (sizeof(symbols) / sizeof(symbols[0]))
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jpeg_done = PTHREAD_COND_INITIALIZER;
+static void_fn add_free_video;
+
+static int preview_frames;
+static int video_frames;
+static int stats_events;
+static int shutter_events;
+static uint32_t jpeg_bytes;
+static uint8_t jpeg_head[2], jpeg_tail[2];
+static bool jpeg_finished;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void on_preview(struct msm_frame *frame)
+{
+    (void)frame;
+    pthread_mutex_lock(&lock);
+    preview_frames++;
+    pthread_mutex_unlock(&lock);
+}
+
+static void on_video(struct msm_frame *frame)
+{
+    pthread_mutex_lock(&lock);
+    video_frames++;
+    pthread_mutex_unlock(&lock);
+    /* releaseRecordingFrame() hands it straight back */
+    ((frame_fn)add_free_video)(frame);
+}
+
+static void on_stats(camstats_type type, camera_preview_histogram_info *hist)
+{
+    (void)type;
+    (void)hist;
+    pthread_mutex_lock(&lock);
+    stats_events++;
+    pthread_mutex_unlock(&lock);
+}
+
+static void on_shutter(void *crop)
+{
+    (void)crop;
+    shutter_events++;
+}
+
+static void on_fragment(uint8_t *buf, uint32_t size)
+{
+    if (!jpeg_bytes && size >= 2)
+        memcpy(jpeg_head, buf, 2);
+    if (size >= 2)
+        memcpy(jpeg_tail, buf + size - 2, 2);
+    jpeg_bytes += size;
+}
+
+static void on_jpeg(uint8_t status)
+{
+    (void)status;
+    pthread_mutex_lock(&lock);
+    jpeg_finished = true;
+    pthread_cond_signal(&jpeg_done);
+    pthread_mutex_unlock(&lock);
+}
+
+static bool ctrl(int fd, int type, void *value, int length, uint16_t *status)
+{
+    struct msm_ctrl_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = type;
+    cmd.value = value;
+    cmd.length = length;
+    cmd.timeout_ms = 5000;
+    cmd.resp_fd = fd;
+    if (ioctl(fd, MSM_CAM_IOCTL_CTRL_COMMAND, &cmd) < 0)
+        return false;
+    if (status)
+        *status = cmd.status;
+    return true;
+}
+
+/* One pmem heap cut into count NV21 buffers, registered like PmemPool. */
+static uint8_t *register_buffers(int camfd, int type, int width, int height,
+                                 int count, int *pmem_fd)
+{
+    uint32_t size = width * height * 3 / 2;
+    struct pmem_region region;
+
+    *pmem_fd = open("/dev/pmem_adsp", O_RDWR);
+    if (*pmem_fd < 0 || ioctl(*pmem_fd, PMEM_GET_TOTAL_SIZE, &region) < 0 ||
+        region.len < size * count)
+        return NULL;
+    uint8_t *base = (uint8_t *)mmap(NULL, size * count, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, *pmem_fd, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    for (int i = 0; i < count; i++) {
+        struct msm_pmem_info info;
+        memset(&info, 0, sizeof(info));
+        info.type = type;
+        info.fd = *pmem_fd;
+        info.vaddr = base + i * size;
+        info.offset = i * size;
+        info.len = size;
+        info.y_off = 0;
+        info.cbcr_off = width * height;
+        info.active = i < count - 1;
+        ioctl(camfd, MSM_CAM_IOCTL_REGISTER_PMEM, &info);
+    }
+    return base;
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc >= 2 ? atoi(argv[1]) : 2;
+    int failures = 0;
+
+    if (seconds <= 0) {
+        fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+        return 2;
+    }
+
+    void *lib = dlopen("liboemcamera.so", RTLD_NOW);
+    if (!lib) {
+        fprintf(stderr, "dlopen: %s\n", dlerror());
+        return 1;
+    }
+    for (size_t i = 0; i < NUM_SYMBOLS; i++) {
+        symbols[i].sym = dlsym(lib, symbols[i].name);
+        if (!symbols[i].sym) {
+            fprintf(stderr, "missing symbol %s\n", symbols[i].name);
+            failures++;
+        }
+    }
+    if (failures)
+        return 1;
+
+    add_free_video = (void_fn)symbols[2].sym;
+    *(void **)symbols[8].sym = (void *)on_preview;
+    *(void **)symbols[9].sym = (void *)on_video;
+    *(void **)symbols[10].sym = (void *)on_stats;
+    *(void **)symbols[11].sym = (void *)on_fragment;
+    *(void **)symbols[12].sym = (void *)on_jpeg;
+    *(void **)symbols[13].sym = (void *)on_shutter;
+
+    int camfd = open(MSM_CAMERA_CONTROL, O_RDWR);
+    struct msm_camsensor_info sensor;
+    if (camfd < 0 || ioctl(camfd, MSM_CAM_IOCTL_GET_SENSOR_INFO, &sensor) < 0) {
+        fprintf(stderr, "no %s\n", MSM_CAMERA_CONTROL);
+        return 1;
+    }
+
+    mm_camera_config cfg;
+    ((config_fn)symbols[7].sym)(&cfg);
+    int32_t on = 1;
+    cfg.mm_camera_set_parm(CAMERA_PARM_HISTOGRAM, &on);
+
+    cam_ctrl_dimension_t dim;
+    memset(&dim, 0, sizeof(dim));
+    dim.display_width = PREVIEW_WIDTH;
+    dim.display_height = PREVIEW_HEIGHT;
+    dim.video_width = PREVIEW_WIDTH;
+    dim.video_height = PREVIEW_HEIGHT;
+    dim.picture_width = PICTURE_WIDTH;
+    dim.picture_height = PICTURE_HEIGHT;
+    dim.orig_picture_dx = PICTURE_WIDTH;
+    dim.orig_picture_dy = PICTURE_HEIGHT;
+    dim.ui_thumbnail_width = THUMB_WIDTH;
+    dim.ui_thumbnail_height = THUMB_HEIGHT;
+    ctrl(camfd, CAMERA_SET_PARM_DIMENSION, &dim, sizeof(dim), NULL);
+
+    /* preview, then recording on top of it */
+    int preview_fd, video_fd;
+    uint8_t *preview = register_buffers(camfd, MSM_PMEM_PREVIEW, PREVIEW_WIDTH,
+                                        PREVIEW_HEIGHT, PREVIEW_BUFFERS, &preview_fd);
+    uint8_t *video = register_buffers(camfd, MSM_PMEM_VIDEO, PREVIEW_WIDTH,
+                                      PREVIEW_HEIGHT, VIDEO_BUFFERS, &video_fd);
+    if (!preview || !video) {
+        fprintf(stderr, "pmem setup failed\n");
+        return 1;
+    }
+
+    struct msm_frame recordframes[VIDEO_BUFFERS];
+    for (int i = 0; i < VIDEO_BUFFERS; i++) {
+        memset(&recordframes[i], 0, sizeof(recordframes[i]));
+        recordframes[i].buffer = (unsigned long)(video + i * PREVIEW_WIDTH *
+                                                 PREVIEW_HEIGHT * 3 / 2);
+        recordframes[i].cbcr_off = PREVIEW_WIDTH * PREVIEW_HEIGHT;
+        recordframes[i].fd = video_fd;
+        ((frame_fn)add_free_video)(&recordframes[i]);
+    }
+
+    struct cam_frame_start_parms parms;
+    memset(&parms, 0, sizeof(parms));
+    pthread_t frame_thread;
+    pthread_create(&frame_thread, NULL, (cam_frame_fn)symbols[0].sym, &parms);
+
+    sleep(seconds);
+    pthread_mutex_lock(&lock);
+    int preview_only = preview_frames;
+    pthread_mutex_unlock(&lock);
+
+    ctrl(camfd, CAMERA_START_VIDEO, NULL, 0, NULL);
+    sleep(seconds);
+    ctrl(camfd, CAMERA_STOP_VIDEO, NULL, 0, NULL);
+    ((void_fn)symbols[3].sym)();
+
+    /* autofocus from its own fd, like the AF worker */
+    int affd = open(MSM_CAMERA_CONTROL, O_RDWR);
+    uint16_t af_status = 0;
+    double start = now_ms();
+    int32_t af_mode = 0;
+    ctrl(affd, CAMERA_SET_PARM_AUTO_FOCUS, &af_mode, sizeof(af_mode), &af_status);
+    double af_ms = now_ms() - start;
+    close(affd);
+
+    ((void_fn)symbols[1].sym)();
+    pthread_join(frame_thread, NULL);
+
+    /* snapshot */
+    int main_fd, thumb_fd;
+    uint8_t *mainimg = register_buffers(camfd, MSM_PMEM_MAINIMG, PICTURE_WIDTH,
+                                        PICTURE_HEIGHT, 1, &main_fd);
+    uint8_t *thumb = register_buffers(camfd, MSM_PMEM_THUMBNAIL, THUMB_WIDTH,
+                                      THUMB_HEIGHT, 1, &thumb_fd);
+    start = now_ms();
+    ctrl(camfd, CAMERA_START_SNAPSHOT, NULL, 0, NULL);
+    struct msm_ctrl_cmd pic;
+    uint8_t crop[64];
+    memset(&pic, 0, sizeof(pic));
+    pic.value = crop;
+    pic.length = sizeof(crop);
+    pic.timeout_ms = 5000;
+    if (!mainimg || !thumb || ioctl(camfd, MSM_CAM_IOCTL_GET_PICTURE, &pic) < 0) {
+        fprintf(stderr, "snapshot failed\n");
+        return 1;
+    }
+    double shot_ms = now_ms() - start;
+
+    ((bool (*)(void))symbols[4].sym)();
+    ((encode_fn)symbols[5].sym)(&dim, thumb, thumb_fd, mainimg, main_fd,
+                                NULL, NULL, 0);
+    pthread_mutex_lock(&lock);
+    while (!jpeg_finished)
+        pthread_cond_wait(&jpeg_done, &lock);
+    pthread_mutex_unlock(&lock);
+    ((void_fn)symbols[6].sym)();
+    double jpeg_ms = now_ms() - start;
+
+    bool jpeg_ok = jpeg_head[0] == 0xff && jpeg_head[1] == 0xd8 &&
+                   jpeg_tail[0] == 0xff && jpeg_tail[1] == 0xd9;
+
+    printf("# sensor %s, %dx%d preview, %ds per stage\n", sensor.name,
+           PREVIEW_WIDTH, PREVIEW_HEIGHT, seconds);
+    printf("%-10s %10s\n", "stage", "result");
+    printf("%-10s %6.1f fps\n", "preview", preview_only / (double)seconds);
+    printf("%-10s %6.1f fps\n", "video", video_frames / (double)seconds);
+    printf("%-10s %10d\n", "stats", stats_events);
+    printf("%-10s %7.1f ms %s\n", "autofocus", af_ms,
+           af_status == 1 ? "done" : "FAIL");
+    printf("%-10s %7.1f ms %s\n", "shutter", shot_ms,
+           shutter_events ? "ok" : "FAIL");
+    printf("%-10s %7.1f ms %u bytes %s\n", "jpeg", jpeg_ms, jpeg_bytes,
+           jpeg_ok ? "ok" : "FAIL");
+
+    failures = !preview_only + !video_frames + !stats_events +
+               (af_status != 1) + !shutter_events + !jpeg_ok;
+    close(camfd);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_interval.h"
+
+void frame_interval_reset(frame_interval_t *t, int fps)
+{
+    memset(t, 0, sizeof(*t));
+    if (fps > 0)
+        t->nominal = 1000000000LL / fps;
+}
+
+static int by_value(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void frame_interval_stats(const frame_interval_t *t, frame_interval_stats_t *s)
+{
+    uint32_t samples[FRAME_INTERVAL_WINDOW];
+    uint64_t sum = 0;
+    double var = 0;
+
+    memset(s, 0, sizeof(*s));
+    s->count = t->count;
+    s->late = t->late;
+    s->window = s->count < FRAME_INTERVAL_WINDOW ? s->count : FRAME_INTERVAL_WINDOW;
+    if (!s->window)
+        return;
+
+    memcpy(samples, t->samples, s->window * sizeof(samples[0]));
+    qsort(samples, s->window, sizeof(samples[0]), by_value);
+
+    for (uint32_t i = 0; i < s->window; i++)
+        sum += samples[i];
+    s->min = samples[0];
+    s->max = samples[s->window - 1];
+    s->avg = sum / s->window;
+    // nearest rank
+    s->p99 = samples[(s->window * 99 + 99) / 100 - 1];
+
+    for (uint32_t i = 0; i < s->window; i++) {
+        double d = (double)samples[i] - (double)sum / s->window;
+        var += d * d;
+    }
+    s->jitter = (uint32_t)sqrt(var / s->window);
+}
+
+int frame_interval_format(const frame_interval_t *t, const char *name,
+                          char *buf, size_t size)
+{
+    frame_interval_stats_t s;
+
+    frame_interval_stats(t, &s);
+    int len = snprintf(buf, size,
+                       "%s: %u intervals, last %u: min %u avg %u max %u "
+                       "p99 %u jitter %u us (%.2f fps), %u late of nominal %lld us\n",
+                       name, s.count, s.window, s.min, s.avg, s.max, s.p99,
+                       s.jitter, s.avg ? 1e6 / s.avg : 0.0, s.late,
+                       (long long)(t->nominal / 1000));
+    return len < (int)size ? len : (int)size - 1;
+}
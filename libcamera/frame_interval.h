@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_FRAME_INTERVAL_H
+#define ANDROID_HARDWARE_FRAME_INTERVAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Rolling frame-interval statistics for one stream.
+ *
+ * frame_interval_add() is called once per frame by the stream's own
+ * thread and only stores the interval in a window of the last
+ * FRAME_INTERVAL_WINDOW; min/avg/max/p99 and jitter are computed from
+ * that window when someone asks, in frame_interval_stats(). Intervals
+ * above 1.5x the nominal one are counted since the last reset. A
+ * reader racing the writer may see one interval from the previous
+ * lap of the window, which is harmless for these numbers.
+ */
+
+#define FRAME_INTERVAL_WINDOW 128   /* power of 2 */
+
+typedef struct frame_interval {
+    int64_t last;               /* ns, 0 before the first frame */
+    int64_t nominal;            /* ns, 0 when the frame rate is unknown */
+    volatile uint32_t count;    /* intervals since reset */
+    volatile uint32_t late;     /* of those, above 1.5x nominal */
+    uint32_t samples[FRAME_INTERVAL_WINDOW];   /* us */
+} frame_interval_t;
+
+typedef struct frame_interval_stats {
+    uint32_t count;             /* intervals since reset */
+    uint32_t late;
+    uint32_t window;            /* intervals the figures below cover */
+    uint32_t min, avg, max, p99;    /* us */
+    uint32_t jitter;            /* standard deviation, us */
+} frame_interval_stats_t;
+
+/* Starts a new run at fps frames per second, 0 if unknown. */
+void frame_interval_reset(frame_interval_t *t, int fps);
+
+static inline void frame_interval_add(frame_interval_t *t, int64_t now)
+{
+    if (t->last) {
+        int64_t interval = now - t->last;
+        uint32_t n = t->count;
+
+        t->samples[n & (FRAME_INTERVAL_WINDOW - 1)] = (uint32_t)(interval / 1000);
+        if (t->nominal && interval * 2 > t->nominal * 3)
+            t->late = t->late + 1;
+        t->count = n + 1;
+    }
+    t->last = now;
+}
+
+void frame_interval_stats(const frame_interval_t *t, frame_interval_stats_t *s);
+
+/* One line, "<name>: ..." ending in a newline; returns its length. */
+int frame_interval_format(const frame_interval_t *t, const char *name,
+                          char *buf, size_t size);
+
+#endif // ANDROID_HARDWARE_FRAME_INTERVAL_H
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "frame_trace"
+#include <utils/Log.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "frame_trace.h"
+
+#define RING_MASK (FRAME_TRACE_RING_SIZE - 1)
+
+volatile int frame_trace_mode = FRAME_TRACE_OFF;
+
+typedef struct {
+    volatile int in_use;
+    int tid;
+    volatile uint32_t head;     /* events ever written to this ring */
+    frame_trace_event_t events[FRAME_TRACE_RING_SIZE];
+} trace_ring_t;
+
+static trace_ring_t rings[FRAME_TRACE_THREADS];
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static volatile uint32_t dropped;   /* from threads that found no free ring */
+
+static const char *const stage_names[] = {
+    "vfe", "copy_start", "copy_end", "app_cb", "record_cb", "release",
+    "jpeg_fragment", "jpeg_done",
+};
+
+static const char *const stream_names[] = {
+    "preview", "video", "snapshot",
+};
+
+/* Thread exit: the ring's events stay readable until it is claimed again. */
+static void release_ring(void *ring)
+{
+    __sync_lock_release(&((trace_ring_t *)ring)->in_use);
+}
+
+static void create_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static trace_ring_t *thread_ring(void)
+{
+    pthread_once(&ring_once, create_key);
+
+    trace_ring_t *ring = (trace_ring_t *)pthread_getspecific(ring_key);
+    if (ring)
+        return ring;
+
+    for (int i = 0; i < FRAME_TRACE_THREADS; i++) {
+        if (__sync_bool_compare_and_swap(&rings[i].in_use, 0, 1)) {
+            rings[i].tid = syscall(__NR_gettid);
+            pthread_setspecific(ring_key, &rings[i]);
+            return &rings[i];
+        }
+    }
+    return NULL;
+}
+
+void frame_trace_set_mode(int mode)
+{
+    LOGI("frame trace %s", mode == FRAME_TRACE_CHROME ? "on, chrome format" :
+         mode == FRAME_TRACE_TEXT ? "on" : "off");
+    frame_trace_mode = mode;
+}
+
+void frame_trace_record(int stage, int stream, uint32_t id, uint32_t arg)
+{
+    trace_ring_t *ring = thread_ring();
+    struct timespec ts;
+
+    if (!ring) {
+        __sync_fetch_and_add(&dropped, 1);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint32_t head = ring->head;
+    frame_trace_event_t *e = &ring->events[head & RING_MASK];
+    e->ts = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    e->id = id;
+    e->arg = arg;
+    e->stage = stage;
+    e->stream = stream;
+    e->tid = ring->tid;
+    // the event must be complete before a reader can see it
+    __sync_synchronize();
+    ring->head = head + 1;
+}
+
+/* Copies the events of every ring into out, dropping any the owner
+ * overwrote while they were being read. */
+static int collect(frame_trace_event_t *out)
+{
+    int n = 0;
+
+    for (int r = 0; r < FRAME_TRACE_THREADS; r++) {
+        trace_ring_t *ring = &rings[r];
+        uint32_t head = ring->head;
+        uint32_t first = head > FRAME_TRACE_RING_SIZE ?
+                         head - FRAME_TRACE_RING_SIZE : 0;
+        int start = n;
+
+        __sync_synchronize();
+        for (uint32_t i = first; i < head; i++)
+            out[n++] = ring->events[i & RING_MASK];
+        __sync_synchronize();
+
+        // the slot of the event being written now is not to be trusted
+        uint32_t now = ring->head;
+        uint32_t valid = now >= FRAME_TRACE_RING_SIZE ?
+                         now - FRAME_TRACE_RING_SIZE + 1 : 0;
+        if (valid > first) {
+            uint32_t skip = valid - first;
+            if (skip > head - first)
+                skip = head - first;
+            memmove(&out[start], &out[start + skip],
+                    (n - start - skip) * sizeof(*out));
+            n -= skip;
+        }
+    }
+    return n;
+}
+
+static int by_time(const void *a, const void *b)
+{
+    int64_t x = ((const frame_trace_event_t *)a)->ts;
+    int64_t y = ((const frame_trace_event_t *)b)->ts;
+    return x < y ? -1 : x > y;
+}
+
+/* Small buffered writer, the dump can run to a few hundred kB. */
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[4096];
+} out_t;
+
+static void out_flush(out_t *o)
+{
+    if (o->len)
+        write(o->fd, o->buf, o->len);
+    o->len = 0;
+}
+
+static void out_printf(out_t *o, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (o->len > sizeof(o->buf) - 256)
+        out_flush(o);
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, sizeof(o->buf) - o->len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        o->len += (size_t)n < sizeof(o->buf) - o->len ? n : sizeof(o->buf) - o->len - 1;
+}
+
+static const char *stage_name(int stage)
+{
+    return stage < (int)(sizeof(stage_names) / sizeof(stage_names[0])) ?
+           stage_names[stage] : "?";
+}
+
+static const char *stream_name(int stream)
+{
+    return stream < (int)(sizeof(stream_names) / sizeof(stream_names[0])) ?
+           stream_names[stream] : "?";
+}
+
+/* One line per frame: its first event, then every later stage in us
+ * after it. A frame is the run of events of one stream and id up to a
+ * stage it already had, when the buffer is carrying the next frame, so
+ * the wrapper's events group by themselves when no VFE event is
+ * recorded, as with the prebuilt HAL. */
+static void dump_text(out_t *o, const frame_trace_event_t *ev, int n)
+{
+    bool *used = (bool *)calloc(n, sizeof(bool));
+    int64_t base = n ? ev[0].ts : 0;
+
+    if (!used)
+        return;
+    for (int i = 0; i < n; i++) {
+        if (used[i])
+            continue;
+        used[i] = true;
+        out_printf(o, "%-8s %08x at %9.3f ms: %s (%u) tid %d",
+                   stream_name(ev[i].stream), ev[i].id, (ev[i].ts - base) / 1e6,
+                   stage_name(ev[i].stage), ev[i].arg, ev[i].tid);
+
+        uint32_t stages = 1u << ev[i].stage;
+        bool later = false;
+        for (int j = i + 1; j < n; j++) {
+            if (used[j] || ev[j].stream != ev[i].stream || ev[j].id != ev[i].id)
+                continue;
+            if (stages & (1u << ev[j].stage))
+                break;
+            stages |= 1u << ev[j].stage;
+            used[j] = true;
+            later = true;
+            out_printf(o, ", %s +%lld", stage_name(ev[j].stage),
+                       (long long)((ev[j].ts - ev[i].ts) / 1000));
+        }
+        out_printf(o, later ? " us\n" : "\n");
+    }
+    free(used);
+}
+
+/* Chrome trace event format; copies are spans, everything else instants. */
+static void dump_chrome(out_t *o, const frame_trace_event_t *ev, int n)
+{
+    int pid = getpid();
+
+    out_printf(o, "{\"traceEvents\":[\n");
+    for (int i = 0; i < n; i++) {
+        const char *name = stage_name(ev[i].stage);
+        const char *ph = "i";
+
+        if (ev[i].stage == FRAME_TRACE_COPY_START) {
+            name = "copy";
+            ph = "B";
+        } else if (ev[i].stage == FRAME_TRACE_COPY_END) {
+            name = "copy";
+            ph = "E";
+        }
+        out_printf(o, "{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,"
+                   "\"pid\":%d,\"tid\":%d,\"args\":{\"stream\":\"%s\","
+                   "\"frame\":%u,\"arg\":%u}}%s\n",
+                   name, ph, *ph == 'i' ? "\"s\":\"t\"," : "", ev[i].ts / 1e3,
+                   pid, ev[i].tid, stream_name(ev[i].stream), ev[i].id,
+                   ev[i].arg, i + 1 < n ? "," : "");
+    }
+    out_printf(o, "],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+void frame_trace_dump(int fd)
+{
+    int mode = frame_trace_mode;
+    out_t o;
+
+    if (mode == FRAME_TRACE_OFF)
+        return;
+
+    frame_trace_event_t *ev = (frame_trace_event_t *)
+        malloc(sizeof(*ev) * FRAME_TRACE_RING_SIZE * FRAME_TRACE_THREADS);
+    if (!ev)
+        return;
+    int n = collect(ev);
+    qsort(ev, n, sizeof(*ev), by_time);
+
+    o.fd = fd;
+    o.len = 0;
+    if (mode == FRAME_TRACE_CHROME) {
+        dump_chrome(&o, ev, n);
+    } else {
+        out_printf(&o, "frame trace: %d events, %u dropped\n", n, dropped);
+        dump_text(&o, ev, n);
+    }
+    out_flush(&o);
+    free(ev);
+}
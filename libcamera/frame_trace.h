@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_FRAME_TRACE_H
+#define ANDROID_HARDWARE_FRAME_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Per-frame trace points for the preview, video and snapshot paths.
+ *
+ * Each thread that records an event gets its own ring of the last
+ * FRAME_TRACE_RING_SIZE events, written only by that thread, so
+ * recording takes no lock; the ring goes back to the pool when the
+ * thread exits. frame_trace_dump() merges the rings by time, either as
+ * one line per frame (text) or as Chrome trace JSON (chrome://tracing,
+ * systrace's viewer). With tracing off a trace point is one load and
+ * a branch.
+ *
+ * Events of one frame share a stream and an id: the byte offset of the
+ * buffer in its heap for preview and video, the JPEG size so far for a
+ * snapshot. The text dump groups them per frame from the id and the
+ * order of the stages alone, so it needs no VFE event.
+ */
+
+#define FRAME_TRACE_RING_SIZE 256       /* events per thread, power of 2 */
+#define FRAME_TRACE_THREADS   16
+
+enum frame_trace_mode {
+    FRAME_TRACE_OFF,
+    FRAME_TRACE_TEXT,
+    FRAME_TRACE_CHROME,
+};
+
+enum frame_trace_stream {
+    FRAME_TRACE_PREVIEW,
+    FRAME_TRACE_VIDEO,
+    FRAME_TRACE_SNAPSHOT,
+};
+
+enum frame_trace_stage {
+    FRAME_TRACE_VFE,            /* frame arrived from the VFE */
+    FRAME_TRACE_COPY_START,     /* overlay/gralloc hand-off */
+    FRAME_TRACE_COPY_END,
+    FRAME_TRACE_APP_CALLBACK,   /* data callback to the client */
+    FRAME_TRACE_RECORD_CALLBACK,
+    FRAME_TRACE_RELEASE,        /* recording frame back from the encoder */
+    FRAME_TRACE_JPEG_FRAGMENT,  /* arg: fragment size */
+    FRAME_TRACE_JPEG_DONE,
+};
+
+typedef struct frame_trace_event {
+    int64_t ts;                 /* CLOCK_MONOTONIC, ns */
+    uint32_t id;
+    uint32_t arg;
+    int32_t tid;
+    uint8_t stage;
+    uint8_t stream;
+} frame_trace_event_t;
+
+extern volatile int frame_trace_mode;
+
+void frame_trace_set_mode(int mode);
+
+void frame_trace_record(int stage, int stream, uint32_t id, uint32_t arg);
+
+/* Writes the events still in the rings to fd in the current mode's
+ * format; does nothing while tracing is off. */
+void frame_trace_dump(int fd);
+
+static inline void frame_trace(int stage, int stream, uint32_t id, uint32_t arg)
+{
+    if (__builtin_expect(frame_trace_mode != FRAME_TRACE_OFF, 0))
+        frame_trace_record(stage, stream, id, arg);
+}
+
+#endif // ANDROID_HARDWARE_FRAME_TRACE_H
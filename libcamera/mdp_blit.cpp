@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "mdp_blit"
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "mdp_blit.h"
+#include "yuv420sp.h"
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void mdp_blit_init(mdp_blit_t *b, int fb_fd)
+{
+    memset(b, 0, sizeof(*b));
+    b->fb_fd = fb_fd;
+}
+
+bool mdp_blit_queue(mdp_blit_t *b,
+                    const mdp_blit_frame_t *dst, const struct mdp_rect *dst_rect,
+                    const mdp_blit_frame_t *src, const struct mdp_rect *src_rect)
+{
+    if (b->count >= MDP_BLIT_BATCH_MAX)
+        return false;
+
+    b->jobs[b->count].dst = *dst;
+    b->jobs[b->count].src = *src;
+    b->jobs[b->count].dst_rect = *dst_rect;
+    b->jobs[b->count].src_rect = *src_rect;
+    b->count++;
+    return true;
+}
+
+static void frame_extent(const mdp_blit_frame_t *f, uint32_t *lo, uint32_t *hi)
+{
+    uint32_t luma = f->width * f->height;
+    uint32_t y_end = f->y_offset + luma;
+    uint32_t uv_end = f->cbcr_offset + luma / 2;
+
+    *lo = f->y_offset < f->cbcr_offset ? f->y_offset : f->cbcr_offset;
+    *hi = y_end > uv_end ? y_end : uv_end;
+}
+
+static bool same_memory(const mdp_blit_frame_t *a, const mdp_blit_frame_t *b)
+{
+    if (a->memory_id >= 0 && a->memory_id == b->memory_id)
+        return true;
+    return a->base != NULL && a->base == b->base;
+}
+
+static bool overlaps(const mdp_blit_frame_t *dst, const mdp_blit_frame_t *src)
+{
+    uint32_t dlo, dhi, slo, shi;
+
+    if (!same_memory(dst, src))
+        return false;
+    frame_extent(dst, &dlo, &dhi);
+    frame_extent(src, &slo, &shi);
+    return dlo < shi && slo < dhi;
+}
+
+static bool mdp_can_blit(const mdp_blit_t *b, const mdp_blit_frame_t *dst,
+                         const mdp_blit_frame_t *src)
+{
+    return b->fb_fd >= 0 &&
+           dst->memory_id >= 0 && src->memory_id >= 0 &&
+           dst->cbcr_offset == dst->y_offset + dst->width * dst->height &&
+           src->cbcr_offset == src->y_offset + src->width * src->height &&
+           !overlaps(dst, src);
+}
+
+/* CPU view of rectangle r of f, origin rounded down to even so the
+ * chroma pairs stay aligned. */
+static void window(yuv420sp_image_t *img, const mdp_blit_frame_t *f,
+                   const struct mdp_rect *r)
+{
+    uint32_t x = r->x & ~1;
+    uint32_t y = r->y & ~1;
+
+    img->y = f->base + f->y_offset + y * f->width + x;
+    img->uv = f->base + f->cbcr_offset + (y / 2) * f->width + x;
+    img->y_stride = f->width;
+    img->uv_stride = f->width;
+    img->width = r->w;
+    img->height = r->h;
+}
+
+/* Crop within one buffer; the CPU is the only way to do it in place. */
+static bool cpu_move(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    if (dst->width != src->width || dst->height != src->height ||
+        dst->y_stride > src->y_stride || dst->uv_stride > src->uv_stride)
+        return false;
+    // The luma goes first, so it must not land on chroma still to be read.
+    if (dst->y + (dst->height - 1) * dst->y_stride + dst->width > src->uv &&
+        dst->y < src->uv + (src->height / 2) * src->uv_stride)
+        return false;
+
+    yuv420sp_move(dst, src);
+    return true;
+}
+
+static bool cpu_blit(const mdp_blit_frame_t *dst, const struct mdp_rect *dst_rect,
+                     const mdp_blit_frame_t *src, const struct mdp_rect *src_rect)
+{
+    yuv420sp_image_t d, s;
+
+    if (dst->base == NULL || src->base == NULL)
+        return false;
+    window(&d, dst, dst_rect);
+    window(&s, src, src_rect);
+
+    if (overlaps(dst, src))
+        return cpu_move(&d, &s);
+
+    if (d.width == s.width && d.height == s.height)
+        yuv420sp_copy(&d, &s);
+    else if (d.width * 2 == s.width && d.height * 2 == s.height &&
+             !(s.width & 3) && !(s.height & 3))
+        yuv420sp_downscale_2x(&d, &s);
+    else
+        yuv420sp_scale(&d, &s);
+    return true;
+}
+
+static void fill_req(struct mdp_blit_req *e, const mdp_blit_frame_t *dst,
+                     const struct mdp_rect *dst_rect, const mdp_blit_frame_t *src,
+                     const struct mdp_rect *src_rect)
+{
+    memset(e, 0, sizeof(*e));
+    e->src.width = src->width;
+    e->src.height = src->height;
+    e->src.format = MDP_Y_CBCR_H2V2;
+    e->src.offset = src->y_offset;
+    e->src.memory_id = src->memory_id;
+    e->dst.width = dst->width;
+    e->dst.height = dst->height;
+    e->dst.format = MDP_Y_CBCR_H2V2;
+    e->dst.offset = dst->y_offset;
+    e->dst.memory_id = dst->memory_id;
+    e->src_rect = *src_rect;
+    e->dst_rect = *dst_rect;
+    e->transp_mask = 0xffffffff;
+    e->flags = 0;
+    e->alpha = 0xff;
+}
+
+int mdp_blit_flush(mdp_blit_t *b)
+{
+    int on_mdp[MDP_BLIT_BATCH_MAX];
+    int mdp_count = 0;
+    int failed = 0;
+    int i;
+
+    if (!b->count)
+        return 0;
+
+    uint64_t start = now_us();
+
+    for (i = 0; i < b->count; i++) {
+        if (mdp_can_blit(b, &b->jobs[i].dst, &b->jobs[i].src)) {
+            fill_req(&b->reqs.list.req[mdp_count], &b->jobs[i].dst,
+                     &b->jobs[i].dst_rect, &b->jobs[i].src, &b->jobs[i].src_rect);
+            on_mdp[mdp_count++] = i;
+        } else if (cpu_blit(&b->jobs[i].dst, &b->jobs[i].dst_rect,
+                            &b->jobs[i].src, &b->jobs[i].src_rect)) {
+            b->stats.cpu_blits++;
+        } else {
+            failed++;
+        }
+    }
+
+    if (mdp_count) {
+        b->reqs.list.count = mdp_count;
+        if (ioctl(b->fb_fd, MSMFB_BLIT, &b->reqs.list) < 0) {
+            LOGE("MSMFB_BLIT of %d failed: %s, using the CPU",
+                 mdp_count, strerror(errno));
+            for (i = 0; i < mdp_count; i++) {
+                int j = on_mdp[i];
+                if (cpu_blit(&b->jobs[j].dst, &b->jobs[j].dst_rect,
+                             &b->jobs[j].src, &b->jobs[j].src_rect))
+                    b->stats.cpu_blits++;
+                else
+                    failed++;
+            }
+        } else {
+            b->stats.mdp_blits += mdp_count;
+        }
+    }
+
+    uint32_t us = now_us() - start;
+    b->stats.flushes++;
+    b->stats.failures += failed;
+    b->stats.last_us = us;
+    if (us > b->stats.max_us)
+        b->stats.max_us = us;
+    b->stats.total_us += us;
+    LOGV("blit: %d requests (%d on mdp) in %u us", b->count, mdp_count, us);
+
+    b->count = 0;
+    return failed;
+}
+
+uint32_t mdp_blit_average_us(const mdp_blit_t *b)
+{
+    uint32_t blits = b->stats.mdp_blits + b->stats.cpu_blits;
+
+    return blits ? b->stats.total_us / blits : 0;
+}
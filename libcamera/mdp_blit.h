@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_MDP_BLIT_H
+#define ANDROID_HARDWARE_MDP_BLIT_H
+
+#include <stdint.h>
+#include <linux/msm_mdp.h>
+
+/*
+ * Zoom, crop and scale blits of YUV420 semi-planar frames, shared by the
+ * preview, postview and snapshot paths.
+ *
+ * Requests are queued with mdp_blit_queue() and issued by
+ * mdp_blit_flush() as a single MSMFB_BLIT request list. A request the
+ * MDP cannot take (no framebuffer, frame not in pmem, chroma plane not
+ * right after the luma, or source and destination overlapping) runs on
+ * the CPU with the yuv420sp kernels instead, as does the whole list when
+ * the driver rejects it. Every flush records its latency in stats.
+ */
+
+#define MDP_BLIT_BATCH_MAX 4
+
+typedef struct mdp_blit_frame {
+    int memory_id;          /* pmem fd, -1 if not in pmem */
+    uint8_t *base;          /* CPU mapping of memory_id, NULL if none */
+    uint32_t y_offset;      /* luma plane, from base */
+    uint32_t cbcr_offset;   /* chroma plane, from base */
+    int width;              /* also the row stride */
+    int height;
+} mdp_blit_frame_t;
+
+typedef struct mdp_blit_stats {
+    uint32_t flushes;
+    uint32_t mdp_blits;     /* requests done by the MDP */
+    uint32_t cpu_blits;     /* requests done on the CPU */
+    uint32_t failures;      /* requests neither could do */
+    uint32_t last_us;       /* last flush, all of its requests */
+    uint32_t max_us;
+    uint64_t total_us;
+} mdp_blit_stats_t;
+
+typedef struct mdp_blit {
+    int fb_fd;
+    int count;
+    struct {
+        mdp_blit_frame_t dst;
+        mdp_blit_frame_t src;
+        struct mdp_rect dst_rect;
+        struct mdp_rect src_rect;
+    } jobs[MDP_BLIT_BATCH_MAX];
+    mdp_blit_stats_t stats;
+    /* last: mdp_blit_req_list ends in a flexible array */
+    union {
+        char d[sizeof(struct mdp_blit_req_list) +
+               sizeof(struct mdp_blit_req) * MDP_BLIT_BATCH_MAX];
+        struct mdp_blit_req_list list;
+    } reqs;
+} mdp_blit_t;
+
+/* fb_fd is borrowed, not closed; -1 sends everything to the CPU. */
+void mdp_blit_init(mdp_blit_t *b, int fb_fd);
+
+/* Queue a blit of src_rect in src to dst_rect in dst, scaling if the
+ * sizes differ. Rectangles are in pixels; the CPU path rounds their
+ * origins down to even. Returns false, queueing nothing, when the batch
+ * is full. */
+bool mdp_blit_queue(mdp_blit_t *b,
+                    const mdp_blit_frame_t *dst, const struct mdp_rect *dst_rect,
+                    const mdp_blit_frame_t *src, const struct mdp_rect *src_rect);
+
+/* Run the queued blits and empty the queue. Returns how many failed. */
+int mdp_blit_flush(mdp_blit_t *b);
+
+/* Average latency of one request over all flushes, in microseconds. */
+uint32_t mdp_blit_average_us(const mdp_blit_t *b);
+
+#endif // ANDROID_HARDWARE_MDP_BLIT_H
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Check of the mdp_blit request routing and its CPU fallback.
+ *
+ *   mdp_blit_check
+ *
+ * Runs the preview zoom, postview downscale, odd-ratio scale and in-place
+ * snapshot crop requests through mdp_blit without a framebuffer, then
+ * again with a descriptor the driver rejects so the whole list falls back
+ * to the CPU. Every result is compared byte for byte with the scalar
+ * yuv420sp kernel on untouched copies, and requests nothing can do must
+ * be counted as failures. Exits non-zero on any mismatch.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdp_blit.h"
+#include "yuv420sp.h"
+
+#define SRC_W 640
+#define SRC_H 480
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    printf("%-28s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok)
+        failures++;
+}
+
+static uint32_t frame_size(int width, int height)
+{
+    return width * height * 3 / 2;
+}
+
+static uint8_t *new_frame(int width, int height, int seed)
+{
+    uint32_t size = frame_size(width, height);
+    uint8_t *base = (uint8_t *)malloc(size);
+
+    for (uint32_t i = 0; i < size; i++)
+        base[i] = (uint8_t)(i * 7 + seed + (i >> 9));
+    return base;
+}
+
+static void describe(mdp_blit_frame_t *f, uint8_t *base, int memory_id,
+                     int width, int height)
+{
+    f->memory_id = memory_id;
+    f->base = base;
+    f->y_offset = 0;
+    f->cbcr_offset = width * height;
+    f->width = width;
+    f->height = height;
+}
+
+static void rect(struct mdp_rect *r, int x, int y, int w, int h)
+{
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+}
+
+/* Scalar view of rectangle r of a packed frame, as the CPU path sees it. */
+static void window(yuv420sp_image_t *img, uint8_t *base, int width, int height,
+                   const struct mdp_rect *r)
+{
+    img->y = base + r->y * width + r->x;
+    img->uv = base + width * height + (r->y / 2) * width + r->x;
+    img->y_stride = width;
+    img->uv_stride = width;
+    img->width = r->w;
+    img->height = r->h;
+}
+
+typedef void (*kernel_t)(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+
+/* One frame-to-frame request through mdp_blit, against kernel on copies. */
+static void check_blit(const char *name, int fb_fd, const int *ids,
+                       int dst_w, int dst_h, const struct mdp_rect *src_rect,
+                       kernel_t kernel)
+{
+    mdp_blit_t b;
+    mdp_blit_frame_t dst, src;
+    struct mdp_rect dst_rect;
+    yuv420sp_image_t d, s;
+
+    uint8_t *src_base = new_frame(SRC_W, SRC_H, 1);
+    uint8_t *dst_base = new_frame(dst_w, dst_h, 2);
+    uint8_t *expect = new_frame(dst_w, dst_h, 2);
+
+    rect(&dst_rect, 0, 0, dst_w, dst_h);
+    window(&d, expect, dst_w, dst_h, &dst_rect);
+    window(&s, src_base, SRC_W, SRC_H, src_rect);
+    kernel(&d, &s);
+
+    mdp_blit_init(&b, fb_fd);
+    describe(&dst, dst_base, ids[0], dst_w, dst_h);
+    describe(&src, src_base, ids[1], SRC_W, SRC_H);
+    bool queued = mdp_blit_queue(&b, &dst, &dst_rect, &src, src_rect);
+    int failed = mdp_blit_flush(&b);
+
+    check(queued && !failed && b.stats.cpu_blits == 1 && !b.stats.mdp_blits &&
+          !memcmp(dst_base, expect, frame_size(dst_w, dst_h)), name);
+
+    free(src_base);
+    free(dst_base);
+    free(expect);
+}
+
+/* The snapshot zoom: the centered crop moved to the start of its own
+ * buffer, against an out-of-place crop of an untouched copy. */
+static void check_in_place(int fb_fd, const int *ids)
+{
+    const int w = SRC_W / 2, h = SRC_H / 2;
+    mdp_blit_t b;
+    mdp_blit_frame_t dst, src;
+    struct mdp_rect dst_rect, src_rect;
+    yuv420sp_image_t d, s;
+
+    uint8_t *base = new_frame(SRC_W, SRC_H, 3);
+    uint8_t *packed = new_frame(SRC_W, SRC_H, 3);
+    uint8_t *expect = new_frame(w, h, 4);
+
+    yuv420sp_init(&s, packed, SRC_W, SRC_H, SRC_W, SRC_W * SRC_H);
+    yuv420sp_init(&d, expect, w, h, w, w * h);
+    yuv420sp_crop_center_c(&d, &s);
+
+    // the destination is packed at the crop size within the same buffer
+    describe(&src, base, ids[0], SRC_W, SRC_H);
+    describe(&dst, base, ids[0], w, h);
+    rect(&src_rect, (SRC_W - w) / 2, (SRC_H - h) / 2, w, h);
+    rect(&dst_rect, 0, 0, w, h);
+
+    mdp_blit_init(&b, fb_fd);
+    mdp_blit_queue(&b, &dst, &dst_rect, &src, &src_rect);
+    int failed = mdp_blit_flush(&b);
+
+    check(!failed && b.stats.cpu_blits == 1 &&
+          !memcmp(base, expect, frame_size(w, h)), "in-place crop");
+
+    free(base);
+    free(packed);
+    free(expect);
+}
+
+/* Requests neither path can do are counted, not run. */
+static void check_refused(int fb_fd)
+{
+    mdp_blit_t b;
+    mdp_blit_frame_t dst, src;
+    struct mdp_rect dst_rect, src_rect;
+    uint8_t *base = new_frame(SRC_W, SRC_H, 5);
+    uint8_t *copy = new_frame(SRC_W, SRC_H, 5);
+
+    mdp_blit_init(&b, fb_fd);
+
+    // not in pmem and not mapped
+    describe(&src, NULL, -1, SRC_W, SRC_H);
+    describe(&dst, base, -1, SRC_W, SRC_H);
+    rect(&src_rect, 0, 0, SRC_W, SRC_H);
+    rect(&dst_rect, 0, 0, SRC_W, SRC_H);
+    mdp_blit_queue(&b, &dst, &dst_rect, &src, &src_rect);
+
+    // in place, but scaled
+    describe(&src, base, -1, SRC_W, SRC_H);
+    rect(&src_rect, 160, 120, 320, 240);
+    rect(&dst_rect, 0, 0, SRC_W, SRC_H);
+    mdp_blit_queue(&b, &dst, &dst_rect, &src, &src_rect);
+
+    int failed = mdp_blit_flush(&b);
+    check(failed == 2 && b.stats.failures == 2 && !b.stats.cpu_blits &&
+          !memcmp(base, copy, frame_size(SRC_W, SRC_H)), "refused requests");
+
+    for (int i = 0; i < MDP_BLIT_BATCH_MAX; i++)
+        mdp_blit_queue(&b, &dst, &dst_rect, &src, &src_rect);
+    check(!mdp_blit_queue(&b, &dst, &dst_rect, &src, &src_rect), "full batch");
+    b.count = 0;
+
+    free(base);
+    free(copy);
+}
+
+/* ids are the pmem descriptors of two distinct buffers, -1 for none. */
+static void run(const char *label, int fb_fd, const int *ids)
+{
+    struct mdp_rect zoom, whole, odd;
+
+    printf("# %s\n", label);
+    rect(&zoom, 160, 120, 320, 240);
+    rect(&whole, 0, 0, SRC_W, SRC_H);
+    rect(&odd, 40, 30, 560, 420);
+
+    check_blit("preview zoom copy", fb_fd, ids, 320, 240, &zoom,
+               yuv420sp_copy_c);
+    check_blit("postview downscale", fb_fd, ids, SRC_W / 2, SRC_H / 2,
+               &whole, yuv420sp_downscale_2x_c);
+    check_blit("odd ratio scale", fb_fd, ids, 352, 288, &odd,
+               yuv420sp_scale_c);
+    check_in_place(fb_fd, ids);
+    check_refused(fb_fd);
+}
+
+int main(void)
+{
+    const int no_pmem[2] = { -1, -1 };
+    int fds[3];
+
+    run("no framebuffer", -1, no_pmem);
+
+    // Any descriptor that is not an MDP makes MSMFB_BLIT fail; the other
+    // two stand in for the pmem regions of the two buffers.
+    for (int i = 0; i < 3; i++) {
+        fds[i] = open("/dev/null", O_RDWR);
+        if (fds[i] < 0) {
+            perror("/dev/null");
+            return 2;
+        }
+    }
+    run("framebuffer rejects the list", fds[0], fds + 1);
+    for (int i = 0; i < 3; i++)
+        close(fds[i]);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,878 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for liboemcamera.so and the msm_camera and pmem drivers,
+ * so the preview, record and snapshot paths can run and be profiled on
+ * a Linux box.
+ *
+ * It exports every symbol startCamera() dlsym()s, and interposes open(),
+ * ioctl() and close(): /dev/msm_camera/ and /dev/pmem_ nodes come back
+ * as memfds (ashmem on the device), everything else goes to the kernel.
+ * Load it with LD_PRELOAD, or link it ahead of libc as camera_sim_run
+ * does; the device build is installed as /data/camera_sim/liboemcamera.so
+ * so the HAL's dlopen() finds the preloaded copy.
+ *
+ * cam_frame() produces synthetic NV21 frames into the registered preview
+ * buffers and hands them to mmcamera_camframe_callback, and to the video
+ * callback from the free video queue while recording. GET_PICTURE fills
+ * the main image and thumbnail buffers, and jpeg_encoder_encode() emits
+ * a dummy JPEG through the fragment and done callbacks from its own
+ * thread, like the real encoder.
+ *
+ * Environment:
+ *   CAMERA_SIM_FPS       preview frame rate (30)
+ *   CAMERA_SIM_AF_MS     duration of one focus sweep (300)
+ *   CAMERA_SIM_SHOT_MS   exposure time of a snapshot (60)
+ *   CAMERA_SIM_JPEG_MS   encode time per megapixel (40)
+ *   CAMERA_SIM_VERBOSE   log every command to stderr when set
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_ANDROID_OS
+#include <cutils/ashmem.h>
+#endif
+
+#include <linux/android_pmem.h>
+
+extern "C" {
+#include "msm_camera.h"
+#include "QCamera_Intf.h"
+}
+
+/* From QualcommCameraHardware.h, which needs the framework headers. */
+typedef struct {
+    uint32_t in1_w;
+    uint32_t out1_w;
+    uint32_t in1_h;
+    uint32_t out1_h;
+    uint32_t in2_w;
+    uint32_t out2_w;
+    uint32_t in2_h;
+    uint32_t out2_h;
+    uint8_t update_flag;
+} common_crop_t;
+
+typedef struct {
+    uint32_t timestamp;
+    double latitude;
+    double longitude;
+    int16_t altitude;
+} camera_position_type;
+
+typedef uint8_t jpeg_event_t;
+#define JPEG_EVENT_DONE 0
+
+#define TRUE 1
+
+/* camera_cb_type values the HAL checks in ctrlCmd.status */
+#define CAMERA_EXIT_CB_DONE  1
+#define CAMERA_EXIT_CB_ABORT 5
+
+#define SIM_MAX_BUFFERS    32
+#define SIM_MAX_VIDEO      16
+#define SIM_MAX_FDS        32
+#define SIM_MAX_ZOOM       30
+#define SIM_PMEM_SIZE      (64 * 1024 * 1024)   /* sparse, per open() */
+#define SIM_FRAGMENT_SIZE  (64 * 1024)
+#define SIM_PHYS_BASE      0x20000000
+
+#define SIM_LOG(...) \
+    do { if (sim_verbose) fprintf(stderr, "oemcamera_sim: " __VA_ARGS__); } while (0)
+
+#ifdef HAVE_ANDROID_OS
+typedef int ioctl_request_t;            /* bionic: ioctl(int, int, ...) */
+#else
+typedef unsigned long ioctl_request_t;
+#endif
+
+enum sim_fd_kind { SIM_FD_NONE, SIM_FD_CONTROL, SIM_FD_PMEM };
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+
+static struct {
+    int fd;
+    enum sim_fd_kind kind;
+} sim_fds[SIM_MAX_FDS];
+
+static struct msm_pmem_info sim_buffers[SIM_MAX_BUFFERS];
+static int sim_buffer_count;
+
+static struct msm_frame *sim_free_video[SIM_MAX_VIDEO];
+static int sim_free_video_count;
+
+static cam_ctrl_dimension_t sim_dimension;
+static bool sim_terminate;
+static bool sim_recording;
+static bool sim_histogram;
+static bool sim_liveshot_pending;
+static bool sim_af_cancel;
+
+static uint8_t *sim_liveshot_buffer;
+static uint32_t sim_liveshot_size;
+
+static int sim_fps = 30;
+static int sim_af_ms = 300;
+static int sim_shot_ms = 60;
+static int sim_jpeg_ms = 40;
+static bool sim_verbose;
+
+static pthread_t sim_jpeg_thread;
+static bool sim_jpeg_running;
+static struct {
+    uint32_t size;
+    const uint8_t *image;
+    int delay_ms;
+} sim_jpeg;
+
+static common_crop_t sim_crop;
+
+extern "C" {
+
+/* Set by the HAL through the pointers dlsym() returns. */
+void (*mmcamera_camframe_callback)(struct msm_frame *frame);
+void (*mmcamera_camframe_videocallback)(struct msm_frame *frame);
+void (*mmcamera_camstats_callback)(camstats_type stype,
+                                   camera_preview_histogram_info *histinfo);
+void (*mmcamera_jpegfragment_callback)(uint8_t *buff_ptr, uint32_t buff_size);
+void (*mmcamera_jpeg_callback)(jpeg_event_t status);
+void (*mmcamera_shutter_callback)(common_crop_t *crop);
+void (*camframe_error_callback)(camera_error_type err);
+void (*mmcamera_liveshot_callback)(liveshot_status status, uint32_t jpeg_size);
+
+static void sim_cancel_liveshot(void);
+void (*cancel_liveshot)(void) = sim_cancel_liveshot;
+
+}
+
+static int env_int(const char *name, int def)
+{
+    const char *v = getenv(name);
+    return v && atoi(v) > 0 ? atoi(v) : def;
+}
+
+__attribute__((constructor))
+static void sim_init(void)
+{
+    sim_fps = env_int("CAMERA_SIM_FPS", sim_fps);
+    sim_af_ms = env_int("CAMERA_SIM_AF_MS", sim_af_ms);
+    sim_shot_ms = env_int("CAMERA_SIM_SHOT_MS", sim_shot_ms);
+    sim_jpeg_ms = env_int("CAMERA_SIM_JPEG_MS", sim_jpeg_ms);
+    sim_verbose = getenv("CAMERA_SIM_VERBOSE") != NULL;
+}
+
+static void add_ms(struct timespec *ts, long ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = { 0, 0 };
+    add_ms(&ts, ms);
+    nanosleep(&ts, NULL);
+}
+
+/* ---- fake device nodes ---- */
+
+static enum sim_fd_kind fd_kind(int fd)
+{
+    enum sim_fd_kind kind = SIM_FD_NONE;
+
+    pthread_mutex_lock(&sim_lock);
+    for (int i = 0; i < SIM_MAX_FDS; i++)
+        if (sim_fds[i].kind != SIM_FD_NONE && sim_fds[i].fd == fd)
+            kind = sim_fds[i].kind;
+    pthread_mutex_unlock(&sim_lock);
+    return kind;
+}
+
+static int shared_memory(const char *name, size_t size)
+{
+#ifdef HAVE_ANDROID_OS
+    return ashmem_create_region(name, size);
+#else
+    int fd = memfd_create(name, 0);
+    if (fd >= 0 && ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#endif
+}
+
+static int sim_open(const char *path)
+{
+    enum sim_fd_kind kind;
+
+    if (!strncmp(path, "/dev/msm_camera/", 16))
+        kind = SIM_FD_CONTROL;
+    else if (!strncmp(path, "/dev/pmem", 9))
+        kind = SIM_FD_PMEM;
+    else
+        return -2;
+
+    /* pmem is mapped without PMEM_ALLOCATE; the size costs nothing until
+     * the pages are touched. */
+    int fd = shared_memory(path + 5, kind == SIM_FD_PMEM ? SIM_PMEM_SIZE : 4096);
+    if (fd < 0)
+        return -1;
+
+    pthread_mutex_lock(&sim_lock);
+    for (int i = 0; i < SIM_MAX_FDS; i++) {
+        if (sim_fds[i].kind == SIM_FD_NONE) {
+            sim_fds[i].fd = fd;
+            sim_fds[i].kind = kind;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sim_lock);
+    SIM_LOG("open %s -> %d\n", path, fd);
+    return fd;
+}
+
+static int pmem_ioctl(int fd, ioctl_request_t request, void *arg)
+{
+    struct pmem_region *region = (struct pmem_region *)arg;
+
+    switch (request) {
+    case PMEM_GET_PHYS:
+        region->offset = SIM_PHYS_BASE + fd * SIM_PMEM_SIZE;
+        region->len = SIM_PMEM_SIZE;
+        return 0;
+    case PMEM_GET_SIZE:
+    case PMEM_GET_TOTAL_SIZE:
+        region->offset = 0;
+        region->len = SIM_PMEM_SIZE;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static void register_pmem(const struct msm_pmem_info *info, bool add)
+{
+    pthread_mutex_lock(&sim_lock);
+    for (int i = 0; i < sim_buffer_count; i++) {
+        if (sim_buffers[i].vaddr == info->vaddr &&
+            sim_buffers[i].type == info->type) {
+            sim_buffers[i] = sim_buffers[--sim_buffer_count];
+            break;
+        }
+    }
+    if (add && sim_buffer_count < SIM_MAX_BUFFERS)
+        sim_buffers[sim_buffer_count++] = *info;
+    pthread_mutex_unlock(&sim_lock);
+    SIM_LOG("%sregister pmem type %d %p len %u\n", add ? "" : "un",
+            info->type, info->vaddr, info->len);
+}
+
+/* Copies the registered buffers of one type into out, returns how many. */
+static int find_buffers(int type, struct msm_pmem_info *out, int max)
+{
+    int n = 0;
+
+    pthread_mutex_lock(&sim_lock);
+    for (int i = 0; i < sim_buffer_count && n < max; i++)
+        if (sim_buffers[i].type == type)
+            out[n++] = sim_buffers[i];
+    pthread_mutex_unlock(&sim_lock);
+    return n;
+}
+
+/* Synthetic NV21: a luma ramp that scrolls with phase, grey chroma. */
+static void fill_nv21(uint8_t *base, uint32_t y_off, uint32_t cbcr_off,
+                      uint32_t len, int width, int phase)
+{
+    uint32_t luma = cbcr_off > y_off ? cbcr_off - y_off : len * 2 / 3;
+    uint32_t chroma = luma / 2;
+    int row = width > 0 ? width : (int)luma;
+    int rows = luma / row;
+
+    if (cbcr_off + chroma > len)
+        chroma = cbcr_off < len ? len - cbcr_off : 0;
+    for (int r = 0; r < rows; r++)
+        memset(base + y_off + r * row, (r + phase * 4) & 0xff, row);
+    memset(base + cbcr_off, 128, chroma);
+}
+
+static void fill_histogram(camera_preview_histogram_info *hist, int width,
+                           int height, int phase)
+{
+    memset(hist, 0, sizeof(*hist));
+    for (int r = 0; r < height; r++)
+        hist->buffer[(r + phase * 4) & 0xff] += width;
+    for (int i = 0; i < 256; i++)
+        if (hist->buffer[i] > hist->max_value)
+            hist->max_value = hist->buffer[i];
+}
+
+static void emit_jpeg(uint8_t *out, uint32_t size, const uint8_t *image)
+{
+    memset(out, image ? image[0] : 0x55, size);
+    out[0] = 0xff;
+    out[1] = 0xd8;
+    out[size - 2] = 0xff;
+    out[size - 1] = 0xd9;
+}
+
+static void auto_focus(struct msm_ctrl_cmd *cmd)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    add_ms(&deadline, sim_af_ms);
+
+    pthread_mutex_lock(&sim_lock);
+    sim_af_cancel = false;
+    while (!sim_af_cancel &&
+           pthread_cond_timedwait(&sim_cond, &sim_lock, &deadline) != ETIMEDOUT)
+        ;
+    cmd->status = sim_af_cancel ? CAMERA_EXIT_CB_ABORT : CAMERA_EXIT_CB_DONE;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+static void ctrl_command(struct msm_ctrl_cmd *cmd)
+{
+    SIM_LOG("ctrl %d len %d\n", cmd->type, cmd->length);
+    cmd->status = CAM_CTRL_SUCCESS;
+
+    switch (cmd->type) {
+    case CAMERA_SET_PARM_DIMENSION:
+        if (cmd->value && cmd->length >= sizeof(sim_dimension)) {
+            pthread_mutex_lock(&sim_lock);
+            memcpy(&sim_dimension, cmd->value, sizeof(sim_dimension));
+            pthread_mutex_unlock(&sim_lock);
+        }
+        break;
+    case CAMERA_SET_PARM_AUTO_FOCUS:
+        auto_focus(cmd);
+        break;
+    case CAMERA_AUTO_FOCUS_CANCEL:
+        pthread_mutex_lock(&sim_lock);
+        sim_af_cancel = true;
+        pthread_cond_broadcast(&sim_cond);
+        pthread_mutex_unlock(&sim_lock);
+        break;
+    case CAMERA_GET_PARM_MAXZOOM:
+        if (cmd->value)
+            *(int32_t *)cmd->value = SIM_MAX_ZOOM;
+        break;
+    case CAMERA_GET_PARM_ZOOMRATIOS:
+        if (cmd->value) {
+            int16_t *ratios = (int16_t *)cmd->value;
+            for (int i = 0; i < cmd->length / 2; i++)
+                ratios[i] = 100 + i * 10;
+        }
+        break;
+    case CAMERA_START_VIDEO:
+    case CAMERA_START_RECORDING:
+        sim_recording = true;
+        break;
+    case CAMERA_STOP_VIDEO:
+    case CAMERA_STOP_RECORDING:
+        sim_recording = false;
+        break;
+    case CAMERA_START_LIVESHOT:
+        sim_liveshot_pending = true;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Snapshot: expose, fire the shutter, fill the picture buffers. */
+static void get_picture(struct msm_ctrl_cmd *cmd)
+{
+    struct msm_pmem_info bufs[SIM_MAX_BUFFERS];
+    static const int types[] = {
+        MSM_PMEM_MAINIMG, MSM_PMEM_RAW_MAINIMG, MSM_PMEM_THUMBNAIL
+    };
+
+    sleep_ms(sim_shot_ms);
+    if (mmcamera_shutter_callback)
+        mmcamera_shutter_callback(&sim_crop);
+
+    pthread_mutex_lock(&sim_lock);
+    int picture_width = sim_dimension.picture_width;
+    int thumbnail_width = sim_dimension.ui_thumbnail_width;
+    pthread_mutex_unlock(&sim_lock);
+
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        int n = find_buffers(types[t], bufs, SIM_MAX_BUFFERS);
+        for (int i = 0; i < n; i++)
+            fill_nv21((uint8_t *)bufs[i].vaddr, bufs[i].y_off, bufs[i].cbcr_off,
+                      bufs[i].len, types[t] == MSM_PMEM_THUMBNAIL ?
+                      thumbnail_width : picture_width, 0);
+    }
+
+    if (cmd->value && cmd->length >= sizeof(common_crop_t))
+        memset(cmd->value, 0, sizeof(common_crop_t));
+    cmd->status = CAM_CTRL_SUCCESS;
+}
+
+static int camera_ioctl(int fd, ioctl_request_t request, void *arg)
+{
+    switch (request) {
+    case MSM_CAM_IOCTL_GET_SENSOR_INFO:
+#ifdef CONFIG_FIH_CONFIG_GROUP
+    case MSM_CAM_IOCTL_GET_FIH_SENSOR_INFO:
+#endif
+    {
+        struct msm_camsensor_info *info = (struct msm_camsensor_info *)arg;
+        memset(info, 0, sizeof(*info));
+        strncpy(info->name, "sim", sizeof(info->name) - 1);
+        return 0;
+    }
+    case MSM_CAM_IOCTL_REGISTER_PMEM:
+    case MSM_CAM_IOCTL_UNREGISTER_PMEM:
+        register_pmem((struct msm_pmem_info *)arg,
+                      request == MSM_CAM_IOCTL_REGISTER_PMEM);
+        return 0;
+    case MSM_CAM_IOCTL_CTRL_COMMAND:
+    case MSM_CAM_IOCTL_CTRL_COMMAND_2:
+        ctrl_command((struct msm_ctrl_cmd *)arg);
+        return 0;
+    case MSM_CAM_IOCTL_GET_PICTURE:
+        get_picture((struct msm_ctrl_cmd *)arg);
+        return 0;
+    default:
+        SIM_LOG("ioctl %d: %#lx ignored\n", fd, (unsigned long)request);
+        return 0;
+    }
+}
+
+/* ---- libc interposition ---- */
+
+/* Everything that is not ours goes straight to the kernel, which works
+ * the same under glibc and bionic and needs no RTLD_NEXT. */
+
+extern "C" {
+
+int ioctl(int fd, ioctl_request_t request, ...);
+
+static int sim_open_va(const char *path, int flags, va_list ap)
+{
+    mode_t mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+
+    int fd = sim_open(path);
+    return fd != -2 ? fd : syscall(__NR_openat, AT_FDCWD, path, flags, mode);
+}
+
+int open(const char *path, int flags, ...)
+{
+    va_list ap;
+
+    va_start(ap, flags);
+    int fd = sim_open_va(path, flags, ap);
+    va_end(ap);
+    return fd;
+}
+
+int open64(const char *path, int flags, ...)
+{
+    va_list ap;
+
+    va_start(ap, flags);
+    int fd = sim_open_va(path, flags | O_LARGEFILE, ap);
+    va_end(ap);
+    return fd;
+}
+
+int ioctl(int fd, ioctl_request_t request, ...)
+{
+    va_list ap;
+
+    va_start(ap, request);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+
+    switch (fd_kind(fd)) {
+    case SIM_FD_CONTROL:
+        return camera_ioctl(fd, request, arg);
+    case SIM_FD_PMEM:
+        return pmem_ioctl(fd, request, arg);
+    default:
+        return syscall(__NR_ioctl, fd, request, arg);
+    }
+}
+
+int close(int fd)
+{
+    pthread_mutex_lock(&sim_lock);
+    for (int i = 0; i < SIM_MAX_FDS; i++)
+        if (sim_fds[i].kind != SIM_FD_NONE && sim_fds[i].fd == fd)
+            sim_fds[i].kind = SIM_FD_NONE;
+    pthread_mutex_unlock(&sim_lock);
+
+    return syscall(__NR_close, fd);
+}
+
+/* ---- frame thread ---- */
+
+static struct msm_frame *pop_free_video(void)
+{
+    struct msm_frame *frame = NULL;
+
+    pthread_mutex_lock(&sim_lock);
+    if (sim_free_video_count)
+        frame = sim_free_video[--sim_free_video_count];
+    pthread_mutex_unlock(&sim_lock);
+    return frame;
+}
+
+static void send_liveshot(int phase)
+{
+    sim_liveshot_pending = false;
+    if (!sim_liveshot_buffer || sim_liveshot_size < 4) {
+        if (mmcamera_liveshot_callback)
+            mmcamera_liveshot_callback(LIVESHOT_ENCODE_ERROR, 0);
+        return;
+    }
+    uint32_t size = sim_liveshot_size / 8 > 4 ? sim_liveshot_size / 8 : 4;
+    emit_jpeg(sim_liveshot_buffer, size, (const uint8_t *)&phase);
+    if (mmcamera_liveshot_callback)
+        mmcamera_liveshot_callback(LIVESHOT_SUCCESS, size);
+}
+
+void *cam_frame(void *data)
+{
+    struct cam_frame_start_parms *parms = (struct cam_frame_start_parms *)data;
+    struct msm_pmem_info bufs[SIM_MAX_BUFFERS];
+    camera_preview_histogram_info hist;
+    struct msm_frame frame;
+    struct timespec next;
+    long period_ns = 1000000000L / sim_fps;
+
+    pthread_mutex_lock(&sim_lock);
+    sim_terminate = false;
+    pthread_mutex_unlock(&sim_lock);
+
+    SIM_LOG("cam_frame: %d fps\n", sim_fps);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int n = 0; ; n++) {
+        next.tv_nsec += period_ns;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        pthread_mutex_lock(&sim_lock);
+        bool done = sim_terminate;
+        int width = sim_dimension.display_width;
+        int height = sim_dimension.display_height;
+        int video_width = sim_dimension.video_width;
+        pthread_mutex_unlock(&sim_lock);
+        if (done)
+            break;
+
+        int count = find_buffers(MSM_PMEM_PREVIEW, bufs, SIM_MAX_BUFFERS);
+        if (!count)
+            count = find_buffers(MSM_PMEM_OUTPUT2, bufs, SIM_MAX_BUFFERS);
+
+        memset(&frame, 0, sizeof(frame));
+        if (count) {
+            const struct msm_pmem_info *b = &bufs[n % count];
+            frame.buffer = (unsigned long)b->vaddr;
+            frame.y_off = b->y_off;
+            frame.cbcr_off = b->cbcr_off;
+            frame.fd = b->fd;
+            fill_nv21((uint8_t *)b->vaddr, b->y_off, b->cbcr_off, b->len,
+                      width, n);
+        } else {
+            /* nothing registered yet: just the frame the HAL started with */
+            frame = parms->frame;
+        }
+        frame.path = OUTPUT_TYPE_P;
+        frame.cropinfo = &sim_crop;
+        frame.croplen = sizeof(sim_crop);
+        clock_gettime(CLOCK_MONOTONIC, &frame.ts);
+
+        if (mmcamera_camframe_callback)
+            mmcamera_camframe_callback(&frame);
+
+        if (sim_histogram && mmcamera_camstats_callback) {
+            fill_histogram(&hist, width, height, n);
+            mmcamera_camstats_callback(CAM_STATS_TYPE_HIST, &hist);
+        }
+
+        if (sim_liveshot_pending)
+            send_liveshot(n);
+
+        if (sim_recording && mmcamera_camframe_videocallback) {
+            struct msm_frame *video = pop_free_video();
+            if (video) {
+                uint32_t len = video->cbcr_off + (video->cbcr_off - video->y_off) / 2;
+                fill_nv21((uint8_t *)video->buffer, video->y_off, video->cbcr_off,
+                          len, video_width, n);
+                video->path = OUTPUT_TYPE_V;
+                video->ts = frame.ts;
+                mmcamera_camframe_videocallback(video);
+            }
+        }
+    }
+    SIM_LOG("cam_frame: exit\n");
+    return NULL;
+}
+
+void camframe_terminate(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    sim_terminate = true;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void cam_frame_add_free_video(struct msm_frame *frame)
+{
+    pthread_mutex_lock(&sim_lock);
+    if (sim_free_video_count < SIM_MAX_VIDEO)
+        sim_free_video[sim_free_video_count++] = frame;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void cam_frame_flush_free_video(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    sim_free_video_count = 0;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+/* ---- config thread and mm_camera ---- */
+
+void *cam_conf(void *data)
+{
+    (void)data;
+    return NULL;
+}
+
+int launch_cam_conf_thread(void)
+{
+    return 0;
+}
+
+int release_cam_conf_thread(void)
+{
+    return 0;
+}
+
+static mm_camera_status_t sim_query_parms(mm_camera_parm_type_t parm_type,
+                                          void **pp_values, uint32_t *p_count)
+{
+    (void)parm_type;
+    (void)pp_values;
+    if (p_count)
+        *p_count = 0;
+    return MM_CAMERA_ERR_NOT_SUPPORTED;
+}
+
+static mm_camera_status_t sim_set_parm(mm_camera_parm_type_t parm_type,
+                                       void *p_value)
+{
+    if (parm_type == CAMERA_PARM_HISTOGRAM && p_value)
+        sim_histogram = *(int32_t *)p_value != 0;
+    return MM_CAMERA_SUCCESS;
+}
+
+static mm_camera_status_t sim_get_parm(mm_camera_parm_type_t parm_type,
+                                       void *p_value)
+{
+    (void)parm_type;
+    (void)p_value;
+    return MM_CAMERA_ERR_NOT_SUPPORTED;
+}
+
+static int8_t sim_is_supported(mm_camera_parm_type_t parm_type)
+{
+    return parm_type == CAMERA_PARM_HISTOGRAM;
+}
+
+static int8_t sim_is_parm_supported(mm_camera_parm_type_t parm_type,
+                                    void *sub_parm)
+{
+    (void)sub_parm;
+    return sim_is_supported(parm_type);
+}
+
+mm_camera_status_t mm_camera_config_init(mm_camera_config *cfg)
+{
+    cfg->mm_camera_query_parms = sim_query_parms;
+    cfg->mm_camera_set_parm = sim_set_parm;
+    cfg->mm_camera_get_parm = sim_get_parm;
+    cfg->mm_camera_is_supported = sim_is_supported;
+    cfg->mm_camera_is_parm_supported = sim_is_parm_supported;
+    return MM_CAMERA_SUCCESS;
+}
+
+mm_camera_status_t mm_camera_config_deinit(mm_camera_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    return MM_CAMERA_SUCCESS;
+}
+
+const struct camera_size_type *default_sensor_get_snapshot_sizes(int *len)
+{
+    static const struct camera_size_type sizes[] = {
+        { 2592, 1944 }, { 2048, 1536 }, { 1600, 1200 },
+        { 1280, 960 }, { 640, 480 },
+    };
+
+    *len = sizeof(sizes) / sizeof(sizes[0]);
+    return sizes;
+}
+
+int8_t zoom_crop_upscale(uint32_t width, uint32_t height,
+                         uint32_t cropped_width, uint32_t cropped_height,
+                         uint8_t *img_buf)
+{
+    /* the crop is left where it is; only the call is simulated */
+    (void)width; (void)height;
+    (void)cropped_width; (void)cropped_height; (void)img_buf;
+    return TRUE;
+}
+
+int8_t set_liveshot_params(uint32_t a_width, uint32_t a_height,
+                           exif_tags_info_t *a_exif_data, int a_exif_numEntries,
+                           uint8_t *a_out_buffer, uint32_t a_outbuffer_size)
+{
+    (void)a_width; (void)a_height; (void)a_exif_data; (void)a_exif_numEntries;
+    sim_liveshot_buffer = a_out_buffer;
+    sim_liveshot_size = a_outbuffer_size;
+    return TRUE;
+}
+
+static void sim_cancel_liveshot(void)
+{
+    sim_liveshot_pending = false;
+}
+
+/* ---- JPEG encoder ---- */
+
+bool jpeg_encoder_init(void)
+{
+    return true;
+}
+
+static void *jpeg_thread(void *data)
+{
+    static uint8_t fragment[SIM_FRAGMENT_SIZE];
+    uint32_t left = sim_jpeg.size;
+    (void)data;
+
+    sleep_ms(sim_jpeg.delay_ms);
+    for (bool first = true; left; first = false) {
+        uint32_t n = left < SIM_FRAGMENT_SIZE ? left : SIM_FRAGMENT_SIZE;
+        memset(fragment, sim_jpeg.image ? sim_jpeg.image[0] : 0x55, n);
+        if (first && n >= 2) {
+            fragment[0] = 0xff;
+            fragment[1] = 0xd8;
+        }
+        left -= n;
+        if (!left && n >= 2) {
+            fragment[n - 2] = 0xff;
+            fragment[n - 1] = 0xd9;
+        }
+        if (mmcamera_jpegfragment_callback)
+            mmcamera_jpegfragment_callback(fragment, n);
+    }
+    if (mmcamera_jpeg_callback)
+        mmcamera_jpeg_callback(JPEG_EVENT_DONE);
+    return NULL;
+}
+
+void jpeg_encoder_join(void)
+{
+    if (sim_jpeg_running) {
+        pthread_join(sim_jpeg_thread, NULL);
+        sim_jpeg_running = false;
+    }
+}
+
+bool jpeg_encoder_encode(const cam_ctrl_dimension_t *dimen,
+                         const uint8_t *thumbnailbuf, int thumbnailfd,
+                         const uint8_t *snapshotbuf, int snapshotfd,
+                         common_crop_t *scaling_parms, exif_tags_info_t *exif_data,
+                         int exif_table_numEntries)
+{
+    (void)thumbnailbuf; (void)thumbnailfd; (void)snapshotfd;
+    (void)scaling_parms; (void)exif_data; (void)exif_table_numEntries;
+
+    uint32_t pixels = dimen->orig_picture_dx * dimen->orig_picture_dy;
+    if (!pixels)
+        pixels = dimen->picture_width * dimen->picture_height;
+
+    jpeg_encoder_join();
+    sim_jpeg.size = pixels / 8 > 1024 ? pixels / 8 : 1024;
+    sim_jpeg.image = snapshotbuf;
+    sim_jpeg.delay_ms = (int)((uint64_t)sim_jpeg_ms * pixels / 1000000);
+    sim_jpeg_running = !pthread_create(&sim_jpeg_thread, NULL, jpeg_thread, NULL);
+    return sim_jpeg_running;
+}
+
+int8_t jpeg_encoder_setMainImageQuality(uint32_t quality)
+{
+    (void)quality;
+    return TRUE;
+}
+
+int8_t jpeg_encoder_setThumbnailQuality(uint32_t quality)
+{
+    (void)quality;
+    return TRUE;
+}
+
+int8_t jpeg_encoder_setRotation(uint32_t rotation)
+{
+    (void)rotation;
+    return TRUE;
+}
+
+int8_t jpeg_encoder_get_buffer_offset(uint32_t width, uint32_t height,
+                                      uint32_t *p_y_offset,
+                                      uint32_t *p_cbcr_offset,
+                                      uint32_t *p_buf_size)
+{
+    *p_y_offset = 0;
+    *p_cbcr_offset = width * height;
+    *p_buf_size = width * height * 3 / 2;
+    return TRUE;
+}
+
+int8_t jpeg_encoder_setLocation(const camera_position_type *location)
+{
+    (void)location;
+    return TRUE;
+}
+
+} // extern "C"
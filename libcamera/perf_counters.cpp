@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perf_counters"
+#include <utils/Log.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perf_counters.h"
+
+volatile int32_t perf_counters[PERF_COUNTER_COUNT];
+perf_histogram_data_t perf_histograms[PERF_HISTOGRAM_COUNT];
+
+static const char *const counter_names[PERF_COUNTER_COUNT] = {
+    "preview_received", "preview_displayed", "preview_dropped",
+    "video_delivered", "video_dropped",
+    "record_outstanding", "snapshots", "jpeg_bytes",
+};
+
+static const struct {
+    const char *name;
+    const char *unit;
+} histogram_names[PERF_HISTOGRAM_COUNT] = {
+    { "preview_copy", "us" },
+    { "snapshot_shutter", "us" },
+    { "snapshot_jpeg", "us" },
+    { "jpeg_rate", "kB/s" },
+};
+
+static int bucket_of(uint32_t value)
+{
+    int b = value ? 32 - __builtin_clz(value) : 0;
+    return b < PERF_HISTOGRAM_BUCKETS ? b : PERF_HISTOGRAM_BUCKETS - 1;
+}
+
+/* Bucket b holds [2^(b-1), 2^b), bucket 0 holds 0. */
+static uint32_t bucket_limit(int b)
+{
+    return b ? (1u << b) - 1 : 0;
+}
+
+void perf_record(int histogram, uint32_t value)
+{
+    perf_histogram_data_t *h = &perf_histograms[histogram];
+    uint32_t max = h->max;
+
+    __sync_fetch_and_add(&h->count, 1);
+    __sync_fetch_and_add(&h->sum, value);
+    __sync_fetch_and_add(&h->buckets[bucket_of(value)], 1);
+    while (value > max) {
+        uint32_t seen = __sync_val_compare_and_swap(&h->max, max, value);
+        if (seen == max)
+            break;
+        max = seen;
+    }
+}
+
+void perf_counters_reset(void)
+{
+    LOGI("resetting performance counters");
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (i != PERF_RECORD_OUTSTANDING)
+            __sync_lock_test_and_set(&perf_counters[i], 0);
+    }
+    for (int i = 0; i < PERF_HISTOGRAM_COUNT; i++) {
+        perf_histogram_data_t *h = &perf_histograms[i];
+        __sync_lock_test_and_set(&h->count, 0);
+        __sync_lock_test_and_set(&h->sum, 0);
+        __sync_lock_test_and_set(&h->max, 0);
+        for (int b = 0; b < PERF_HISTOGRAM_BUCKETS; b++)
+            __sync_lock_test_and_set(&h->buckets[b], 0);
+    }
+}
+
+/* Upper bound of the bucket holding the given rank, from a snapshot
+ * of the buckets; at most the recorded max. */
+static uint32_t percentile(const uint32_t *buckets, uint32_t count,
+                           uint32_t max, int pct)
+{
+    uint32_t rank = ((uint64_t)count * pct + 99) / 100;
+    uint32_t seen = 0;
+
+    for (int b = 0; b < PERF_HISTOGRAM_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            uint32_t limit = bucket_limit(b);
+            return limit < max ? limit : max;
+        }
+    }
+    return max;
+}
+
+void perf_counters_dump(int fd)
+{
+    char buffer[256];
+    int len;
+
+    write(fd, "performance counters:\n", 22);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        len = snprintf(buffer, sizeof(buffer), "  %-20s %d\n",
+                       counter_names[i], perf_counters[i]);
+        write(fd, buffer, len);
+    }
+
+    for (int i = 0; i < PERF_HISTOGRAM_COUNT; i++) {
+        const perf_histogram_data_t *h = &perf_histograms[i];
+        uint32_t buckets[PERF_HISTOGRAM_BUCKETS];
+
+        // not an atomic snapshot; a racing update skews one line slightly
+        uint32_t count = h->count;
+        uint32_t sum = h->sum;
+        uint32_t max = h->max;
+        for (int b = 0; b < PERF_HISTOGRAM_BUCKETS; b++)
+            buckets[b] = h->buckets[b];
+
+        len = snprintf(buffer, sizeof(buffer),
+                       "  %-20s count %u avg %u p50 %u p99 %u max %u %s\n",
+                       histogram_names[i].name, count,
+                       count ? sum / count : 0,
+                       percentile(buckets, count, max, 50),
+                       percentile(buckets, count, max, 99),
+                       max, histogram_names[i].unit);
+        write(fd, buffer, len);
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_PERF_COUNTERS_H
+#define ANDROID_HARDWARE_PERF_COUNTERS_H
+
+#include <stdint.h>
+
+/*
+ * Always-on performance counters for the camera paths, kept by the HAL
+ * wrapper from what it sees of the prebuilt HAL's callbacks.
+ *
+ * A fixed registry of counters and latency histograms, indexed by the
+ * enums below, so a hot path pays one atomic add per update and no
+ * lookup. Histograms keep power-of-two buckets in microseconds plus
+ * count, sum and max; percentiles in the dump are bucket upper bounds.
+ * perf_counters_dump() renders everything for dumpsys media.camera,
+ * CAMERA_CMD_RESET_PERF_COUNTERS through sendCommand() zeroes it; the
+ * wrapper handles that command itself.
+ */
+
+/* vendor command, clear of the framework and histogram commands */
+#define CAMERA_CMD_RESET_PERF_COUNTERS 1000
+
+#define PERF_HISTOGRAM_BUCKETS 24   /* last bucket holds 2^22 us and up */
+
+enum perf_counter {
+    PERF_PREVIEW_RECEIVED,      /* frames handed to the queue buffer hook */
+    PERF_PREVIEW_DISPLAYED,
+    PERF_PREVIEW_DROPPED,
+    PERF_VIDEO_DELIVERED,       /* frames given to the encoder */
+    PERF_VIDEO_DROPPED,
+    PERF_RECORD_OUTSTANDING,    /* gauge: frames the encoder still holds */
+    PERF_SNAPSHOTS,
+    PERF_JPEG_BYTES,            /* compressed image sizes */
+    PERF_COUNTER_COUNT
+};
+
+enum perf_histogram {
+    PERF_PREVIEW_COPY,          /* queue buffer hook, copy or hand-off */
+    PERF_SNAPSHOT_SHUTTER,      /* takePicture to shutter */
+    PERF_SNAPSHOT_JPEG,         /* takePicture to compressed image */
+    PERF_JPEG_RATE,             /* JPEG size over takePicture to JPEG, kB/s */
+    PERF_HISTOGRAM_COUNT
+};
+
+typedef struct perf_histogram_data {
+    volatile uint32_t count;
+    volatile uint32_t sum;      /* us, wraps after ~71 minutes */
+    volatile uint32_t max;
+    volatile uint32_t buckets[PERF_HISTOGRAM_BUCKETS];
+} perf_histogram_data_t;
+
+extern volatile int32_t perf_counters[PERF_COUNTER_COUNT];
+extern perf_histogram_data_t perf_histograms[PERF_HISTOGRAM_COUNT];
+
+static inline void perf_count(int counter, int32_t n)
+{
+    __sync_fetch_and_add(&perf_counters[counter], n);
+}
+
+void perf_record(int histogram, uint32_t value);
+
+/* Records the time since start, both in ns as from systemTime(). */
+static inline void perf_record_since(int histogram, int64_t start, int64_t now)
+{
+    perf_record(histogram, (uint32_t)((now - start) / 1000));
+}
+
+/* Zeroes every counter and histogram except gauges. */
+void perf_counters_reset(void);
+
+void perf_counters_dump(int fd);
+
+#endif // ANDROID_HARDWARE_PERF_COUNTERS_H
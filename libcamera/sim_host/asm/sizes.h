@@ -0,0 +1 @@
+/* Host build of msm_camera.h: the kernel's asm/sizes.h is not needed. */
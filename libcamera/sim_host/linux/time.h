@@ -0,0 +1,4 @@
+/* Host build of msm_camera.h: linux/time.h clashes with glibc's, which
+ * already has struct timespec and struct timeval. */
+#include <time.h>
+#include <sys/time.h>
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SPSC_RING_H
+#define ANDROID_HARDWARE_SPSC_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/*
+ * Fixed capacity single-producer/single-consumer ring of word sized
+ * entries (buffer indices or frame pointers). Push and pop never block
+ * and never allocate; the only shared writes are the producer's head
+ * and the consumer's tail. An eventfd lets the consumer sleep while the
+ * ring is empty; spsc_ring_wake() also unblocks it for shutdown.
+ * The slot array is a power of two, but the ring never holds more than
+ * the capacity it was initialised with.
+ */
+
+#define SPSC_RING_MAX 16    /* power of two */
+
+struct spsc_ring {
+    volatile uint32_t head;         /* next slot to fill, producer owned */
+    volatile uint32_t tail;         /* next slot to drain, consumer owned */
+    uint32_t mask;
+    int efd;
+    uint32_t capacity;              /* at most mask + 1 */
+    intptr_t slots[SPSC_RING_MAX];
+};
+
+/* capacity is exact, at most SPSC_RING_MAX */
+static inline bool spsc_ring_init(struct spsc_ring *r, unsigned int capacity)
+{
+    unsigned int size = 1;
+
+    if (capacity > SPSC_RING_MAX)
+        capacity = SPSC_RING_MAX;
+    while (size < capacity)
+        size <<= 1;
+    r->head = 0;
+    r->tail = 0;
+    r->mask = size - 1;
+    r->capacity = capacity;
+    r->efd = eventfd(0, 0);
+    return r->efd >= 0;
+}
+
+static inline void spsc_ring_destroy(struct spsc_ring *r)
+{
+    if (r->efd >= 0)
+        close(r->efd);
+    r->efd = -1;
+}
+
+static inline unsigned int spsc_ring_count(const struct spsc_ring *r)
+{
+    return r->head - r->tail;
+}
+
+static inline void spsc_ring_wake(struct spsc_ring *r)
+{
+    uint64_t one = 1;
+    write(r->efd, &one, sizeof(one));
+}
+
+/* Producer side. Returns false, leaving the ring untouched, when full. */
+static inline bool spsc_ring_push(struct spsc_ring *r, intptr_t value)
+{
+    uint32_t head = r->head;
+
+    if (head - r->tail >= r->capacity)
+        return false;
+    r->slots[head & r->mask] = value;
+    __sync_synchronize();   /* publish the slot before the new head */
+    r->head = head + 1;
+    spsc_ring_wake(r);
+    return true;
+}
+
+/* Consumer side. Returns false when the ring is empty. */
+static inline bool spsc_ring_pop(struct spsc_ring *r, intptr_t *value)
+{
+    uint32_t tail = r->tail;
+
+    if (tail == r->head)
+        return false;
+    __sync_synchronize();   /* read the slot only after seeing the head */
+    *value = r->slots[tail & r->mask];
+    __sync_synchronize();   /* finish reading before releasing the slot */
+    r->tail = tail + 1;
+    return true;
+}
+
+/* Consumer side. Sleep until something was pushed or spsc_ring_wake()
+ * was called; callers re-check their exit condition and the ring. */
+static inline void spsc_ring_wait(struct spsc_ring *r)
+{
+    uint64_t count;
+
+    if (spsc_ring_count(r))
+        return;
+    read(r->efd, &count, sizeof(count));
+}
+
+#endif // ANDROID_HARDWARE_SPSC_RING_H
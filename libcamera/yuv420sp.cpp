@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "yuv420sp.h"
+
+#ifdef YUV420SP_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+void yuv420sp_init(yuv420sp_image_t *img, void *base,
+                   int width, int height, int y_stride, int cbcr_offset)
+{
+    img->y = (uint8_t *)base;
+    img->uv = (uint8_t *)base + cbcr_offset;
+    img->y_stride = y_stride;
+    img->uv_stride = y_stride;
+    img->width = width;
+    img->height = height;
+}
+
+/* View of the centered dst-sized window of src, offsets kept even so the
+ * chroma pairs stay aligned. */
+static void center_window(yuv420sp_image_t *win, const yuv420sp_image_t *dst,
+                          const yuv420sp_image_t *src)
+{
+    int x = ((src->width - dst->width) / 2) & ~1;
+    int y = ((src->height - dst->height) / 2) & ~1;
+
+    *win = *src;
+    win->y = src->y + y * src->y_stride + x;
+    win->uv = src->uv + (y / 2) * src->uv_stride + x;
+    win->width = dst->width;
+    win->height = dst->height;
+}
+
+/*******************************************************************
+ * in-place moves, shared by the scalar and NEON versions
+ *******************************************************************/
+
+/* Moves n bytes from s to d, d <= s; may overlap. */
+typedef void (*move_row_fn)(uint8_t *d, const uint8_t *s, int n);
+
+/*
+ * Move the rows of one plane within a buffer. Destination rows are no
+ * further apart than source rows, so dst - src shrinks row by row: rows
+ * past the point where dst drops to src go forwards with forward(), the
+ * ones before it backwards with memmove(). No row is overwritten before
+ * it has been read.
+ */
+static void move_plane(uint8_t *dst, int dst_stride, const uint8_t *src,
+                       int src_stride, int width, int rows, move_row_fn forward)
+{
+    int first = -1;
+    int i;
+
+    if (dst > src) {
+        first = rows - 1;
+        if (src_stride > dst_stride)
+            first = (dst - src) / (src_stride - dst_stride);
+        if (first > rows - 1)
+            first = rows - 1;
+    }
+    for (i = first + 1; i < rows; i++)
+        forward(dst + i * dst_stride, src + i * src_stride, width);
+    for (i = first; i >= 0; i--)
+        memmove(dst + i * dst_stride, src + i * src_stride, width);
+}
+
+/* True if f(k) = base + k * step >= 0 for k in [0, n). */
+static bool linear_nonneg(intptr_t base, intptr_t step, int n)
+{
+    return base >= 0 && base + (n - 1) * step >= 0;
+}
+
+/*
+ * The fused pass moves luma rows 2k and 2k + 1, then chroma row k, all
+ * forwards. That is safe when both planes only move down and neither
+ * plane's writes reach source rows of the other that are still unread:
+ * chroma row k must end before luma row 2k + 2 or lie past the whole
+ * source luma, and luma row 2k + 1 must end before chroma row k.
+ */
+static bool fused_forward_ok(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    intptr_t dy = (intptr_t)dst->y, sy = (intptr_t)src->y;
+    intptr_t duv = (intptr_t)dst->uv, suv = (intptr_t)src->uv;
+    int rows = dst->height / 2;
+
+    if (dst->height & 1 || dy > sy || duv > suv)
+        return false;
+    if (!linear_nonneg(sy + 2 * src->y_stride - duv - dst->width,
+                       2 * src->y_stride - dst->uv_stride, rows) &&
+        duv < sy + src->height * src->y_stride)
+        return false;
+    return linear_nonneg(suv - dy - dst->y_stride - dst->width,
+                         src->uv_stride - 2 * dst->y_stride, rows);
+}
+
+static void move_image(const yuv420sp_image_t *dst, const yuv420sp_image_t *src,
+                       move_row_fn forward)
+{
+    int k;
+
+    if (fused_forward_ok(dst, src)) {
+        for (k = 0; k < dst->height / 2; k++) {
+            forward(dst->y + 2 * k * dst->y_stride,
+                    src->y + 2 * k * src->y_stride, dst->width);
+            forward(dst->y + (2 * k + 1) * dst->y_stride,
+                    src->y + (2 * k + 1) * src->y_stride, dst->width);
+            forward(dst->uv + k * dst->uv_stride,
+                    src->uv + k * src->uv_stride, dst->width);
+        }
+        return;
+    }
+
+    move_plane(dst->y, dst->y_stride, src->y, src->y_stride,
+               dst->width, dst->height, forward);
+    move_plane(dst->uv, dst->uv_stride, src->uv, src->uv_stride,
+               dst->width, dst->height / 2, forward);
+}
+
+/*******************************************************************
+ * scalar reference
+ *******************************************************************/
+
+void yuv420sp_copy_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    int i;
+
+    if (dst->y_stride == src->y_stride && dst->y_stride == dst->width &&
+        dst->uv_stride == src->uv_stride && dst->uv_stride == dst->width) {
+        memcpy(dst->y, src->y, dst->width * dst->height);
+        memcpy(dst->uv, src->uv, dst->width * dst->height / 2);
+        return;
+    }
+
+    for (i = 0; i < dst->height; i++)
+        memcpy(dst->y + i * dst->y_stride, src->y + i * src->y_stride, dst->width);
+    for (i = 0; i < dst->height / 2; i++)
+        memcpy(dst->uv + i * dst->uv_stride, src->uv + i * src->uv_stride, dst->width);
+}
+
+void yuv420sp_crop_center_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    yuv420sp_image_t win;
+
+    center_window(&win, dst, src);
+    yuv420sp_copy_c(dst, &win);
+}
+
+void yuv420sp_swap_uv_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    int i, j;
+
+    for (i = 0; i < dst->height; i++)
+        memcpy(dst->y + i * dst->y_stride, src->y + i * src->y_stride, dst->width);
+
+    for (i = 0; i < dst->height / 2; i++) {
+        const uint8_t *s = src->uv + i * src->uv_stride;
+        uint8_t *d = dst->uv + i * dst->uv_stride;
+        for (j = 0; j < dst->width; j += 2) {
+            uint8_t c0 = s[j];
+            d[j] = s[j + 1];
+            d[j + 1] = c0;
+        }
+    }
+}
+
+void yuv420sp_downscale_2x_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    int i, j;
+
+    for (i = 0; i < dst->height; i++) {
+        const uint8_t *s0 = src->y + (2 * i) * src->y_stride;
+        const uint8_t *s1 = s0 + src->y_stride;
+        uint8_t *d = dst->y + i * dst->y_stride;
+        for (j = 0; j < dst->width; j++)
+            d[j] = (s0[2 * j] + s0[2 * j + 1] + s1[2 * j] + s1[2 * j + 1] + 2) >> 2;
+    }
+
+    for (i = 0; i < dst->height / 2; i++) {
+        const uint8_t *s0 = src->uv + (2 * i) * src->uv_stride;
+        const uint8_t *s1 = s0 + src->uv_stride;
+        uint8_t *d = dst->uv + i * dst->uv_stride;
+        for (j = 0; j < dst->width; j += 2) {
+            /* chroma pairs at 2j and 2j + 2 in the source row */
+            d[j] = (s0[2 * j] + s0[2 * j + 2] + s1[2 * j] + s1[2 * j + 2] + 2) >> 2;
+            d[j + 1] = (s0[2 * j + 1] + s0[2 * j + 3] +
+                        s1[2 * j + 1] + s1[2 * j + 3] + 2) >> 2;
+        }
+    }
+}
+
+static void memmove_row(uint8_t *d, const uint8_t *s, int n)
+{
+    memmove(d, s, n);
+}
+
+void yuv420sp_move_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    move_image(dst, src, memmove_row);
+}
+
+void yuv420sp_scale_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    /* 16.16 source steps; chroma samples in pairs, so every other pixel */
+    uint32_t dx = ((uint32_t)src->width << 16) / dst->width;
+    uint32_t dy = ((uint32_t)src->height << 16) / dst->height;
+    uint32_t sy;
+    int i, j;
+
+    for (i = 0, sy = 0; i < dst->height; i++, sy += dy) {
+        const uint8_t *s = src->y + (sy >> 16) * src->y_stride;
+        uint8_t *d = dst->y + i * dst->y_stride;
+        uint32_t sx = 0;
+        for (j = 0; j < dst->width; j++, sx += dx)
+            d[j] = s[sx >> 16];
+    }
+
+    for (i = 0, sy = 0; i < dst->height / 2; i++, sy += dy) {
+        const uint8_t *s = src->uv + (sy >> 16) * src->uv_stride;
+        uint8_t *d = dst->uv + i * dst->uv_stride;
+        uint32_t sx = 0;
+        for (j = 0; j < dst->width; j += 2, sx += 2 * dx) {
+            const uint8_t *pair = s + ((sx >> 16) & ~1);
+            d[j] = pair[0];
+            d[j + 1] = pair[1];
+        }
+    }
+}
+
+/*******************************************************************
+ * NEON
+ *******************************************************************/
+
+#ifdef YUV420SP_HAVE_NEON
+
+static inline void copy_row_neon(uint8_t *d, const uint8_t *s, int n)
+{
+    while (n >= 64) {
+        uint8x16_t a = vld1q_u8(s);
+        uint8x16_t b = vld1q_u8(s + 16);
+        uint8x16_t c = vld1q_u8(s + 32);
+        uint8x16_t e = vld1q_u8(s + 48);
+        __builtin_prefetch(s + 256);
+        vst1q_u8(d, a);
+        vst1q_u8(d + 16, b);
+        vst1q_u8(d + 32, c);
+        vst1q_u8(d + 48, e);
+        s += 64;
+        d += 64;
+        n -= 64;
+    }
+    while (n >= 16) {
+        vst1q_u8(d, vld1q_u8(s));
+        s += 16;
+        d += 16;
+        n -= 16;
+    }
+    if (n)
+        memcpy(d, s, n);
+}
+
+/* copy_row_neon() that tolerates overlap with d <= s: every block is
+ * loaded before it is stored, so stores only reach bytes already read. */
+static void move_row_neon(uint8_t *d, const uint8_t *s, int n)
+{
+    while (n >= 64) {
+        uint8x16_t a = vld1q_u8(s);
+        uint8x16_t b = vld1q_u8(s + 16);
+        uint8x16_t c = vld1q_u8(s + 32);
+        uint8x16_t e = vld1q_u8(s + 48);
+        __builtin_prefetch(s + 256);
+        vst1q_u8(d, a);
+        vst1q_u8(d + 16, b);
+        vst1q_u8(d + 32, c);
+        vst1q_u8(d + 48, e);
+        s += 64;
+        d += 64;
+        n -= 64;
+    }
+    while (n >= 16) {
+        vst1q_u8(d, vld1q_u8(s));
+        s += 16;
+        d += 16;
+        n -= 16;
+    }
+    if (n)
+        memmove(d, s, n);
+}
+
+void yuv420sp_move_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    move_image(dst, src, move_row_neon);
+}
+
+void yuv420sp_copy_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    int i;
+
+    for (i = 0; i < dst->height; i++)
+        copy_row_neon(dst->y + i * dst->y_stride, src->y + i * src->y_stride, dst->width);
+    for (i = 0; i < dst->height / 2; i++)
+        copy_row_neon(dst->uv + i * dst->uv_stride, src->uv + i * src->uv_stride, dst->width);
+}
+
+void yuv420sp_crop_center_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    yuv420sp_image_t win;
+
+    center_window(&win, dst, src);
+    yuv420sp_copy_neon(dst, &win);
+}
+
+void yuv420sp_swap_uv_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    int i, j;
+
+    for (i = 0; i < dst->height; i++)
+        copy_row_neon(dst->y + i * dst->y_stride, src->y + i * src->y_stride, dst->width);
+
+    for (i = 0; i < dst->height / 2; i++) {
+        const uint8_t *s = src->uv + i * src->uv_stride;
+        uint8_t *d = dst->uv + i * dst->uv_stride;
+        for (j = 0; j + 32 <= dst->width; j += 32) {
+            uint8x16x2_t c = vld2q_u8(s + j);
+            uint8x16_t t = c.val[0];
+            c.val[0] = c.val[1];
+            c.val[1] = t;
+            vst2q_u8(d + j, c);
+        }
+        for (; j < dst->width; j += 2) {
+            uint8_t c0 = s[j];
+            d[j] = s[j + 1];
+            d[j + 1] = c0;
+        }
+    }
+}
+
+void yuv420sp_downscale_2x_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    int i, j;
+
+    for (i = 0; i < dst->height; i++) {
+        const uint8_t *s0 = src->y + (2 * i) * src->y_stride;
+        const uint8_t *s1 = s0 + src->y_stride;
+        uint8_t *d = dst->y + i * dst->y_stride;
+        for (j = 0; j + 8 <= dst->width; j += 8) {
+            uint16x8_t sum = vpaddlq_u8(vld1q_u8(s0 + 2 * j));
+            sum = vpadalq_u8(sum, vld1q_u8(s1 + 2 * j));
+            vst1_u8(d + j, vrshrn_n_u16(sum, 2));
+        }
+        for (; j < dst->width; j++)
+            d[j] = (s0[2 * j] + s0[2 * j + 1] + s1[2 * j] + s1[2 * j + 1] + 2) >> 2;
+    }
+
+    for (i = 0; i < dst->height / 2; i++) {
+        const uint8_t *s0 = src->uv + (2 * i) * src->uv_stride;
+        const uint8_t *s1 = s0 + src->uv_stride;
+        uint8_t *d = dst->uv + i * dst->uv_stride;
+        for (j = 0; j + 16 <= dst->width; j += 16) {
+            uint8x16x2_t r0 = vld2q_u8(s0 + 2 * j);
+            uint8x16x2_t r1 = vld2q_u8(s1 + 2 * j);
+            uint16x8_t c0 = vpadalq_u8(vpaddlq_u8(r0.val[0]), r1.val[0]);
+            uint16x8_t c1 = vpadalq_u8(vpaddlq_u8(r0.val[1]), r1.val[1]);
+            uint8x8x2_t out;
+            out.val[0] = vrshrn_n_u16(c0, 2);
+            out.val[1] = vrshrn_n_u16(c1, 2);
+            vst2_u8(d + j, out);
+        }
+        for (; j < dst->width; j += 2) {
+            d[j] = (s0[2 * j] + s0[2 * j + 2] + s1[2 * j] + s1[2 * j + 2] + 2) >> 2;
+            d[j + 1] = (s0[2 * j + 1] + s0[2 * j + 3] +
+                        s1[2 * j + 1] + s1[2 * j + 3] + 2) >> 2;
+        }
+    }
+}
+
+#endif // YUV420SP_HAVE_NEON
+
+/*******************************************************************
+ * dispatch
+ *******************************************************************/
+
+#ifdef YUV420SP_HAVE_NEON
+#define YUV420SP_KERNEL(name) name##_neon
+#else
+#define YUV420SP_KERNEL(name) name##_c
+#endif
+
+void yuv420sp_copy(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    YUV420SP_KERNEL(yuv420sp_copy)(dst, src);
+}
+
+void yuv420sp_crop_center(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    YUV420SP_KERNEL(yuv420sp_crop_center)(dst, src);
+}
+
+void yuv420sp_swap_uv(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    YUV420SP_KERNEL(yuv420sp_swap_uv)(dst, src);
+}
+
+void yuv420sp_downscale_2x(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    YUV420SP_KERNEL(yuv420sp_downscale_2x)(dst, src);
+}
+
+void yuv420sp_move(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    YUV420SP_KERNEL(yuv420sp_move)(dst, src);
+}
+
+void yuv420sp_scale(const yuv420sp_image_t *dst, const yuv420sp_image_t *src)
+{
+    yuv420sp_scale_c(dst, src);
+}
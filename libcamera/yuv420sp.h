@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_YUV420SP_H
+#define ANDROID_HARDWARE_YUV420SP_H
+
+#include <stdint.h>
+
+/*
+ * Pixel move kernels for YUV420 semi-planar frames (NV21/NV12), as
+ * produced by the VFE for preview, video and snapshot.
+ *
+ * Each kernel has a scalar reference (_c) and, when built with
+ * USE_NEON_CONVERSION on a NEON capable CPU, a NEON version (_neon).
+ * The unsuffixed entry points pick the fastest one available.
+ */
+
+#if defined(USE_NEON_CONVERSION) && defined(__ARM_NEON__)
+#define YUV420SP_HAVE_NEON 1
+#endif
+
+typedef struct yuv420sp_image {
+    uint8_t *y;         /* luma plane */
+    uint8_t *uv;        /* interleaved chroma plane, height / 2 rows */
+    int y_stride;       /* bytes between luma rows */
+    int uv_stride;      /* bytes between chroma rows */
+    int width;          /* visible pixels per row, even */
+    int height;         /* visible rows, even */
+} yuv420sp_image_t;
+
+/* Describe a contiguous frame: luma rows of y_stride bytes followed by
+ * the chroma plane at cbcr_offset (use y_stride * height if unpadded). */
+void yuv420sp_init(yuv420sp_image_t *img, void *base,
+                   int width, int height, int y_stride, int cbcr_offset);
+
+/* Copy the visible area of src into dst (sizes must match). */
+void yuv420sp_copy(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_copy_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+
+/* Copy the centered dst->width x dst->height window of src into dst. */
+void yuv420sp_crop_center(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_crop_center_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+
+/* Copy src into dst swapping the chroma order (NV21 <-> NV12). */
+void yuv420sp_swap_uv(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_swap_uv_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+
+/* Halve src into dst with a rounded 2x2 box filter. dst must be exactly
+ * half the size of src, and src dimensions multiples of 4. */
+void yuv420sp_downscale_2x(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_downscale_2x_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+
+/* Copy src into dst where both are windows of the same buffer and may
+ * overlap, as when cropping a frame in place. Sizes must match, dst
+ * strides must not exceed src strides, and the dst luma must not reach
+ * the src chroma. Luma and chroma move in one pass when the layout
+ * allows it, otherwise plane by plane. */
+void yuv420sp_move(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_move_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+
+/* Resize src into dst with nearest neighbour sampling, any sizes. Only
+ * the scalar version exists; it is the fallback for zoom ratios the
+ * other kernels do not cover. */
+void yuv420sp_scale(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_scale_c(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+
+#ifdef YUV420SP_HAVE_NEON
+void yuv420sp_copy_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_crop_center_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_swap_uv_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_downscale_2x_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+void yuv420sp_move_neon(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+#endif
+
+#endif // ANDROID_HARDWARE_YUV420SP_H
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Correctness and throughput check for the yuv420sp kernels.
+ *
+ *   yuv420sp_bench [width height [iterations]]
+ *
+ * Every kernel's dispatched version is compared byte for byte with its
+ * scalar reference on a padded, strided frame, then both are timed. On a
+ * host build both columns use the scalar path; on the device the fast
+ * column is NEON. The in-place crops move a centered window of a packed
+ * frame to its start, as the snapshot zoom does; both versions are checked
+ * against an out-of-place scalar crop of an untouched copy. Exits non-zero
+ * on any mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "yuv420sp.h"
+
+typedef void (*kernel_t)(const yuv420sp_image_t *dst, const yuv420sp_image_t *src);
+
+static const struct {
+    const char *name;
+    kernel_t ref;
+    kernel_t fast;
+    int dst_shift;      /* dst is src >> dst_shift */
+    int dst_crop;       /* dst is a centered crop of src */
+} kernels[] = {
+    { "copy",         yuv420sp_copy_c,         yuv420sp_copy,         0, 0 },
+    { "crop_center",  yuv420sp_crop_center_c,  yuv420sp_crop_center,  0, 1 },
+    { "swap_uv",      yuv420sp_swap_uv_c,      yuv420sp_swap_uv,      0, 0 },
+    { "downscale_2x", yuv420sp_downscale_2x_c, yuv420sp_downscale_2x, 1, 0 },
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Allocate a frame with stride padding so stride handling is exercised. */
+static uint8_t *alloc_image(yuv420sp_image_t *img, int width, int height, int pad)
+{
+    int stride = width + pad;
+    int cbcr_offset = stride * height;
+    uint8_t *base = (uint8_t *)malloc(cbcr_offset + stride * height / 2);
+
+    yuv420sp_init(img, base, width, height, stride, cbcr_offset);
+    return base;
+}
+
+static bool same_image(const yuv420sp_image_t *a, const yuv420sp_image_t *b)
+{
+    int i;
+
+    for (i = 0; i < a->height; i++)
+        if (memcmp(a->y + i * a->y_stride, b->y + i * b->y_stride, a->width))
+            return false;
+    for (i = 0; i < a->height / 2; i++)
+        if (memcmp(a->uv + i * a->uv_stride, b->uv + i * b->uv_stride, a->width))
+            return false;
+    return true;
+}
+
+/* Packed frame in base and the centered crop_w x crop_h window of it that
+ * an in-place crop moves to the start of base. */
+static void inplace_images(yuv420sp_image_t *dst, yuv420sp_image_t *src,
+                           uint8_t *base, int width, int height,
+                           int crop_w, int crop_h)
+{
+    int x = ((width - crop_w) / 2) & ~1;
+    int y = ((height - crop_h) / 2) & ~1;
+
+    yuv420sp_init(src, base, width, height, width, width * height);
+    src->y += y * width + x;
+    src->uv += (y / 2) * width + x;
+    src->width = crop_w;
+    src->height = crop_h;
+    yuv420sp_init(dst, base, crop_w, crop_h, crop_w, crop_w * crop_h);
+}
+
+static double run(kernel_t k, const yuv420sp_image_t *dst,
+                  const yuv420sp_image_t *src, int iterations)
+{
+    double start = now_ms();
+    for (int i = 0; i < iterations; i++)
+        k(dst, src);
+    return (now_ms() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    int width = 800, height = 480, iterations = 200;
+    int failures = 0;
+
+    if (argc >= 3) {
+        width = atoi(argv[1]) & ~3;
+        height = atoi(argv[2]) & ~3;
+    }
+    if (argc >= 4)
+        iterations = atoi(argv[3]);
+    if (width <= 0 || height <= 0 || iterations <= 0) {
+        fprintf(stderr, "usage: %s [width height [iterations]]\n", argv[0]);
+        return 2;
+    }
+
+    yuv420sp_image_t src;
+    uint8_t *src_base = alloc_image(&src, width, height, 40);
+    srand(1);
+    for (int i = 0; i < src.y_stride * height * 3 / 2; i++)
+        src_base[i] = rand();
+
+#ifdef YUV420SP_HAVE_NEON
+    printf("# yuv420sp kernels %dx%d, %d iterations, fast path: neon\n",
+           width, height, iterations);
+#else
+    printf("# yuv420sp kernels %dx%d, %d iterations, fast path: scalar\n",
+           width, height, iterations);
+#endif
+    printf("%-14s %8s %10s %10s %10s %10s\n",
+           "kernel", "match", "ref_ms", "fast_ms", "ref_MB/s", "fast_MB/s");
+
+    for (size_t n = 0; n < sizeof(kernels) / sizeof(kernels[0]); n++) {
+        int dw = width >> kernels[n].dst_shift;
+        int dh = height >> kernels[n].dst_shift;
+        if (kernels[n].dst_crop) {
+            dw = (width * 3 / 4) & ~1;
+            dh = (height * 3 / 4) & ~1;
+        }
+
+        yuv420sp_image_t ref, fast;
+        uint8_t *ref_base = alloc_image(&ref, dw, dh, 24);
+        uint8_t *fast_base = alloc_image(&fast, dw, dh, 24);
+        memset(ref_base, 0, ref.y_stride * dh * 3 / 2);
+        memset(fast_base, 0xff, fast.y_stride * dh * 3 / 2);
+
+        kernels[n].ref(&ref, &src);
+        kernels[n].fast(&fast, &src);
+        bool match = same_image(&ref, &fast);
+        if (!match)
+            failures++;
+
+        double ref_ms = run(kernels[n].ref, &ref, &src, iterations);
+        double fast_ms = run(kernels[n].fast, &fast, &src, iterations);
+        /* bytes written per call, visible area only */
+        double mb = dw * dh * 3 / 2 / (1024.0 * 1024.0);
+
+        printf("%-14s %8s %10.3f %10.3f %10.1f %10.1f\n",
+               kernels[n].name, match ? "ok" : "FAIL", ref_ms, fast_ms,
+               mb * 1000.0 / ref_ms, mb * 1000.0 / fast_ms);
+
+        free(ref_base);
+        free(fast_base);
+    }
+
+    /* in-place crops: slight zoom moves plane by plane, 2x zoom fused */
+    static const struct {
+        const char *name;
+        int num, den;   /* crop size is num / den of the frame */
+    } crops[] = {
+        { "move_9/10",  9, 10 },
+        { "move_1/2",   1, 2 },
+    };
+    size_t frame = width * height * 3 / 2;
+    uint8_t *ref_base = (uint8_t *)malloc(frame);
+    uint8_t *fast_base = (uint8_t *)malloc(frame);
+    uint8_t *expect_base = (uint8_t *)malloc(frame);
+    yuv420sp_image_t packed;
+    yuv420sp_init(&packed, src_base, width, height, width, width * height);
+    for (size_t n = 0; n < sizeof(crops) / sizeof(crops[0]); n++) {
+        int cw = (width * crops[n].num / crops[n].den) & ~1;
+        int ch = (height * crops[n].num / crops[n].den) & ~1;
+        size_t size = cw * ch * 3 / 2;
+        yuv420sp_image_t ref_dst, ref_src, fast_dst, fast_src, expect;
+
+        yuv420sp_init(&expect, expect_base, cw, ch, cw, cw * ch);
+        yuv420sp_crop_center_c(&expect, &packed);
+
+        memcpy(ref_base, src_base, frame);
+        memcpy(fast_base, src_base, frame);
+        inplace_images(&ref_dst, &ref_src, ref_base, width, height, cw, ch);
+        inplace_images(&fast_dst, &fast_src, fast_base, width, height, cw, ch);
+        yuv420sp_move_c(&ref_dst, &ref_src);
+        yuv420sp_move(&fast_dst, &fast_src);
+        bool match = !memcmp(ref_base, expect_base, size) &&
+                     !memcmp(fast_base, expect_base, size);
+        if (!match)
+            failures++;
+
+        /* repeats move whatever is in the window now; same work */
+        double ref_ms = run(yuv420sp_move_c, &ref_dst, &ref_src, iterations);
+        double fast_ms = run(yuv420sp_move, &fast_dst, &fast_src, iterations);
+        double mb = size / (1024.0 * 1024.0);
+
+        printf("%-14s %8s %10.3f %10.3f %10.1f %10.1f\n",
+               crops[n].name, match ? "ok" : "FAIL", ref_ms, fast_ms,
+               mb * 1000.0 / ref_ms, mb * 1000.0 / fast_ms);
+    }
+    free(ref_base);
+    free(fast_base);
+    free(expect_base);
+
+    free(src_base);
+    return failures ? 1 : 0;
+}